@@ -0,0 +1,22 @@
+/* art--0.1--0.2.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION art UPDATE TO '0.2'" to load this file. \quit
+
+-- Indexes built by 0.1 have older on-disk format, they must be rebuilt
+-- with REINDEX after update.
+
+CREATE OPERATOR CLASS _art_uuid_ops
+DEFAULT FOR TYPE uuid USING art
+AS
+    OPERATOR        1       <,
+    OPERATOR        2       <=,
+    OPERATOR        3       =,
+    OPERATOR        4       >=,
+    OPERATOR        5       >,
+STORAGE uuid;
+
+CREATE FUNCTION art_reorganize(regclass)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
@@ -9,8 +9,10 @@
 #include "postgres.h"
 
 #include "access/amapi.h"
+#include "access/reloptions.h"
 #include "commands/vacuum.h"
 #include "utils/guc.h"
+#include "utils/rel.h"
 
 #include "art.h"
 
@@ -18,24 +20,35 @@ PG_MODULE_MAGIC;
 
 /* GUC variables */
 double page_leaf_insert_treshold = 0.8f;
-bool update_parent_iptr = true;
 int build_max_memory = 4000U;
+int bitmap_leaf_threshold = 8192;
+bool subtree_node_placement = true;
+int bucket_max_keys = 16;
+bool fast_update = false;
+int pending_list_limit = 4096;
+bool insert_combining = true;
+
+/* Kind of ART storage parameters */
+static relopt_kind art_relopt_kind;
+
+static relopt_enum_elt_def artPlacementValues[] =
+{
+	{"tail", ART_PLACEMENT_TAIL},
+	{"subtree", ART_PLACEMENT_SUBTREE},
+	{(const char *) NULL}
+};
+
+static relopt_enum_elt_def artOnOffValues[] =
+{
+	{"off", ART_OPTION_OFF},
+	{"on", ART_OPTION_ON},
+	{(const char *) NULL}
+};
 
 void
 _PG_init(void)
 {
 
-	DefineCustomBoolVariable("art.update_parent_iptr",
-							 "Keep parent node pointer updated",
-							 NULL,
-							 &update_parent_iptr,
-							 true,
-							 PGC_USERSET,
-							 0,
-							 NULL,
-							 NULL,
-							 NULL);
-
 	DefineCustomRealVariable("art.page_leaf_insert_treshold",
 							 "Sets the leaf insert page treshold",
 							 "Valid range is 0.0 .. 1.0.",
@@ -60,6 +73,120 @@ _PG_init(void)
 							NULL,
 							NULL,
 							NULL);
+
+	DefineCustomIntVariable("art.bitmap_leaf_threshold",
+							"Number of key TIDs after which leaf is stored as bitmap",
+							"Zero disables bitmap leaves.",
+							&bitmap_leaf_threshold,
+							8192,
+							0,
+							PG_INT32_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("art.subtree_node_placement",
+							 "Place new inner nodes on their parent node page",
+							 "Otherwise nodes are appended to tail node page.",
+							 &subtree_node_placement,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("art.bucket_max_keys",
+							"Number of keys up to which subtree is stored as sorted bucket",
+							"Values below 2 disable buckets.",
+							&bucket_max_keys,
+							16,
+							0,
+							256,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("art.fast_update",
+							 "Append inserted keys to pending list merged into tree later",
+							 "Pending list is merged once it reaches art.pending_list_limit, and by VACUUM.",
+							 &fast_update,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("art.pending_list_limit",
+							"Size of pending list at which it is merged into tree",
+							NULL,
+							&pending_list_limit,
+							4096,
+							64,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("art.insert_combining",
+							 "Let one backend apply concurrent inserts into same index region",
+							 "Only available with art in shared_preload_libraries.",
+							 &insert_combining,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	art_relopt_kind = add_reloption_kind();
+
+	add_int_reloption(art_relopt_kind, "node_fillfactor",
+					  "Packs ART node pages only to this percentage",
+					  ART_OPTION_UNSET, ART_MIN_FILLFACTOR, 100,
+					  ShareUpdateExclusiveLock);
+	add_int_reloption(art_relopt_kind, "leaf_fillfactor",
+					  "Packs ART leaf pages only to this percentage",
+					  ART_OPTION_UNSET, ART_MIN_FILLFACTOR, 100,
+					  ShareUpdateExclusiveLock);
+	add_int_reloption(art_relopt_kind, "bitmap_leaf_threshold",
+					  "Number of key TIDs after which leaf is stored as bitmap",
+					  ART_OPTION_UNSET, 0, PG_INT32_MAX,
+					  ShareUpdateExclusiveLock);
+	add_int_reloption(art_relopt_kind, "bucket_max_keys",
+					  "Number of keys up to which subtree is stored as sorted bucket",
+					  ART_OPTION_UNSET, 0, 256,
+					  ShareUpdateExclusiveLock);
+	add_enum_reloption(art_relopt_kind, "node_placement",
+					   "Page on which new inner nodes are placed",
+					   artPlacementValues, ART_OPTION_UNSET,
+					   "Valid values are \"tail\" and \"subtree\".",
+					   ShareUpdateExclusiveLock);
+	add_enum_reloption(art_relopt_kind, "fast_update",
+					   "Enables fast update feature for this ART index",
+					   artOnOffValues, ART_OPTION_UNSET,
+					   "Valid values are \"on\" and \"off\".",
+					   AccessExclusiveLock);
+	add_int_reloption(art_relopt_kind, "pending_list_limit",
+					  "Maximum size of the pending list for this ART index, in kilobytes",
+					  ART_OPTION_UNSET, 64, MAX_KILOBYTES,
+					  ShareUpdateExclusiveLock);
+	add_enum_reloption(art_relopt_kind, "jump_table",
+					   "Builds ART index with jump table over first two key bytes",
+					   artOnOffValues, ART_OPTION_OFF,
+					   "Valid values are \"on\" and \"off\".",
+					   ShareUpdateExclusiveLock);
+
+	_art_select_key_kernels();
+	_art_xlog_register_rmgr();
+	_art_combine_register();
 }
 
 
@@ -93,6 +220,13 @@ _art_form_key(Relation index, ItemPointer iptr, Datum * values, bool * isnull)
 				if (VARATT_IS_EXTENDED(values[0]))
 					pfree((void*) datum);
 			}
+			else if (!indexTupleAttr->attbyval)
+			{
+				// Fixed length by reference types (uuid) are compared bytewise
+				res->key_len = indexTupleAttr->attlen;
+				res->key = palloc0(sizeof(uint8_t) * (res->key_len));
+				memcpy(res->key, DatumGetPointer(values[i]), res->key_len);
+			}
 			else
 			{
 				res->key_len = indexTupleAttr->attlen;
@@ -119,7 +253,131 @@ _art_compare_key(uint8 a, uint8 b)
 bytea *
 artoptions(Datum reloptions, bool validate)
 {
-  return NULL;
+	static const relopt_parse_elt tab[] = {
+		{"node_fillfactor", RELOPT_TYPE_INT, offsetof(ArtOptions, node_fillfactor)},
+		{"leaf_fillfactor", RELOPT_TYPE_INT, offsetof(ArtOptions, leaf_fillfactor)},
+		{"bitmap_leaf_threshold", RELOPT_TYPE_INT, offsetof(ArtOptions, bitmap_leaf_threshold)},
+		{"bucket_max_keys", RELOPT_TYPE_INT, offsetof(ArtOptions, bucket_max_keys)},
+		{"node_placement", RELOPT_TYPE_ENUM, offsetof(ArtOptions, node_placement)},
+		{"fast_update", RELOPT_TYPE_ENUM, offsetof(ArtOptions, fast_update)},
+		{"pending_list_limit", RELOPT_TYPE_INT, offsetof(ArtOptions, pending_list_limit)},
+		{"jump_table", RELOPT_TYPE_ENUM, offsetof(ArtOptions, jump_table)}
+	};
+
+	return (bytea *) build_reloptions(reloptions, validate, art_relopt_kind,
+									  sizeof(ArtOptions), tab, lengthof(tab));
+}
+
+
+/*
+ * Fillfactor of node or leaf pages, or ART_OPTION_UNSET when index keeps
+ * default layout.
+ */
+int
+_art_fillfactor(Relation index, uint8 pageType)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options == NULL)
+		return ART_OPTION_UNSET;
+
+	return (pageType & ART_LEAF_PAGE) ? options->leaf_fillfactor :
+		options->node_fillfactor;
+}
+
+
+/*
+ * Free space kept on node page when placing new node next to its parent,
+ * so nodes already on page have room to grow.
+ */
+Size
+_art_node_page_reserve(Relation index)
+{
+	int fillfactor = _art_fillfactor(index, ART_NODE_PAGE);
+
+	if (fillfactor == ART_OPTION_UNSET)
+		return ART_NODE_PAGE_RESERVE;
+
+	return ART_FILLFACTOR_RESERVE(fillfactor);
+}
+
+
+int
+_art_bitmap_leaf_threshold(Relation index)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options && options->bitmap_leaf_threshold != ART_OPTION_UNSET)
+		return options->bitmap_leaf_threshold;
+
+	return bitmap_leaf_threshold;
+}
+
+
+int
+_art_bucket_max_keys(Relation index)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options && options->bucket_max_keys != ART_OPTION_UNSET)
+		return options->bucket_max_keys;
+
+	return bucket_max_keys;
+}
+
+
+bool
+_art_subtree_node_placement(Relation index)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options && options->node_placement != ART_OPTION_UNSET)
+		return options->node_placement == ART_PLACEMENT_SUBTREE;
+
+	return subtree_node_placement;
+}
+
+
+bool
+_art_fast_update(Relation index)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options && options->fast_update != ART_OPTION_UNSET)
+		return options->fast_update == ART_OPTION_ON;
+
+	return fast_update;
+}
+
+
+/*
+ * Pending list size in kB at which it is merged into tree.
+ */
+int
+_art_pending_list_limit(Relation index)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options && options->pending_list_limit != ART_OPTION_UNSET)
+		return options->pending_list_limit;
+
+	return pending_list_limit;
+}
+
+
+/*
+ * Check if index is built with jump table. Layout is fixed by build, so
+ * it has no session default: every rebuild must produce same layout.
+ */
+bool
+_art_jump_table(Relation index)
+{
+	ArtOptions * options = ArtGetOptions(index);
+
+	if (options == NULL || options->jump_table != ART_OPTION_ON)
+		return false;
+
+	return _art_jump_table_supported(index);
 }
 
 
@@ -165,7 +423,7 @@ arthandler(PG_FUNCTION_ARGS)
 	amroutine->ambeginscan = artbeginscan;
 	amroutine->amrescan = artrescan;
 	amroutine->amgettuple = artgettuple;
-	amroutine->amgetbitmap = NULL;
+	amroutine->amgetbitmap = artgetbitmap;
 	amroutine->amendscan = artendscan;
 	amroutine->ammarkpos = NULL;
 	amroutine->amrestrpos = NULL;
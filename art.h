@@ -12,16 +12,25 @@
 
 #include "access/amapi.h"
 #include "access/generic_xlog.h"
+#include "access/htup_details.h"
 #include "access/itup.h"
+#include "access/transam.h"
 #include "access/xlog.h"
 #include "fmgr.h"
 #include "nodes/pathnodes.h"
+#include "nodes/tidbitmap.h"
+#include "port/pg_bitutils.h"
 #include "utils/hsearch.h"
 
 /* GUC */
 extern double page_leaf_insert_treshold;
-extern bool update_parent_iptr;
 extern int build_max_memory;
+extern int bitmap_leaf_threshold;
+extern bool subtree_node_placement;
+extern int bucket_max_keys;
+extern bool fast_update;
+extern int pending_list_limit;
+extern bool insert_combining;
 
 /* ART page information */
 
@@ -32,32 +41,114 @@ extern int build_max_memory;
 
 #define ART_NODE_PAGE (1 << 0)
 #define ART_LEAF_PAGE (1 << 1)
-
+#define ART_BITMAP_PAGE (1 << 2)
+#define ART_JUMP_PAGE (1 << 3)		/* node page holding jump nodes */
+#define ART_PENDING_PAGE (1 << 4)	/* pending list page */
+#define ART_PENDING_CLOSED (1 << 5)	/* pending page being merged, no appends */
+
+/* Free space left on node page for growth of nodes already on it */
+#define ART_NODE_PAGE_RESERVE (BLCKSZ / 10)
+
+/*
+ * Storage parameters (reloptions). Unset parameters are -1 and take value
+ * of the matching GUC, so indexes created without WITH (...) follow session.
+ * jump_table has no GUC, it defaults to off.
+ */
+typedef struct ArtOptions
+{
+	int32 vl_len_;				/* varlena header (do not touch directly!) */
+	int node_fillfactor;		/* percent of node page filled by inserts */
+	int leaf_fillfactor;		/* percent of leaf page filled by inserts */
+	int bitmap_leaf_threshold;	/* key TIDs after which leaf is bitmap */
+	int bucket_max_keys;		/* keys up to which subtree is bucket */
+	int node_placement;			/* ART_PLACEMENT_* */
+	int fast_update;			/* ART_OPTION_ON/OFF */
+	int pending_list_limit;		/* pending list size in kB */
+	int jump_table;				/* ART_OPTION_ON/OFF */
+} ArtOptions;
+
+#define ART_OPTION_UNSET (-1)
+#define ART_OPTION_OFF (0)
+#define ART_OPTION_ON (1)
+
+#define ART_PLACEMENT_TAIL (0)		/* new nodes go to tail node page */
+#define ART_PLACEMENT_SUBTREE (1)	/* new nodes go to parent's page */
+
+#define ArtGetOptions(index) ((ArtOptions *) (index)->rd_options)
+
+#define ART_MIN_FILLFACTOR (10)
+#define ART_FILLFACTOR_RESERVE(ff) ((Size) BLCKSZ * (100 - (ff)) / 100)
+
+/*
+ * Scans hold item pointers of nodes and leaves they haven't read yet
+ * without page lock or pin. Item removed from tree is marked dead and
+ * keeps its line pointer and contents until no scan that could have
+ * reached it is running, like nbtree pages deleted before recycling.
+ */
 typedef struct ArtDataPageOpaqueData
 {
 	uint8 page_flags;			/* page flags */
 	uint16 n_total; 			/* total number of items on page */
-	uint16 n_deleted;			/* number of deleted items */
-	uint16 deleted_item_size;	/* size of deleted items */
+	uint16 n_deleted;			/* number of items kept dead for scans */
+	uint16 deleted_item_size;	/* size of dead items */
+	uint16 remove_cycle;		/* bumped when items or TIDs are removed */
+	uint16 vacuum_cycle;		/* bulk delete cycle page got items moved in */
 	BlockNumber right_link;		/* next page if any */
+	FullTransactionId dead_xid;	/* next xid when item was last marked dead */
 } ArtDataPageOpaqueData;
 
 typedef ArtDataPageOpaqueData *ArtDataPageOpaque;
 
 typedef struct ArtPageCache
 {
-	BlockNumber blk_num; /* block number, or InvalidBlockNumber */
+	BlockNumber blk_num; /* block number, metadata block number if empty */
 	int	free_space; /* page's free space (could be obsolete!) */
 } ArtPageCache;
 
-/* Note: indexes in cachedPage[] match flag assignments for SpGistGetBuffer */
+/*
+ * Pages that got space freed by moved or deleted items. First half of
+ * cache is for node pages, second half for leaf pages.
+ */
 #define ART_CACHED_PAGES 8
 
+#define ART_PAGE_CACHE_FIRST(pageType) \
+	((pageType) == ART_NODE_PAGE ? 0 : ART_CACHED_PAGES / 2)
+
+/*
+ * Bulk delete sweeps pages in block order while inserts run. Pages that
+ * get items moved in during sweep are listed on metadata page, and are
+ * visited again. More pages than list holds make whole index revisited.
+ */
+#define ART_VACUUM_BLKS 64
+#define ART_VACUUM_BLKS_OVERFLOW (ART_VACUUM_BLKS + 1)
+
+/* Index layout flags, set at build */
+#define ART_META_JUMP_TABLE (1 << 0)
+
+/*
+ * Metadata page identifies index and its on disk format. Index built by
+ * release with other format must be rebuilt, indexes of 0.1 release have
+ * no version and are recognized by missing magic.
+ */
+#define ART_META_MAGIC 0x41525431
+#define ART_FORMAT_VERSION 2
+
 typedef struct ArtMetaDataPageOpaqueData
 {
+	uint32 magic;							/* ART_META_MAGIC */
+	uint32 version;							/* ART_FORMAT_VERSION */
 	ArtPageCache page_cache[ART_CACHED_PAGES];
 	BlockNumber last_internal_node_blk_num; /* Last internal node block number */
 	BlockNumber last_leaf_blk_num; 			/* Last leaf block number */
+	uint16 flags;							/* layout flags */
+	BlockNumber pending_head;				/* first pending list page */
+	BlockNumber pending_tail;				/* pending list page inserts append to */
+	BlockNumber pending_free;				/* first page freed by pending merge */
+	uint32 pending_pages;					/* number of pending list pages */
+	uint16 vacuum_cycle;					/* cycle of running bulk delete, 0 if none */
+	uint16 last_vacuum_cycle;				/* last cycle used */
+	uint16 num_vacuum_blks;					/* pages listed for bulk delete to revisit */
+	BlockNumber vacuum_blks[ART_VACUUM_BLKS];
 } ArtMetaDataPageOpaqueData;
 
 typedef ArtMetaDataPageOpaqueData *ArtMetaDataPageOpaque;
@@ -71,6 +162,23 @@ typedef struct ArtItemList
 	ItemPointerData iptr[FLEXIBLE_ARRAY_MEMBER];
 } ArtItemList;
 
+/*
+ * Pending list entry, full key of inserted tuple with its heap TID.
+ */
+typedef struct ArtPendingItem
+{
+	ItemPointerData iptr;
+	uint16 key_len;
+	uint8 key[FLEXIBLE_ARRAY_MEMBER];
+} ArtPendingItem;
+
+#define ART_PENDING_ITEM_SIZE(keyLen) (offsetof(ArtPendingItem, key) + (keyLen))
+
+/* Largest entry that fits on empty pending page */
+#define ART_PENDING_ITEM_MAX_SIZE \
+	(BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(ArtDataPageOpaqueData)) - \
+	 sizeof(ItemIdData))
+
 typedef struct ArtTuple
 {
 	uint32_t key_len;
@@ -86,30 +194,147 @@ typedef enum ArtNodeType {
 	NODE_16,
 	NODE_48,
 	NODE_256,
+	NODE_BUCKET,
 } ArtNodeType;
 
-#define MAX_PREFIX_KEY_LEN 8
-
+/*
+ * Node header. Whole compressed path (prefix) of node is stored after
+ * node body, so node items are variable length.
+ *
+ * Nodes are modified in memory form (ArtNode4 .. ArtNode256) with full
+ * ItemPointerData children, and stored on pages in compact form
+ * (ArtPageNodeSorted, ArtPageNode256), see below.
+ */
 typedef struct ArtNodeHeader
 {
 	uint8 node_type;				// Should be first header member to match leaf structure
-	ItemPointerData parent_iptr;	// Should be second header member to match leaf structure
-	uint8 num_children;
-	uint8 prefix_key_len;
-	uint8 prefix[MAX_PREFIX_KEY_LEN];
+	uint8 flags;					// Should be second header member to match leaf structure
+	uint16 num_children;
+	uint16 prefix_key_len;
+	uint16 num_far;					/* far child table entries, page form only */
 } ArtNodeHeader;
 
+/*
+ * Node page item is sized for all children being far, so node never grows
+ * on its page. Used for root node that can't be moved.
+ */
+#define ART_NODE_RESERVED (1 << 0)
+
+#define ART_NODE_PREFIX(n) \
+	((uint8 *) (n) + _art_node_body_size(((ArtNodeHeader *) (n))->node_type))
+
 typedef struct ArtNodeLeaf
 {
 	uint8 node_type;
-	ItemPointerData parent_iptr;
+	uint8 flags;					/* leaf flags, fits into header padding */
 	ItemPointerData next_leaf_iptr;
 	ItemPointerData last_leaf_iptr;
-	uint16 key_len;
-	uint16 num_items;
-	uint8 data[FLEXIBLE_ARRAY_MEMBER];
+	uint16 key_offset;				/* key bytes before offset are implied by path */
+	uint16 key_len;					/* length of stored key suffix */
+	uint16 num_items;				/* number of TIDs in posting list */
+	uint16 posting_size;			/* size of compressed posting list */
+	uint8 data[FLEXIBLE_ARRAY_MEMBER];	/* key suffix followed by posting list */
 } ArtNodeLeaf;
 
+/* Full key length, and key byte at absolute position pos >= key_offset */
+#define ART_LEAF_KEY_LEN(leaf) ((leaf)->key_offset + (leaf)->key_len)
+#define ART_LEAF_KEY_BYTE(leaf, pos) ((leaf)->data[(pos) - (leaf)->key_offset])
+
+#define ART_LEAF_POSTING(leaf) ((leaf)->data + (leaf)->key_len)
+
+/* Worst case varbyte encoded size of posting list with n items */
+#define ART_POSTING_MAX_SIZE(n) ((n) * 7)
+
+/* Leaf TIDs are stored in bitmap pages instead of posting list */
+#define ART_LEAF_BITMAP (1 << 0)
+
+/*
+ * Bitmap leaf stores reference to its bitmap pages in place of
+ * posting list.
+ */
+typedef struct ArtLeafBitmap
+{
+	BlockNumber first_blk;			/* first bitmap page */
+	BlockNumber last_blk;			/* last bitmap page, heap order appends */
+} ArtLeafBitmap;
+
+#define ART_BITMAP_CONTAINER_BITMAP (1 << 0)
+
+#define ART_BITMAP_WORDS \
+	(MaxHeapTuplesPerPage / (sizeof(uint16) * BITS_PER_BYTE) + 1)
+
+/* Array containers never get bigger than bitmap */
+#define ART_BITMAP_ARRAY_MAX ART_BITMAP_WORDS
+
+/*
+ * Bitmap page item holding offsets of single heap block, either as
+ * sorted array or as offset bitmap.
+ */
+typedef struct ArtBitmapContainer
+{
+	BlockNumber heap_blk;			/* heap block number */
+	uint16 num_items;				/* number of offsets */
+	uint16 flags;					/* container flags */
+	uint16 data[FLEXIBLE_ARRAY_MEMBER];
+} ArtBitmapContainer;
+
+/*
+ * Keys are either fixed length or zero terminated, so key that ends at
+ * child byte is fully determined by path to that child. Such child slot
+ * holds heap TID of single key instead of pointing to leaf, marked by
+ * high offset bit that is never set for index or heap offsets.
+ */
+#define ART_CHILD_INLINE_TID 0x8000
+
+#define ART_CHILD_IS_INLINE(iptr) \
+	((ItemPointerGetOffsetNumberNoCheck(iptr) & ART_CHILD_INLINE_TID) != 0)
+
+#define ART_CHILD_SET_INLINE(slot, tid) \
+	ItemPointerSet((slot), ItemPointerGetBlockNumber(tid), \
+				   ItemPointerGetOffsetNumber(tid) | ART_CHILD_INLINE_TID)
+
+#define ART_CHILD_GET_INLINE(slot, tid) \
+	ItemPointerSet((tid), ItemPointerGetBlockNumberNoCheck(slot), \
+				   ItemPointerGetOffsetNumberNoCheck(slot) & ~ART_CHILD_INLINE_TID)
+
+/*
+ * Bucket stores small subtree as sorted array of key suffixes, each with
+ * child that is either inline TID or leaf, so whole subtree is searched
+ * within single item. Suffixes follow common prefix of bucket keys, kept
+ * as node prefix. Body is header, entry offsets, prefix and entries, and
+ * is same in memory and on page. Bucket bursts into radix nodes once it
+ * has more than art.bucket_max_keys keys or grows over ART_BUCKET_MAX_SIZE.
+ */
+typedef struct ArtBucketEntry
+{
+	ItemPointerData child;			/* inline TID or leaf */
+	uint16 key_len;					/* length of key suffix */
+	uint8 key[FLEXIBLE_ARRAY_MEMBER];
+} ArtBucketEntry;
+
+#define ART_BUCKET_MAX_SIZE (BLCKSZ / 8)
+
+#define ART_BUCKET_ENTRY_SIZE(len) SHORTALIGN(offsetof(ArtBucketEntry, key) + (len))
+
+#define ART_BUCKET_OFFSETS(n) \
+	((uint16 *) ((char *) (n) + sizeof(ArtNodeHeader)))
+
+#define ART_BUCKET_PREFIX(n) \
+	((uint8 *) (ART_BUCKET_OFFSETS(n) + ((ArtNodeHeader *) (n))->num_children))
+
+#define ART_BUCKET_ENTRY(n, i) \
+	((ArtBucketEntry *) ((char *) (n) + ART_BUCKET_OFFSETS(n)[i]))
+
+/*
+ * Key of bucket being built, key bytes start at bucket depth.
+ */
+typedef struct ArtBucketItem
+{
+	const uint8 * key;
+	int key_len;
+	ItemPointerData child;
+} ArtBucketItem;
+
 typedef struct ArtNode4
 {
 	ArtNodeHeader node;
@@ -124,9 +349,49 @@ typedef struct ArtNode16
 	ItemPointerData children[16];
 } ArtNode16;
 
+/*
+ * Bitmap of key bytes that have child in NODE_48 and NODE_256, so that
+ * children are enumerated by set bits instead of probing each key byte.
+ */
+#define ART_KEY_BITMAP_WORDS (256 / 64)
+
+#define ART_KEY_BITMAP_SET(bm, k) \
+	((bm)[(k) >> 6] |= UINT64CONST(1) << ((k) & 63))
+#define ART_KEY_BITMAP_CLEAR(bm, k) \
+	((bm)[(k) >> 6] &= ~(UINT64CONST(1) << ((k) & 63)))
+#define ART_KEY_BITMAP_TEST(bm, k) \
+	(((bm)[(k) >> 6] & (UINT64CONST(1) << ((k) & 63))) != 0)
+
+/*
+ * Get first key byte >= key that is set in bitmap, -1 if there is none.
+ */
+static inline int
+_art_key_bitmap_next(const uint64 * bm, int key)
+{
+	int word = key >> 6;
+	uint64 bits;
+
+	if (key > 255)
+		return -1;
+
+	bits = bm[word] & (~UINT64CONST(0) << (key & 63));
+
+	while (bits == 0)
+	{
+		if (++word == ART_KEY_BITMAP_WORDS)
+			return -1;
+		bits = bm[word];
+	}
+
+	return (word << 6) + pg_rightmost_one_pos64(bits);
+}
+
 typedef struct ArtNode48
 {
 	ArtNodeHeader node;
+	uint64 present[ART_KEY_BITMAP_WORDS];
+	uint64 used_slots;		/* children[] slots in use, free slot is lowest
+							 * clear bit */
 	uint8 keys[256];
 	ItemPointerData children[48];
 } ArtNode48;
@@ -134,9 +399,93 @@ typedef struct ArtNode48
 typedef struct ArtNode256 
 {
 	ArtNodeHeader node;
+	uint64 present[ART_KEY_BITMAP_WORDS];
 	ItemPointerData children[256];
 } ArtNode256;
 
+/*
+ * On page node form. Child slot is 2 bytes: zero for empty slot, offset
+ * of child item if child is on same page as node, or ART_SLOT_FAR flag
+ * with index into far child table for children on other pages and
+ * inline TIDs. Far table follows node body, prefix follows far table.
+ */
+#define ART_SLOT_EMPTY 0
+#define ART_SLOT_FAR 0x8000
+
+#define ART_SLOT_IS_FAR(s) (((s) & ART_SLOT_FAR) != 0)
+#define ART_SLOT_FAR_INDEX(s) ((s) & ~ART_SLOT_FAR)
+
+/*
+ * NODE_4, NODE_16 and NODE_48 are stored sized for children they have:
+ * sorted key bytes, padded to slot alignment, followed by child slots.
+ * NODE_256 keeps slot per key byte and bitmap of keys in use.
+ */
+typedef struct ArtPageNodeSorted
+{
+	ArtNodeHeader node;
+	uint8 keys[FLEXIBLE_ARRAY_MEMBER];
+} ArtPageNodeSorted;
+
+#define ART_PAGE_NODE_SLOTS(n) \
+	((uint16 *) (((ArtPageNodeSorted *) (n))->keys + \
+				 TYPEALIGN(sizeof(uint16), ((ArtNodeHeader *) (n))->num_children)))
+
+typedef struct ArtPageNode256
+{
+	ArtNodeHeader node;
+	uint64 present[ART_KEY_BITMAP_WORDS];
+	uint16 children[256];
+} ArtPageNode256;
+
+#define ART_PAGE_NODE_FAR(n) \
+	((ItemPointerData *) ((char *) (n) + _art_page_node_body_size((ArtNodeHeader *) (n))))
+
+#define ART_PAGE_NODE_PREFIX(n) \
+	((uint8 *) (ART_PAGE_NODE_FAR(n) + ((ArtNodeHeader *) (n))->num_far))
+
+/*
+ * Jump table. With ART_META_JUMP_TABLE index has reserved NODE_256 for
+ * each first key byte, stored at fixed position on dedicated pages right
+ * after first leaf page. Together they are table of 65536 children for
+ * first two key bytes, lookups compute position of jump node from first
+ * key byte and skip root. Root still points to jump nodes, so full tree
+ * walks are not affected.
+ */
+#define ART_JUMP_FIRST_BLKNO (ART_LEAF_NODE_BLKNO + 1)
+
+#define ART_JUMP_NODE_SIZE \
+	MAXALIGN(sizeof(ArtPageNode256) + 256 * sizeof(ItemPointerData))
+
+#define ART_JUMP_NODES_PER_PAGE \
+	((BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(ArtDataPageOpaqueData))) / \
+	 (ART_JUMP_NODE_SIZE + sizeof(ItemIdData)))
+
+#define ART_JUMP_NUM_PAGES \
+	((256 + ART_JUMP_NODES_PER_PAGE - 1) / ART_JUMP_NODES_PER_PAGE)
+
+#define ART_JUMP_NODE_BLKNO(keyByte) \
+	(ART_JUMP_FIRST_BLKNO + (keyByte) / ART_JUMP_NODES_PER_PAGE)
+#define ART_JUMP_NODE_ITEM(keyByte) \
+	((keyByte) % ART_JUMP_NODES_PER_PAGE + FirstOffsetNumber)
+
+/*
+ * Key byte search kernels. Keys are read in blocks of ART_KEY_BLOCK bytes,
+ * up to ART_KEY_BLOCKS_MAX blocks, result has bit set for each matching
+ * key position. Bits of positions past actual keys are garbage and are
+ * masked by caller. Implementation is chosen for CPU in _PG_init.
+ */
+#define ART_KEY_BLOCK 16
+#define ART_KEY_BLOCKS_MAX 4
+
+typedef struct ArtKeyKernels
+{
+	const char * name;
+	uint64 (*eq_mask) (const uint8 * keys, int numBlocks, uint8 key);
+	uint64 (*le_mask) (const uint8 * keys, int numBlocks, uint8 key);
+} ArtKeyKernels;
+
+extern const ArtKeyKernels * art_key_kernels;
+
 
 typedef struct ArtPageEntry
 {
@@ -163,6 +512,14 @@ extern void _PG_init(void);
 extern ArtTuple * _art_form_key(Relation index, ItemPointer iptr,
 								Datum *values, bool *isnull);
 extern int32 _art_compare_key(uint8 a, uint8 b);
+extern int _art_fillfactor(Relation index, uint8 pageType);
+extern Size _art_node_page_reserve(Relation index);
+extern int _art_bitmap_leaf_threshold(Relation index);
+extern int _art_bucket_max_keys(Relation index);
+extern bool _art_subtree_node_placement(Relation index);
+extern bool _art_fast_update(Relation index);
+extern int _art_pending_list_limit(Relation index);
+extern bool _art_jump_table(Relation index);
 
 
 /* art_insert.c */
@@ -170,28 +527,75 @@ extern int32 _art_compare_key(uint8 a, uint8 b);
 extern void _art_init_page_hash(HTAB ** pageHashLookup);
 extern void _art_add_page_hash(HTAB * pageHashLookup, BlockNumber blockNumber, ArtPageEntry * pageEntry);
 extern ArtPageEntry * _art_get_page_hash(HTAB * pageHashLookup, BlockNumber blockNumber);
+extern void _art_cleanup_tree(Relation index);
+extern void _art_insert_tuples(Relation index, ArtTuple * tuples, int ntuples);
 
 /* art_utils.c */
-extern ArtNodeHeader * _art_alloc_node(uint8 type);
+extern ArtNodeHeader * _art_alloc_node(uint8 type, uint16 prefixLen);
+extern Size _art_node_body_size(uint8 type);
 extern Size _art_node_size(ArtNodeHeader * node);
+extern Size _art_page_node_body_size(const ArtNodeHeader * node);
+extern Size _art_page_node_size(const ArtNodeHeader * node, BlockNumber blkNum);
+extern ArtNodeHeader * _art_page_node_encode(const ArtNodeHeader * node, BlockNumber blkNum);
+extern ArtNodeHeader * _art_page_node_decode(const ArtNodeHeader * pageNode, BlockNumber blkNum);
+extern bool _art_page_node_set_child(ArtNodeHeader * pageNode, BlockNumber blkNum,
+									 uint8 key, ItemPointer child, bool add);
+extern bool _art_page_node_find_child(const ArtNodeHeader * n, BlockNumber blkNum,
+									  uint8 key, ItemPointer child);
 extern void _art_add_queue_itemptr(pairingheap * queue, ItemPointer iptr, bool checkRange);
 extern ItemPointer _art_find_child_equal(ArtNodeHeader * n, uint8 key);
-extern void _art_find_child_range(ArtNodeHeader * n, uint8 key,
+extern int _art_node_children(const ArtNodeHeader * n, uint8 * keys,
+							  ItemPointerData * children);
+extern void _art_node_remove_child(ArtNodeHeader * n, uint8 key);
+extern void _art_find_child_range(const ArtNodeHeader * n, BlockNumber blkNum, uint8 key,
 								  StrategyNumber skStrategy,
 								  pairingheap * childrenQueue,
 								  bool checkRange);
-extern ArtNodeLeaf * _art_minimum_leaf(Relation index, ArtNodeHeader * n, 
-				  					   HTAB * pageHashLookup, dlist_head * pagListHead);
 extern ArtNodeHeader * _art_get_node_from_iptr(Relation index, ItemPointer iptr, 
 											   Buffer * nodeBuffer, int bufferLockMode);
+extern ArtNodeHeader * _art_page_get_node(Relation index, Page page, ItemPointer iptr);
 extern void _art_copy_header(ArtNodeHeader *dest, ArtNodeHeader *src);
+extern ArtNodeHeader * _art_node_set_prefix(ArtNodeHeader *n, const uint8 *prefix,
+											uint16 prefixLen);
 extern int _art_leaf_matches(const ArtNodeLeaf * n, const uint8 * key, uint16 key_len);
-extern int _art_longest_common_prefix(ArtNodeLeaf *l1, ArtNodeLeaf *l2, int depth);
-extern int _art_prefix_mismatch(Relation index, ArtNodeHeader *node,
-								HTAB * pageHashLookup, dlist_head * pageHeadList,
-								const uint8 *key, uint32 key_len, int depth);
-extern int _art_check_prefix(const ArtNodeHeader *n, const uint8 *key, int key_len,
-							 int depth);
+extern int32 _art_leaf_compare(const ArtNodeLeaf * n, const uint8 * key, uint16 key_len);
+extern int _art_longest_common_prefix(const ArtNodeLeaf *l, const uint8 *key, int key_len,
+									  int depth);
+extern int _art_check_prefix(const uint8 *prefix, int prefix_len,
+							 const uint8 *key, int key_len, int depth);
+extern Size _art_bucket_size(const ArtNodeHeader * bucket);
+extern Size _art_bucket_build_size(uint16 prefixLen, const ArtBucketItem * items,
+								   int nitems, int skip);
+extern ArtNodeHeader * _art_bucket_build(const uint8 * prefix, uint16 prefixLen,
+										 const ArtBucketItem * items, int nitems,
+										 int skip);
+extern int32 _art_bucket_compare(const ArtNodeHeader * bucket, int i,
+								 const uint8 * key, int key_len, int depth);
+extern int _art_bucket_find(const ArtNodeHeader * bucket, const uint8 * key,
+							int key_len, int depth, bool * found);
+extern void _art_select_key_kernels(void);
+extern int _art_keys_find(const uint8 * keys, int numKeys, uint8 key);
+extern int _art_keys_lower_bound(const uint8 * keys, int numKeys, uint8 key);
+extern int _art_keys_upper_bound(const uint8 * keys, int numKeys, uint8 key);
+
+/* art_postinglist.c */
+extern int _art_posting_encode(const ItemPointerData *items, int nitems, uint8 *dest);
+extern int _art_posting_decode(const uint8 *src, int nbytes, ItemPointerData *dest);
+extern void _art_posting_last(const uint8 *src, int nbytes, ItemPointer last);
+extern int _art_posting_append(uint8 *dest, const ItemPointer last, const ItemPointer item);
+extern int _art_posting_merge_item(ItemPointerData *items, int nitems, const ItemPointer item);
+
+/* art_bitmap.c */
+extern Size _art_bitmap_container_size(const ArtBitmapContainer * c);
+extern ArtBitmapContainer * _art_bitmap_container_create(BlockNumber heapBlk,
+														 OffsetNumber off);
+extern ArtBitmapContainer * _art_bitmap_container_build(BlockNumber heapBlk,
+														const OffsetNumber * offsets,
+														int nitems);
+extern ArtBitmapContainer * _art_bitmap_container_add(ArtBitmapContainer * c,
+													  OffsetNumber off);
+extern int _art_bitmap_container_decode(const ArtBitmapContainer * c,
+										ItemPointerData * dest);
 
 /* art_pageops.c */
 extern void _art_init_data_page(Page page, uint8 flags);
@@ -206,6 +610,36 @@ extern dlist_node * _art_load_page(Relation index, dlist_head * pageListHead,
 									 bool * isNewPageEntry);
 extern ArtPageEntry * _art_copy_page(Relation index, BlockNumber blockNum);
 extern void _art_flush_pages(Relation index, dlist_head * pageListHead);
+extern uint16 _art_get_metadata_flags(Relation index);
+extern bool _art_page_prune(Relation index, Page page);
+extern bool _art_page_cache_put(ArtMetaDataPageOpaque metadata, BlockNumber blkNum, Page page);
+extern bool _art_jump_table_supported(Relation index);
+
+/* art_pending.c */
+extern bool _art_pending_insert(Relation index, ArtTuple * artTuple);
+extern void _art_pending_merge(Relation index, bool wait);
+extern int32 _art_pending_compare(const ArtPendingItem * item, const uint8 * key,
+								  uint32 keyLen);
+
+/* art_combine.c */
+extern void _art_combine_register(void);
+extern bool _art_combine_publish(Relation index, ArtTuple * artTuple, int * combineQueue);
+extern void _art_combine_apply(Relation index, int queue);
+extern void _art_combine_abort(int queue);
+
+/* art_xlog.c */
+extern void _art_xlog_register_rmgr(void);
+extern void _art_xlog_begin(Relation index);
+extern bool _art_xlog_in_progress(void);
+extern void _art_xlog_register_buffer(Buffer buffer, bool isNew);
+extern Buffer _art_xlog_read_buffer(Relation index, BlockNumber blkNum, bool conditional);
+extern bool _art_xlog_release_buffer(Buffer buffer);
+extern void _art_xlog_set_latest_removed_xid(TransactionId xid);
+extern bool _art_xlog_can_remove_tids(Relation index);
+extern void _art_xlog_flush(void);
+extern void _art_xlog_flush_if_full(void);
+extern void _art_xlog_finish(void);
+extern void _art_xlog_abort(void);
 
 /* index access method interface functions */
 extern IndexBuildResult *artbuild(Relation heap, Relation index,
@@ -232,6 +666,7 @@ extern IndexScanDesc artbeginscan(Relation r, int nkeys, int norderbys);
 extern void artrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
 					  ScanKey orderbys, int norderbys);
 extern bool artgettuple(IndexScanDesc scan, ScanDirection dir);
+extern int64 artgetbitmap(IndexScanDesc scan, TIDBitmap *tbm);
 extern void artendscan(IndexScanDesc scan);
 
 #endif
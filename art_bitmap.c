@@ -0,0 +1,191 @@
+/*-------------------------------------------------------------------------
+ *
+ * art_bitmap.c
+ *		Routines for dealing with bitmap containers of ART bitmap leaves.
+ *
+ * Keys with a very large number of TIDs are stored as a block level
+ * bitmap spread over dedicated bitmap pages. Every page holds containers
+ * sorted by heap block number, one container per heap block. Same as in
+ * roaring bitmaps, sparse containers keep a sorted array of offsets and
+ * switch to a fixed size offset bitmap once array would get bigger than
+ * the bitmap.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "port/pg_bitutils.h"
+
+#include "art.h"
+
+#define BITMAP_WORD_BITS (sizeof(uint16) * BITS_PER_BYTE)
+
+static inline bool
+_container_is_bitmap(const ArtBitmapContainer * c)
+{
+	return (c->flags & ART_BITMAP_CONTAINER_BITMAP) != 0;
+}
+
+static inline bool
+_bitmap_test(const uint16 * words, OffsetNumber off)
+{
+	return (words[off / BITMAP_WORD_BITS] & (1 << (off % BITMAP_WORD_BITS))) != 0;
+}
+
+static inline void
+_bitmap_set(uint16 * words, OffsetNumber off)
+{
+	words[off / BITMAP_WORD_BITS] |= (1 << (off % BITMAP_WORD_BITS));
+}
+
+Size
+_art_bitmap_container_size(const ArtBitmapContainer * c)
+{
+	if (_container_is_bitmap(c))
+		return offsetof(ArtBitmapContainer, data) + sizeof(uint16) * ART_BITMAP_WORDS;
+
+	return offsetof(ArtBitmapContainer, data) + sizeof(uint16) * c->num_items;
+}
+
+/*
+ * Create new array container with single offset.
+ */
+ArtBitmapContainer *
+_art_bitmap_container_create(BlockNumber heapBlk, OffsetNumber off)
+{
+	ArtBitmapContainer * c =
+		(ArtBitmapContainer *) palloc0(offsetof(ArtBitmapContainer, data) + sizeof(uint16));
+
+	c->heap_blk = heapBlk;
+	c->num_items = 1;
+	c->flags = 0;
+	c->data[0] = off;
+
+	return c;
+}
+
+/*
+ * Create container from sorted array of offsets that belong to heap block.
+ */
+ArtBitmapContainer *
+_art_bitmap_container_build(BlockNumber heapBlk, const OffsetNumber * offsets, int nitems)
+{
+	ArtBitmapContainer * c;
+
+	if (nitems > ART_BITMAP_ARRAY_MAX)
+	{
+		c = (ArtBitmapContainer *) palloc0(offsetof(ArtBitmapContainer, data) +
+										   sizeof(uint16) * ART_BITMAP_WORDS);
+		c->flags = ART_BITMAP_CONTAINER_BITMAP;
+
+		for (int i = 0; i < nitems; i++)
+			_bitmap_set(c->data, offsets[i]);
+	}
+	else
+	{
+		c = (ArtBitmapContainer *) palloc0(offsetof(ArtBitmapContainer, data) +
+										   sizeof(uint16) * nitems);
+		c->flags = 0;
+
+		for (int i = 0; i < nitems; i++)
+			c->data[i] = offsets[i];
+	}
+
+	c->heap_blk = heapBlk;
+	c->num_items = nitems;
+
+	return c;
+}
+
+/*
+ * Add offset to container. Bitmap containers, or containers that already
+ * have offset, are modified in place and NULL is returned. Otherwise new
+ * container is returned and caller should replace old one with it.
+ */
+ArtBitmapContainer *
+_art_bitmap_container_add(ArtBitmapContainer * c, OffsetNumber off)
+{
+	ArtBitmapContainer * new_c;
+	int idx;
+
+	if (_container_is_bitmap(c))
+	{
+		if (!_bitmap_test(c->data, off))
+		{
+			_bitmap_set(c->data, off);
+			c->num_items++;
+		}
+		return NULL;
+	}
+
+	for (idx = 0; idx < c->num_items; idx++)
+	{
+		if (c->data[idx] == off)
+			return NULL;
+
+		if (c->data[idx] > off)
+			break;
+	}
+
+	// Array would be bigger than bitmap, convert it
+	if (c->num_items + 1 > ART_BITMAP_ARRAY_MAX)
+	{
+		new_c = (ArtBitmapContainer *) palloc0(offsetof(ArtBitmapContainer, data) +
+											   sizeof(uint16) * ART_BITMAP_WORDS);
+		new_c->flags = ART_BITMAP_CONTAINER_BITMAP;
+
+		for (int i = 0; i < c->num_items; i++)
+			_bitmap_set(new_c->data, c->data[i]);
+
+		_bitmap_set(new_c->data, off);
+	}
+	else
+	{
+		new_c = (ArtBitmapContainer *) palloc0(offsetof(ArtBitmapContainer, data) +
+											   sizeof(uint16) * (c->num_items + 1));
+		new_c->flags = 0;
+
+		memcpy(new_c->data, c->data, sizeof(uint16) * idx);
+		new_c->data[idx] = off;
+		memcpy(new_c->data + idx + 1, c->data + idx,
+			   sizeof(uint16) * (c->num_items - idx));
+	}
+
+	new_c->heap_blk = c->heap_blk;
+	new_c->num_items = c->num_items + 1;
+
+	return new_c;
+}
+
+/*
+ * Decode container into dest array of TIDs. Returns number of TIDs.
+ */
+int
+_art_bitmap_container_decode(const ArtBitmapContainer * c, ItemPointerData * dest)
+{
+	int n = 0;
+
+	if (_container_is_bitmap(c))
+	{
+		for (int w = 0; w < ART_BITMAP_WORDS; w++)
+		{
+			uint16 word = c->data[w];
+
+			while (word)
+			{
+				int bit = pg_rightmost_one_pos32(word);
+
+				ItemPointerSet(&dest[n++], c->heap_blk, w * BITMAP_WORD_BITS + bit);
+				word &= word - 1;
+			}
+		}
+	}
+	else
+	{
+		for (int i = 0; i < c->num_items; i++)
+			ItemPointerSet(&dest[n++], c->heap_blk, c->data[i]);
+	}
+
+	return n;
+}
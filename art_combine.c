@@ -0,0 +1,465 @@
+/*-------------------------------------------------------------------------
+ *
+ * art_combine.c
+ *		Combining of concurrent inserts into same index region.
+ *
+ * Inserts of keys that differ only in their last bytes descend to same
+ * nodes and leaves, and under concurrency queue on same page locks. Such
+ * inserts share combining queue in shared memory, chosen by index and
+ * leading key bytes. First insert of queue becomes its combiner, others
+ * of same index publish key and TID into queue slot and wait. Inserts into
+ * other indexes whose region maps to same queue insert directly. Combiner inserts its own
+ * tuple and then every tuple published for its index, so hot pages are
+ * changed by one backend at a time while others sleep instead of spinning
+ * on buffer locks. Publisher whose tuple could not be applied inserts it
+ * itself.
+ *
+ * Queues live in shared memory, so combining is only available when
+ * library is in shared_preload_libraries.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "common/hashfn.h"
+#include "miscadmin.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/rel.h"
+#include "utils/wait_event.h"
+
+#include "art.h"
+
+#define ART_COMBINE_QUEUES 64
+#define ART_COMBINE_SLOTS 16
+
+/* Keys up to this size are published, longer keys are inserted directly */
+#define ART_COMBINE_KEY_SIZE 64
+
+/* Leading key bytes choosing queue, last key byte is never used */
+#define ART_COMBINE_REGION_BYTES 8
+
+/* Combiner applies at most this many published tuples before leaving */
+#define ART_COMBINE_MAX_APPLY (ART_COMBINE_SLOTS * 4)
+
+typedef enum ArtCombineSlotState
+{
+	ART_COMBINE_EMPTY = 0,
+	ART_COMBINE_PUBLISHED,		/* waiting for combiner */
+	ART_COMBINE_CLAIMED,		/* being inserted by combiner */
+	ART_COMBINE_DONE,			/* inserted, publisher frees slot */
+	ART_COMBINE_FAILED			/* not inserted, publisher inserts itself */
+} ArtCombineSlotState;
+
+typedef struct ArtCombineSlot
+{
+	uint8 state;
+	bool abandoned;				/* publisher left, combiner frees slot */
+	int owner;					/* pgprocno of publisher */
+	Oid db_id;
+	Oid index_id;
+	ItemPointerData iptr;
+	uint16 key_len;
+	uint8 key[ART_COMBINE_KEY_SIZE];
+} ArtCombineSlot;
+
+typedef struct ArtCombineQueue
+{
+	slock_t mutex;				/* protects combiner and slot states */
+	int combiner;				/* pgprocno of combiner, -1 if there is none */
+	Oid db_id;					/* database of combiner's index */
+	Oid index_id;				/* index combiner applies slots of */
+	ConditionVariable cv;		/* slot completed or combiner left */
+	ArtCombineSlot slots[ART_COMBINE_SLOTS];
+} ArtCombineQueue;
+
+static ArtCombineQueue * art_combine_queues = NULL;
+static bool art_combine_exit_registered = false;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size _art_combine_shmem_size(void);
+static void _art_combine_shmem_request(void);
+static void _art_combine_shmem_startup(void);
+static int _art_combine_queue_number(Relation index, ArtTuple * artTuple);
+static bool _art_combine_wait(ArtCombineQueue * q, int queue, ArtCombineSlot * slot,
+							  int * combineQueue);
+static void _art_combine_complete(ArtCombineQueue * q, ArtCombineSlot * slot,
+								  uint8 state);
+static void _art_combine_exit(int code, Datum arg);
+
+
+/*
+ * Request shared memory of combining queues, only possible while
+ * preloading libraries.
+ */
+void
+_art_combine_register(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = _art_combine_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = _art_combine_shmem_startup;
+}
+
+Size
+_art_combine_shmem_size(void)
+{
+	return mul_size(ART_COMBINE_QUEUES, sizeof(ArtCombineQueue));
+}
+
+void
+_art_combine_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(_art_combine_shmem_size());
+}
+
+void
+_art_combine_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	art_combine_queues = ShmemInitStruct("ART insert combining queues",
+										 _art_combine_shmem_size(), &found);
+
+	if (!found)
+	{
+		memset(art_combine_queues, 0, _art_combine_shmem_size());
+
+		for (int i = 0; i < ART_COMBINE_QUEUES; i++)
+		{
+			SpinLockInit(&art_combine_queues[i].mutex);
+			art_combine_queues[i].combiner = -1;
+			ConditionVariableInit(&art_combine_queues[i].cv);
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Queue of index region, keys sharing leading bytes share queue.
+ */
+int
+_art_combine_queue_number(Relation index, ArtTuple * artTuple)
+{
+	int region_len = Min(artTuple->key_len - 1, ART_COMBINE_REGION_BYTES);
+	uint32 hash = hash_combine(hash_uint32(MyDatabaseId),
+							   hash_uint32(RelationGetRelid(index)));
+
+	if (region_len > 0)
+		hash = hash_combine(hash, hash_bytes(artTuple->key, region_len));
+
+	return hash % ART_COMBINE_QUEUES;
+}
+
+/*
+ * Hand tuple to combiner of its queue. Returns true if combiner inserted
+ * it. Otherwise caller inserts tuple itself; combineQueue is then set to
+ * queue it became combiner of, or -1, and combiner calls
+ * _art_combine_apply after its insert.
+ */
+bool
+_art_combine_publish(Relation index, ArtTuple * artTuple, int * combineQueue)
+{
+	ArtCombineQueue * q;
+	ArtCombineSlot * slot = NULL;
+	int queue;
+
+	*combineQueue = -1;
+
+	if (art_combine_queues == NULL || !insert_combining ||
+		artTuple->key_len > ART_COMBINE_KEY_SIZE)
+		return false;
+
+	if (!art_combine_exit_registered)
+	{
+		before_shmem_exit(_art_combine_exit, (Datum) 0);
+		art_combine_exit_registered = true;
+	}
+
+	queue = _art_combine_queue_number(index, artTuple);
+	q = &art_combine_queues[queue];
+
+	SpinLockAcquire(&q->mutex);
+
+	if (q->combiner < 0)
+	{
+		q->combiner = MyProc->pgprocno;
+		q->db_id = MyDatabaseId;
+		q->index_id = RelationGetRelid(index);
+		SpinLockRelease(&q->mutex);
+
+		*combineQueue = queue;
+		return false;
+	}
+
+	// Queue is shared with another index, its combiner would never apply slot
+	if (q->db_id != MyDatabaseId || q->index_id != RelationGetRelid(index))
+	{
+		SpinLockRelease(&q->mutex);
+		return false;
+	}
+
+	for (int i = 0; i < ART_COMBINE_SLOTS; i++)
+	{
+		if (q->slots[i].state != ART_COMBINE_EMPTY)
+			continue;
+
+		slot = &q->slots[i];
+		slot->state = ART_COMBINE_PUBLISHED;
+		slot->abandoned = false;
+		slot->owner = MyProc->pgprocno;
+		slot->db_id = MyDatabaseId;
+		slot->index_id = RelationGetRelid(index);
+		slot->iptr = artTuple->iptr;
+		slot->key_len = artTuple->key_len;
+		memcpy(slot->key, artTuple->key, artTuple->key_len);
+		break;
+	}
+
+	SpinLockRelease(&q->mutex);
+
+	// Queue is full, insert alongside combiner
+	if (slot == NULL)
+		return false;
+
+	return _art_combine_wait(q, queue, slot, combineQueue);
+}
+
+/*
+ * Wait for combiner to complete published slot. Combiner that left
+ * before claiming slot is replaced by this backend.
+ */
+bool
+_art_combine_wait(ArtCombineQueue * q, int queue, ArtCombineSlot * slot,
+				  int * combineQueue)
+{
+	bool inserted = false;
+
+	ConditionVariablePrepareToSleep(&q->cv);
+
+	PG_TRY();
+	{
+		for (;;)
+		{
+			uint8 state;
+
+			SpinLockAcquire(&q->mutex);
+
+			state = slot->state;
+
+			if (state == ART_COMBINE_DONE || state == ART_COMBINE_FAILED)
+				slot->state = ART_COMBINE_EMPTY;
+			else if (state == ART_COMBINE_PUBLISHED && q->combiner < 0)
+			{
+				slot->state = ART_COMBINE_EMPTY;
+				q->combiner = MyProc->pgprocno;
+				q->db_id = slot->db_id;
+				q->index_id = slot->index_id;
+				*combineQueue = queue;
+			}
+
+			SpinLockRelease(&q->mutex);
+
+			if (state == ART_COMBINE_DONE)
+			{
+				inserted = true;
+				break;
+			}
+
+			if (state == ART_COMBINE_FAILED || *combineQueue >= 0)
+				break;
+
+			ConditionVariableSleep(&q->cv, PG_WAIT_EXTENSION);
+		}
+	}
+	PG_CATCH();
+	{
+		// Slot being inserted is freed by combiner
+		SpinLockAcquire(&q->mutex);
+
+		if (slot->state == ART_COMBINE_CLAIMED)
+			slot->abandoned = true;
+		else
+			slot->state = ART_COMBINE_EMPTY;
+
+		SpinLockRelease(&q->mutex);
+
+		ConditionVariableCancelSleep();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	ConditionVariableCancelSleep();
+
+	return inserted;
+}
+
+/*
+ * Insert tuples published for index into combiner's queue, then leave
+ * combiner role. Caller holds share lock on metadata page lock tag.
+ */
+void
+_art_combine_apply(Relation index, int queue)
+{
+	ArtCombineQueue * q = &art_combine_queues[queue];
+	int num_applied = 0;
+
+	PG_TRY();
+	{
+		while (num_applied < ART_COMBINE_MAX_APPLY)
+		{
+			int claimed[ART_COMBINE_SLOTS];
+			int num_claimed = 0;
+
+			SpinLockAcquire(&q->mutex);
+
+			for (int i = 0; i < ART_COMBINE_SLOTS; i++)
+			{
+				ArtCombineSlot * slot = &q->slots[i];
+
+				if (slot->state != ART_COMBINE_PUBLISHED ||
+					slot->db_id != MyDatabaseId ||
+					slot->index_id != RelationGetRelid(index))
+					continue;
+
+				slot->state = ART_COMBINE_CLAIMED;
+				claimed[num_claimed++] = i;
+			}
+
+			SpinLockRelease(&q->mutex);
+
+			if (num_claimed == 0)
+				break;
+
+			// Claimed slot is not changed by its publisher
+			for (int i = 0; i < num_claimed; i++)
+			{
+				ArtCombineSlot * slot = &q->slots[claimed[i]];
+				ArtTuple tuple;
+
+				tuple.iptr = slot->iptr;
+				tuple.key_len = slot->key_len;
+				tuple.key = palloc(slot->key_len);
+				memcpy(tuple.key, slot->key, slot->key_len);
+
+				_art_insert_tuples(index, &tuple, 1);
+
+				pfree(tuple.key);
+
+				_art_combine_complete(q, slot, ART_COMBINE_DONE);
+			}
+
+			ConditionVariableBroadcast(&q->cv);
+
+			num_applied += num_claimed;
+		}
+	}
+	PG_CATCH();
+	{
+		_art_combine_abort(queue);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	SpinLockAcquire(&q->mutex);
+	q->combiner = -1;
+	SpinLockRelease(&q->mutex);
+
+	// Publishers that arrived last take over
+	ConditionVariableBroadcast(&q->cv);
+}
+
+/*
+ * Leave combiner role after error, claimed slots are inserted by their
+ * publishers.
+ */
+void
+_art_combine_abort(int queue)
+{
+	ArtCombineQueue * q = &art_combine_queues[queue];
+
+	SpinLockAcquire(&q->mutex);
+
+	for (int i = 0; i < ART_COMBINE_SLOTS; i++)
+	{
+		ArtCombineSlot * slot = &q->slots[i];
+
+		if (slot->state != ART_COMBINE_CLAIMED)
+			continue;
+
+		if (slot->abandoned)
+			slot->state = ART_COMBINE_EMPTY;
+		else
+			slot->state = ART_COMBINE_FAILED;
+	}
+
+	q->combiner = -1;
+
+	SpinLockRelease(&q->mutex);
+
+	ConditionVariableBroadcast(&q->cv);
+}
+
+void
+_art_combine_complete(ArtCombineQueue * q, ArtCombineSlot * slot, uint8 state)
+{
+	SpinLockAcquire(&q->mutex);
+
+	if (slot->abandoned)
+		slot->state = ART_COMBINE_EMPTY;
+	else
+		slot->state = state;
+
+	SpinLockRelease(&q->mutex);
+}
+
+/*
+ * Backend exit releases combiner role and slots of backend.
+ */
+void
+_art_combine_exit(int code, Datum arg)
+{
+	for (int queue = 0; queue < ART_COMBINE_QUEUES; queue++)
+	{
+		ArtCombineQueue * q = &art_combine_queues[queue];
+
+		if (q->combiner == MyProc->pgprocno)
+			_art_combine_abort(queue);
+
+		SpinLockAcquire(&q->mutex);
+
+		for (int i = 0; i < ART_COMBINE_SLOTS; i++)
+		{
+			ArtCombineSlot * slot = &q->slots[i];
+
+			if (slot->state == ART_COMBINE_EMPTY || slot->owner != MyProc->pgprocno)
+				continue;
+
+			if (slot->state == ART_COMBINE_CLAIMED)
+				slot->abandoned = true;
+			else
+				slot->state = ART_COMBINE_EMPTY;
+		}
+
+		SpinLockRelease(&q->mutex);
+	}
+}
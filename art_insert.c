@@ -12,6 +12,7 @@
 #include "catalog/index.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "storage/lmgr.h"
 #include "utils/memutils.h"
 
 #include "art.h"
@@ -20,6 +21,12 @@
 	(BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(ItemPointerData)) \
 		- MAXALIGN(sizeof(ArtDataPageOpaqueData)))
 
+/*
+ * Longest key that fits on empty page as prefix of NODE_256 with all
+ * children far, the largest node. Leaf of key with one TID is smaller.
+ */
+#define ART_MAX_KEY_LEN (ART_PAGE_SIZE - ART_JUMP_NODE_SIZE)
+
 /*
  * This structure contain information about node
  * on index page.
@@ -28,6 +35,7 @@ typedef struct ArtNodeEntry
 {
 	dlist_node node;
 	bool memory_node;
+	uint8 parent_key;			/* key byte of node in parent node */
 	ItemPointerData iptr;
 	ArtNodeHeader * art_node;
 	dlist_node * page_entry;
@@ -57,6 +65,13 @@ typedef struct ArtState
 	dlist_node * node_last_page;		/* internal node tail page */
 	dlist_node * leaf_last_page;		/* leaf tail page*/
 	MemoryContext build_ctx;			/* build temporary context */
+	Relation heap_rel;					/* heap of inserted tuple, insert only */
+	bool index_unchanged;				/* insert is new version of unchanged row */
+	ItemPointerData * cleanup_dead;		/* items cleanup removes once unreferenced */
+	int num_cleanup_dead;
+	int max_cleanup_dead;
+	uint16 vacuum_cycle;				/* running bulk delete cycle, see _page_vacuum_stamp */
+	bool vacuum_cycle_known;
 } ArtState;
 
 /*
@@ -72,8 +87,41 @@ typedef struct ArtPageEntryHashEntry
 
 static void _init_state(ArtState * state);
 static ArtNodeHeader * _get_node(ArtNodeEntry * nodeEntry);
+static bool _leaf_page_has_space(Page page, Size oldSize, Size newSize);
+static bool _leaf_add_item(ArtPageEntry * pageEntry, OffsetNumber off,
+						   ArtNodeLeaf * leaf, ItemPointer iptr);
+static int _itemptr_cmp(const void * a, const void * b);
+static OffsetNumber _bitmap_page_find(Page page, BlockNumber heapBlk);
+static ArtPageEntry * _bitmap_split_page(ArtState * state, ArtPageEntry * pageEntry,
+										 ArtLeafBitmap * bitmap);
+static void _bitmap_add_tid(ArtState * state, ArtNodeLeaf * leaf,
+							ArtPageEntry * leafPage, ItemPointer iptr);
+static uint32 _leaf_chain_items(ArtState * state, ArtNodeLeaf * leaf);
+static void _leaf_convert_to_bitmap(ArtState * state, ArtNodeEntry * leafEntry,
+									ArtTuple * artTuple);
+static bool _leaf_delete_bottomup(ArtState * state, ArtPageEntry * pageEntry,
+								  OffsetNumber off, ArtNodeLeaf * leaf);
 static void _update_leaf_item(ArtState * state, ArtNodeEntry * leafEntry, ArtTuple * artTuple);
-static ArtNodeEntry * _add_leaf(ArtState * state, ItemPointer parentIptr, ArtTuple * artTuple);
+static ArtNodeEntry * _add_leaf(ArtState * state, ArtTuple * artTuple, int keyOffset);
+static ArtNodeEntry * _add_leaf_items(ArtState * state, ArtTuple * artTuple, int keyOffset,
+									  ItemPointerData * items, int nitems);
+static void _new_child_slot(ArtState * state, ArtTuple * artTuple, int depth,
+							ItemPointer slot);
+static bool _leaf_get_single_tid(ArtNodeLeaf * leaf, ItemPointer tid);
+static bool _leaf_get_inline_tid(ArtNodeLeaf * leaf, int depth, ItemPointer tid);
+static void _expand_inline_tid(ArtState * state, ArtNodeEntry * nodeEntry,
+							   ItemPointer slot, ArtTuple * artTuple, int depth);
+static ArtNodeHeader * _bucket_make_node(ArtState * state, ArtNodeEntry * placeEntry,
+										 ArtBucketItem * items, int nitems,
+										 int depth, int offset);
+static void _bucket_child_slot(ArtState * state, ArtNodeEntry * placeEntry,
+							   ArtBucketItem * items, int nitems, int depth,
+							   int offset, ItemPointer slot);
+static void _bucket_split_leaf(ArtState * state, ArtNodeEntry * leafEntry,
+							   ArtNodeEntry * parentEntry, ArtTuple * artTuple,
+							   int depth);
+static void _bucket_insert(ArtState * state, ArtNodeEntry * nodeEntry,
+						   ArtTuple * artTuple, int depth);
 static ArtNodeHeader * _add_child_node4(ArtNode4 * n, uint8 key, 
 									   ItemPointer iptr);
 static ArtNodeHeader * _add_child_node16(ArtNode16 * n, uint8 key,
@@ -84,28 +132,57 @@ static ArtNodeHeader * _add_child_node256(ArtNode256 * n, uint8 key,
 										  ItemPointer iptr);
 static ArtNodeHeader * _add_child(ArtNodeHeader * node, uint8 key, ItemPointer iptr);
 static void _replace_child_iptr(ArtNodeHeader *node, uint8 key, ItemPointer iptr);
-static void _update_child_node_parent_iptr(ArtState * state, ItemPointer childIptr,
-										   ItemPointer parentIptr);
-static void _update_child_list_parent_iptr(ArtState * state, ArtNodeEntry * node);
+static ArtPageEntry * _get_page(ArtState * state, BlockNumber blkNum);
+static ArtPageEntry * _get_new_page(ArtState * state, uint8 pageType);
 static ArtNodeEntry * _get_node_from_iptr(ArtState * state, ItemPointer iptr);
 static ArtPageEntry * _get_page_with_free_space(ArtState * state,
 												uint8 pageType,
 												Size itemSize);
+static ArtPageEntry * _get_node_page(ArtState * state, ArtNodeEntry * parentEntry,
+									 Size itemSize);
 static ArtNodeEntry * _page_add_node(ArtState * state, ArtPageEntry * pageEntry,
 									 ArtNodeHeader * node);
 static void _page_update_node(ArtNodeEntry * nodeEntry, ArtNodeHeader *node);
-static ArtNodeEntry * _page_replace_node(ArtState * state,
-										 ArtNodeEntry * oldNodeEntry,
-										 Size oldNodeSize,
-										 ArtNodeHeader * node,
-										 uint8_t key);
+static void _page_delete_node(ArtState * state, ArtNodeEntry * nodeEntry);
+static void _page_delete_item(ArtState * state, ArtPageEntry * pageEntry, OffsetNumber off);
+static ArtMetaDataPageOpaque _get_page_cache(ArtState * state, dlist_head * metadataHead,
+											 ArtPageEntry ** metadataEntry);
+static void _page_cache_record(ArtState * state, ArtPageEntry * pageEntry);
+static void _page_vacuum_stamp(ArtState * state, ArtPageEntry * pageEntry);
+static ArtPageEntry * _get_cached_page(ArtState * state, uint8 pageType, Size itemsz);
+static void _check_key_len(Relation index, ArtTuple * artTuple);
+static void _page_store_child(ArtState * state, ArtNodeEntry * nodeEntry,
+							  ArtNodeHeader * node, uint8 key, ItemPointer child,
+							  bool add);
+static void _page_store_node(ArtState * state, ArtNodeEntry * nodeEntry,
+							 ArtNodeHeader * node);
 static ItemPointer _node_insert_recursive(ArtState * state,
 										 ArtNodeHeader * node,
 					 					 ArtTuple * artTuple,
 					 					 int depth);
 static bool _node_insert(ArtState * state, ArtTuple * artTuple);
+static bool _has_jump_table(ArtState * state);
+static void _jump_node_iptr(uint8 keyByte, ItemPointer iptr);
+static ArtNodeHeader * _alloc_root_node(bool jumpTable);
+static void _build_jump_nodes(ArtState * state);
 static void _node_release(ArtNodeEntry * node);
 static void _node_release_list(ArtState * state);
+static void _cleanup_defer_delete(ArtState * state, ItemPointer iptr);
+static void _cleanup_flush(ArtState * state, int mark);
+static void _cleanup_store_node(ArtState * state, ArtNodeEntry * nodeEntry,
+								ArtNodeHeader * node, bool move, ItemPointer newIptr);
+static bool _cleanup_leaf(ArtState * state, ArtNodeEntry * leafEntry);
+static bool _cleanup_bitmap_leaf(ArtState * state, ArtNodeEntry * leafEntry);
+static void _cleanup_free_bitmap_page(ArtState * state, ArtPageEntry * pageEntry);
+static bool _cleanup_bucket(ArtState * state, ArtNodeEntry * nodeEntry, int depth,
+							ItemPointer newIptr);
+static bool _cleanup_collapse(ArtState * state, ArtNodeEntry * nodeEntry, uint8 key,
+							  ItemPointer child, int depth, ItemPointer newIptr);
+static bool _cleanup_node(ArtState * state, ArtNodeEntry * nodeEntry, int depth,
+						  ItemPointer newIptr);
+static bool _cleanup_subtree(ArtState * state, ArtNodeEntry * nodeEntry, int depth,
+							 ItemPointer newIptr);
+static bool _cleanup_child(ArtState * state, ItemPointer slot, int depth);
 
 void 
 _init_state(ArtState * state)
@@ -114,6 +191,7 @@ _init_state(ArtState * state)
 	dlist_init(&state->art_nodes);
 	state->node_last_page = NULL;
 	state->leaf_last_page = NULL;
+	state->vacuum_cycle_known = false;
 }
 
 void
@@ -169,1019 +247,2753 @@ _get_node(ArtNodeEntry * nodeEntry)
 		PageGetItem(page_entry->page, PageGetItemId(page_entry->page, off));
 }
 
-void
-_update_leaf_item(ArtState * state, ArtNodeEntry * leafEntry, ArtTuple * artTuple)
+/*
+ * Check if leaf item on page can grow from oldSize to newSize.
+ */
+bool
+_leaf_page_has_space(Page page, Size oldSize, Size newSize)
 {
-	ArtPageEntry * init_leaf_page = 
-		dlist_container(ArtPageEntry, node, leafEntry->page_entry);
-	ArtNodeLeaf * init_leaf = (ArtNodeLeaf*) leafEntry->art_node;
+	if (MAXALIGN(newSize) <= MAXALIGN(oldSize))
+		return true;
 
-	ArtNodeLeaf * leaf = NULL;
-	ArtPageEntry * leaf_page = init_leaf_page;
-	ArtNodeEntry * leaf_node_entry = leafEntry;
-	Offset leaf_entry_off = ItemPointerGetOffsetNumber(&leaf_node_entry->iptr);
+	return PageGetExactFreeSpace(page) >= MAXALIGN(newSize) - MAXALIGN(oldSize);
+}
 
+/*
+ * Add TID to leaf posting list. TIDs greater than last item in list are
+ * appended, in place if encoded delta fits into item alignment padding.
+ * Otherwise TID is merged into list and leaf is overwritten. Returns false
+ * if leaf can't grow on its page.
+ */
+bool
+_leaf_add_item(ArtPageEntry * pageEntry, OffsetNumber off,
+			   ArtNodeLeaf * leaf, ItemPointer iptr)
+{
+	uint8 * posting = ART_LEAF_POSTING(leaf);
+	Size leaf_size = _art_node_size((ArtNodeHeader *) leaf);
 	ArtNodeLeaf * new_leaf = NULL;
-	
-	Size leaf_page_size;
-
-	leaf = (ArtNodeLeaf *) leafEntry->art_node;
-
-	for (;;)
-	{
-		if (ItemPointerIsValid(&leaf->last_leaf_iptr))
-		{
-			leaf_node_entry = _get_node_from_iptr(state, &leaf->last_leaf_iptr);
-			leaf_entry_off = ItemPointerGetOffsetNumber(&leaf_node_entry->iptr);
-			leaf_page = dlist_container(ArtPageEntry, node, leaf_node_entry->page_entry);
-			leaf = (ArtNodeLeaf*) leaf_node_entry->art_node;
-		}
-		else
-		{
-			Size leaf_size = _art_node_size((ArtNodeHeader *) leaf);
-
-			Size new_leaf_size = leaf_size + sizeof(ItemPointerData);
-
-			leaf_page_size = PageGetFreeSpace(leaf_page->page);
-
-			if (leaf_page_size > MAXALIGN(sizeof(ItemPointerData)))
-			{
-				ItemPointer new_leaf_iptr = NULL;
+	Size new_leaf_size;
+	ItemPointerData last;
 
-				new_leaf = (ArtNodeLeaf*) palloc0(new_leaf_size + sizeof(ItemPointerData));
+	if (leaf->num_items == PG_UINT16_MAX)
+		return false;
 
-				ItemPointerSetInvalid(&new_leaf->next_leaf_iptr);
-				ItemPointerSetInvalid(&new_leaf->last_leaf_iptr);
+	_art_posting_last(posting, leaf->posting_size, &last);
 
-				new_leaf->key_len = leaf->key_len;
-				new_leaf->num_items = leaf->num_items + 1;
+	if (ItemPointerCompare(iptr, &last) > 0)
+	{
+		uint8 delta[ART_POSTING_MAX_SIZE(1)];
+		int delta_size = _art_posting_append(delta, &last, iptr);
 
-				if (update_parent_iptr)
-				{
-					ItemPointerCopy(&leaf->parent_iptr, &new_leaf->parent_iptr);
-				}
+		new_leaf_size = leaf_size + delta_size;
 
-				memcpy(new_leaf->data, leaf->data,
-					   leaf->key_len + 
-					   sizeof(ItemPointerData) * leaf->num_items);
+		// Delta fits into item padding, no need to move anything
+		if (MAXALIGN(new_leaf_size) == MAXALIGN(leaf_size))
+		{
+			ItemId item_id = PageGetItemId(pageEntry->page, off);
 
-				new_leaf_iptr = (ItemPointer)&new_leaf->data[new_leaf->key_len];
+			START_CRIT_SECTION();
 
-				ItemPointerCopy(&artTuple->iptr, &new_leaf_iptr[new_leaf->num_items-1]);
+			memcpy(posting + leaf->posting_size, delta, delta_size);
+			leaf->posting_size += delta_size;
+			leaf->num_items++;
+			ItemIdSetNormal(item_id, ItemIdGetOffset(item_id), new_leaf_size);
 
-				START_CRIT_SECTION();
-				PageIndexTupleOverwrite(leaf_page->page, leaf_entry_off,
-										(Item) new_leaf, new_leaf_size);
-				END_CRIT_SECTION();
+			END_CRIT_SECTION();
 
-				pfree(new_leaf);
+			pageEntry->dirty = true;
 
-				leaf_page->dirty = true;
+			return true;
+		}
 
-				break;
-			}
-			else
-			{
-				ArtNodeEntry * new_leaf_entry = NULL;
+		if (!_leaf_page_has_space(pageEntry->page, leaf_size, new_leaf_size))
+			return false;
 
-				new_leaf_entry =
-					_add_leaf(state, &leaf->parent_iptr, artTuple);
-	
-				ItemPointerCopy(&new_leaf_entry->iptr, &leaf->next_leaf_iptr);
+		new_leaf = (ArtNodeLeaf *) palloc(new_leaf_size);
+		memcpy(new_leaf, leaf, leaf_size);
+		memcpy(ART_LEAF_POSTING(new_leaf) + new_leaf->posting_size, delta, delta_size);
+		new_leaf->posting_size += delta_size;
+		new_leaf->num_items++;
+	}
+	else
+	{
+		ItemPointerData * items;
+		int num_items;
+		int new_num_items;
 
-				START_CRIT_SECTION();
+		// Out of order TID, merge it into decoded list
+		items = (ItemPointerData *) palloc(sizeof(ItemPointerData) * (leaf->num_items + 1));
+		num_items = _art_posting_decode(posting, leaf->posting_size, items);
+		new_num_items = _art_posting_merge_item(items, num_items, iptr);
 
-				PageIndexTupleOverwrite(leaf_page->page, leaf_entry_off,
-										(Item) leaf, leaf_size);
+		// TID is already part of list
+		if (new_num_items == num_items)
+		{
+			pfree(items);
+			return true;
+		}
 
-				END_CRIT_SECTION();
+		new_leaf = (ArtNodeLeaf *) palloc(sizeof(ArtNodeLeaf) + leaf->key_len +
+										  ART_POSTING_MAX_SIZE(new_num_items));
+		memcpy(new_leaf, leaf, sizeof(ArtNodeLeaf) + leaf->key_len);
+		new_leaf->num_items = new_num_items;
+		new_leaf->posting_size =
+			_art_posting_encode(items, new_num_items, ART_LEAF_POSTING(new_leaf));
+		new_leaf_size = _art_node_size((ArtNodeHeader *) new_leaf);
 
-				leaf_page->dirty = true;
+		pfree(items);
 
-				// Update init leaf item to point to last leaf iptr
-				ItemPointerCopy(&new_leaf_entry->iptr, &init_leaf->last_leaf_iptr);
+		if (!_leaf_page_has_space(pageEntry->page, leaf_size, new_leaf_size))
+		{
+			pfree(new_leaf);
+			return false;
+		}
+	}
 
-				START_CRIT_SECTION();
+	START_CRIT_SECTION();
+	PageIndexTupleOverwrite(pageEntry->page, off, (Item) new_leaf, new_leaf_size);
+	END_CRIT_SECTION();
 
-				PageIndexTupleOverwrite(init_leaf_page->page, 
-										ItemPointerGetOffsetNumber(&leafEntry->iptr),
-										(Item) init_leaf, _art_node_size((ArtNodeHeader*) init_leaf));
-				
-				init_leaf_page->dirty = true;
+	pageEntry->dirty = true;
 
-				END_CRIT_SECTION();
+	pfree(new_leaf);
 
-				break;
-			}
-		}
-	}
+	return true;
 }
 
-ArtNodeEntry * 
-_add_leaf(ArtState * state, ItemPointer parentIptr, ArtTuple * artTuple)
+int
+_itemptr_cmp(const void * a, const void * b)
 {
-	ArtPageEntry * new_leaf_page_entry;
-	ArtNodeEntry * new_leaf_node_entry;
-
-	Size leaf_key_size = artTuple->key_len;
-	ArtNodeLeaf * leaf = (ArtNodeLeaf*) palloc0(sizeof(ArtNodeLeaf) + leaf_key_size + sizeof(ItemPointerData));
+	return ItemPointerCompare((ItemPointer) a, (ItemPointer) b);
+}
 
-	leaf->key_len = leaf_key_size;
-	leaf->num_items = 1;
-	
-	memcpy(leaf->data, artTuple->key, leaf_key_size);
-	memcpy(leaf->data + artTuple->key_len, &artTuple->iptr, sizeof(ItemPointerData));
+/*
+ * Find offset of first container on bitmap page with heap block number
+ * greater or equal to heapBlk. Returns max offset + 1 if there is none.
+ */
+OffsetNumber
+_bitmap_page_find(Page page, BlockNumber heapBlk)
+{
+	OffsetNumber low = FirstOffsetNumber;
+	OffsetNumber high = OffsetNumberNext(PageGetMaxOffsetNumber(page));
 
-	if (parentIptr && update_parent_iptr)
+	while (low < high)
 	{
-		ItemPointerCopy(parentIptr, &leaf->parent_iptr);
-	}
-
-	new_leaf_page_entry = 
-		_get_page_with_free_space(state,
-								  ART_LEAF_PAGE,
-								  _art_node_size((ArtNodeHeader*) leaf));
+		OffsetNumber mid = low + (high - low) / 2;
+		ArtBitmapContainer * c =
+			(ArtBitmapContainer *) PageGetItem(page, PageGetItemId(page, mid));
 
-	new_leaf_node_entry = _page_add_node(state, new_leaf_page_entry, (ArtNodeHeader*) leaf);
+		if (c->heap_blk < heapBlk)
+			low = mid + 1;
+		else
+			high = mid;
+	}
 
-	return new_leaf_node_entry;
+	return low;
 }
 
-ArtNodeHeader *
-_add_child_node4(ArtNode4 * n, uint8_t key, ItemPointer iptr)
+/*
+ * Move upper half of containers to new right sibling page. Returns
+ * new page entry.
+ */
+ArtPageEntry *
+_bitmap_split_page(ArtState * state, ArtPageEntry * pageEntry, ArtLeafBitmap * bitmap)
 {
-	if (n->node.num_children < 4)
-	{
-		int idx;
-		
-		for (idx=0; idx < n->node.num_children; idx++)
-			if (key < n->keys[idx]) break;
-
-		// Shift to make room
-		memmove(n->keys + idx + 1, n->keys+idx, n->node.num_children - idx);
-		memmove(n->children + idx + 1, n->children + idx,
-				(n->node.num_children - idx) * sizeof(ItemPointerData));
+	Page page = pageEntry->page;
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+	OffsetNumber split_off = maxoff / 2 + 1;
+	OffsetNumber * deleted = palloc(sizeof(OffsetNumber) * maxoff);
+	int num_deleted = 0;
+	ArtPageEntry * right_page_entry = _get_new_page(state, ART_BITMAP_PAGE);
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+	ArtDataPageOpaque right_opaque =
+		(ArtDataPageOpaque) PageGetSpecialPointer(right_page_entry->page);
 
-		n->keys[idx] = key;
-		ItemPointerCopy(iptr, &(n->children[idx]));
-		n->node.num_children++;
+	START_CRIT_SECTION();
 
-		return NULL;
-	}
-	else
+	for (OffsetNumber off = split_off; off <= maxoff; off++)
 	{
-		ArtNode16 * new_node = (ArtNode16*) _art_alloc_node(NODE_16);
-
-		memcpy(new_node->children, n->children,
-			   sizeof(ItemPointerData) * n->node.num_children);
-		memcpy(new_node->keys, n->keys,
-			   sizeof(uint8_t) * n->node.num_children);
+		ItemId item_id = PageGetItemId(page, off);
 
-		_art_copy_header((ArtNodeHeader*) new_node, (ArtNodeHeader*) n);
-		_add_child_node16(new_node, key, iptr);
+		PageAddItem(right_page_entry->page, PageGetItem(page, item_id),
+					ItemIdGetLength(item_id), InvalidOffsetNumber, false, false);
 
-		return (ArtNodeHeader *) new_node;
+		deleted[num_deleted++] = off;
 	}
-}
 
-ArtNodeHeader * 
-_add_child_node16(ArtNode16 * n, uint8_t key, ItemPointer iptr)
-{
-	if (n->node.num_children < 16)
-	{
-		int idx;
-		
-		for (idx = 0; idx < n->node.num_children; idx++)
-			if (key < n->keys[idx]) break;
+	PageIndexMultiDelete(page, deleted, num_deleted);
 
-		// Shift to make room
-		memmove(n->keys + idx + 1, n->keys+idx, n->node.num_children - idx);
-		memmove(n->children+idx + 1, n->children+idx,
-				(n->node.num_children - idx) * sizeof(ItemPointerData));
+	right_opaque->n_total = num_deleted;
+	right_opaque->right_link = opaque->right_link;
+	opaque->n_total -= num_deleted;
+	opaque->right_link = right_page_entry->blk_num;
 
-		n->keys[idx] = key;
-		ItemPointerCopy(iptr, &(n->children[idx]));
-		n->node.num_children++;
+	END_CRIT_SECTION();
 
-		return NULL;
-	}
-	else
-	{
-		ArtNode48 * new_node = (ArtNode48*) _art_alloc_node(NODE_48);
+	pageEntry->dirty = true;
+	right_page_entry->dirty = true;
 
-		// Copy the child pointers and populate the key map
-		memcpy(new_node->children, n->children, 
-			   sizeof(ItemPointerData) * n->node.num_children);
+	_page_vacuum_stamp(state, right_page_entry);
 
-		for (int i = 0; i <n ->node.num_children; i++)
-			new_node->keys[n->keys[i]] = i + 1;
+	if (bitmap->last_blk == pageEntry->blk_num)
+		bitmap->last_blk = right_page_entry->blk_num;
 
-		_art_copy_header((ArtNodeHeader*)new_node, (ArtNodeHeader*)n);
-		_add_child_node48(new_node, key, iptr);
+	pfree(deleted);
 
-		return (ArtNodeHeader*) new_node;
-	}
+	return right_page_entry;
 }
 
-ArtNodeHeader *
-_add_child_node48(ArtNode48 * n, uint8_t key, ItemPointer iptr)
+/*
+ * Add TID to bitmap leaf.
+ */
+void
+_bitmap_add_tid(ArtState * state, ArtNodeLeaf * leaf, ArtPageEntry * leafPage,
+				ItemPointer iptr)
 {
-	if (n->node.num_children < 48) 
-	{
-		int idx = 0;
+	BlockNumber heap_blk = ItemPointerGetBlockNumber(iptr);
+	OffsetNumber heap_off = ItemPointerGetOffsetNumber(iptr);
+	ArtLeafBitmap bitmap;
+	BlockNumber last_blk;
+	ArtPageEntry * page_entry;
+	ArtDataPageOpaque opaque;
 
-		while (ItemPointerIsValid(&n->children[idx]))
-			idx++;
+	memcpy(&bitmap, ART_LEAF_POSTING(leaf), sizeof(ArtLeafBitmap));
+	last_blk = bitmap.last_blk;
 
-		n->keys[key] = idx + 1;
-		ItemPointerCopy(iptr, &(n->children[idx]));
-		n->node.num_children++;
+	// TIDs mostly come in heap order, so try last page first
+	page_entry = _get_page(state, bitmap.last_blk);
 
-		return NULL;
-	}
-	else
+	if (_bitmap_page_find(page_entry->page, heap_blk) == FirstOffsetNumber &&
+		bitmap.first_blk != bitmap.last_blk)
 	{
-		ArtNode256 *new_node = (ArtNode256*) _art_alloc_node(NODE_256);
+		BlockNumber blk = bitmap.first_blk;
+
+		_art_page_release(page_entry);
 
-		for (int i = 0; i < 256; i++)
+		for (;;)
 		{
-			if (n->keys[i])
-				ItemPointerCopy(&n->children[n->keys[i] - 1], &new_node->children[i]);
-		}
+			page_entry = _get_page(state, blk);
+			opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page_entry->page);
 
-		_art_copy_header((ArtNodeHeader*)new_node, (ArtNodeHeader*)n);
-		_add_child_node256(new_node, key, iptr);
+			if (opaque->right_link == InvalidBlockNumber ||
+				_bitmap_page_find(page_entry->page, heap_blk) <=
+					PageGetMaxOffsetNumber(page_entry->page))
+				break;
 
-		return (ArtNodeHeader*) new_node;
+			blk = opaque->right_link;
+			_art_page_release(page_entry);
+		}
 	}
-}
-
-ArtNodeHeader * 
-_add_child_node256(ArtNode256 * n, uint8_t key, ItemPointer iptr)
-{
-	ItemPointerCopy(iptr, &(n->children[key]));
-	n->node.num_children++;
-	return NULL;
-}
 
-ArtNodeHeader *
-_add_child(ArtNodeHeader *node, uint8 key, ItemPointer iptr)
-{
-	switch (node->node_type)
+	for (;;)
 	{
-		case NODE_4:
-			return _add_child_node4((ArtNode4*) node, key, iptr);
-
-		case NODE_16:
-			return _add_child_node16((ArtNode16*) node, key, iptr);
-
-		case NODE_48:
-			return _add_child_node48((ArtNode48*) node, key, iptr);
+		Page page = page_entry->page;
+		OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+		OffsetNumber off = _bitmap_page_find(page, heap_blk);
+		ArtBitmapContainer * c = NULL;
+		ArtBitmapContainer * new_c = NULL;
+		ArtPageEntry * right_page_entry;
 
-		case NODE_256:
-			return _add_child_node256((ArtNode256*) node, key, iptr);
-		
-		default:
-			elog(ERROR, "Unknown node type");
-	}
-}
+		opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
 
-void
-_replace_child_iptr(ArtNodeHeader * node, uint8 key, ItemPointer iptr)
-{
-	ItemPointer child_iptr = _art_find_child_equal(node, key);
-	ItemPointerCopy(iptr, child_iptr);
-}
+		if (off <= maxoff)
+			c = (ArtBitmapContainer *) PageGetItem(page, PageGetItemId(page, off));
 
-void
-_update_child_node_parent_iptr(ArtState * state, ItemPointer childIptr,
-							   ItemPointer parentIptr)
-{
+		if (c && c->heap_blk == heap_blk)
+		{
+			Size old_size = _art_bitmap_container_size(c);
 
-	ArtNodeHeader * child_node;
-	Buffer child_node_buffer = InvalidBuffer;
+			new_c = _art_bitmap_container_add(c, heap_off);
 
-	BlockNumber node_block_number = ItemPointerGetBlockNumber(childIptr);
-	BlockNumber node_offset = ItemPointerGetOffsetNumber(childIptr);
+			if (new_c == NULL)
+			{
+				page_entry->dirty = true;
+				break;
+			}
 
-	if (IS_MEMORY_BUILD(state))
-	{
-		ArtPageEntry * node_page = 
-			_art_get_page_hash(state->build_state->page_lookup_hash, node_block_number);
+			if (PageGetExactFreeSpace(page) >=
+				MAXALIGN(_art_bitmap_container_size(new_c)) - MAXALIGN(old_size))
+			{
+				START_CRIT_SECTION();
+				PageIndexTupleOverwrite(page, off, (Item) new_c,
+										_art_bitmap_container_size(new_c));
+				END_CRIT_SECTION();
 
-		if (!node_page)
-		{
-			node_page = _art_copy_page(state->index, node_block_number);
-			dlist_push_head(&state->pages, &node_page->node);
-			_art_add_page_hash(state->build_state->page_lookup_hash,
-							   node_block_number,
-							   node_page);
+				page_entry->dirty = true;
+				pfree(new_c);
+				break;
+			}
 		}
-
-		child_node =
-			(ArtNodeHeader *) PageGetItem(node_page->page,
-									PageGetItemId(node_page->page, node_offset));
-	}
-	else
-	{
-		dlist_iter iter;
-		ArtPageEntry * page_entry;
-		bool page_found = false;
-
-		dlist_foreach(iter, &state->pages)
+		else
 		{
-			page_entry = dlist_container(ArtPageEntry, node, iter.cur);
-			
-			if (page_entry->blk_num == node_block_number)
+			new_c = _art_bitmap_container_create(heap_blk, heap_off);
+
+			if (PageGetFreeSpace(page) >= MAXALIGN(_art_bitmap_container_size(new_c)))
 			{
-				page_found = true;
+				START_CRIT_SECTION();
+				PageAddItem(page, (Item) new_c, _art_bitmap_container_size(new_c),
+							off, false, false);
+				opaque->n_total++;
+				END_CRIT_SECTION();
+
+				page_entry->dirty = true;
+				pfree(new_c);
 				break;
 			}
 		}
 
-		if (page_found)
+		pfree(new_c);
+
+		// Page is full, split it and retry on the half that covers heap block
+		right_page_entry = _bitmap_split_page(state, page_entry, &bitmap);
+
+		c = (ArtBitmapContainer *)
+			PageGetItem(right_page_entry->page,
+						PageGetItemId(right_page_entry->page, FirstOffsetNumber));
+
+		if (off > maxoff || heap_blk >= c->heap_blk)
 		{
-			child_node =
-				(ArtNodeHeader *) PageGetItem(page_entry->page,
-											  PageGetItemId(page_entry->page, node_offset));
+			_art_page_release(page_entry);
+			page_entry = right_page_entry;
 		}
 		else
 		{
-			child_node = 
-				_art_get_node_from_iptr(state->index, childIptr, 
-										&child_node_buffer, BUFFER_LOCK_EXCLUSIVE);
+			_art_page_release(right_page_entry);
 		}
 	}
 
-	if (update_parent_iptr)
+	_art_page_release(page_entry);
+
+	if (bitmap.last_blk != last_blk)
 	{
-		ItemPointerCopy(parentIptr, &child_node->parent_iptr);
+		memcpy(ART_LEAF_POSTING(leaf), &bitmap, sizeof(ArtLeafBitmap));
+		leafPage->dirty = true;
 	}
+}
+
+/*
+ * Count TIDs of all leaf fragments.
+ */
+uint32
+_leaf_chain_items(ArtState * state, ArtNodeLeaf * leaf)
+{
+	uint32 num_items = leaf->num_items;
 
-	if (!IS_MEMORY_BUILD(state) && child_node_buffer != InvalidBuffer)
+	while (ItemPointerIsValid(&leaf->next_leaf_iptr))
 	{
-		UnlockReleaseBuffer(child_node_buffer);
+		ArtNodeEntry * leaf_entry = _get_node_from_iptr(state, &leaf->next_leaf_iptr);
+		leaf = (ArtNodeLeaf *) leaf_entry->art_node;
+		num_items += leaf->num_items;
 	}
+
+	return num_items;
 }
 
+/*
+ * Move all TIDs of leaf fragment chain, together with new TID, into bitmap
+ * pages and rewrite first leaf as bitmap leaf. Other fragments are removed
+ * once first leaf no longer points to them. Long chain spans many pages,
+ * so batch is flushed while only unreferenced pages and items changed.
+ */
 void
-_update_child_list_parent_iptr(ArtState * state, ArtNodeEntry * nodeEntry)
+_leaf_convert_to_bitmap(ArtState * state, ArtNodeEntry * leafEntry, ArtTuple * artTuple)
 {
-	ArtNodeHeader * node = (ArtNodeHeader *) nodeEntry->art_node;
+	ArtPageEntry * leaf_page = dlist_container(ArtPageEntry, node, leafEntry->page_entry);
+	ArtNodeLeaf * init_leaf = (ArtNodeLeaf *) leafEntry->art_node;
+	ArtNodeLeaf * leaf = init_leaf;
+	ArtNodeEntry * leaf_entry = NULL;
+	ArtNodeLeaf * new_leaf;
+	Size new_leaf_size;
+	ItemPointerData * items;
+	OffsetNumber * offsets;
+	ItemPointerData * fragments;
+	int num_items = 0;
+	int max_items = init_leaf->num_items + 1;
+	int num_fragments = 0;
+	int max_fragments = 8;
+	ArtPageEntry * bitmap_page_entry;
+	ArtLeafBitmap bitmap;
 	int i;
 
-	switch(node->node_type)
+	items = (ItemPointerData *) palloc(sizeof(ItemPointerData) * max_items);
+	fragments = (ItemPointerData *) palloc(sizeof(ItemPointerData) * max_fragments);
+
+	for (;;)
 	{
-		case NODE_4:
+		ItemPointerData next_leaf_iptr;
+
+		if (num_items + leaf->num_items + 1 > max_items)
 		{
-			ArtNode4 * node4 = (ArtNode4 *) node;
-			for (i = 0 ; i < node4->node.num_children; i++)
-			{
-				_update_child_node_parent_iptr(state, &node4->children[i],
-											   &nodeEntry->iptr);
-			}
-			break;
+			max_items = (num_items + leaf->num_items + 1) * 2;
+			items = (ItemPointerData *) repalloc(items, sizeof(ItemPointerData) * max_items);
 		}
-		case NODE_16:
+
+		num_items += _art_posting_decode(ART_LEAF_POSTING(leaf), leaf->posting_size,
+										 items + num_items);
+
+		next_leaf_iptr = leaf->next_leaf_iptr;
+
+		// Fragment items are decoded, don't keep its page locked
+		if (leaf_entry != NULL)
 		{
-			ArtNode16 * node16 = (ArtNode16 *) node;
-			for (i = 0 ; i < node16->node.num_children; i++)
-			{
-				_update_child_node_parent_iptr(state, &node16->children[i],
-											   &nodeEntry->iptr);
-			}
-			break;
+			dlist_delete(&leaf_entry->node);
+			_node_release(leaf_entry);
 		}
-		case NODE_48:
-		{
-			ArtNode48 * node48 = (ArtNode48 *) node;
-			for (i = 0 ; i < node48->node.num_children; i++)
-			{
-				_update_child_node_parent_iptr(state, &node48->children[i],
-											   &nodeEntry->iptr);
-			}
+
+		if (!ItemPointerIsValid(&next_leaf_iptr))
 			break;
-		}
+
+		if (num_fragments == max_fragments)
+		{
+			max_fragments *= 2;
+			fragments = (ItemPointerData *)
+				repalloc(fragments, sizeof(ItemPointerData) * max_fragments);
+		}
+
+		fragments[num_fragments++] = next_leaf_iptr;
+
+		leaf_entry = _get_node_from_iptr(state, &next_leaf_iptr);
+		leaf = (ArtNodeLeaf *) leaf_entry->art_node;
+	}
+
+	ItemPointerCopy(&artTuple->iptr, &items[num_items++]);
+
+	pg_qsort(items, num_items, sizeof(ItemPointerData), _itemptr_cmp);
+
+	// Fill bitmap pages with one container per heap block
+	offsets = (OffsetNumber *) palloc(sizeof(OffsetNumber) * MaxHeapTuplesPerPage);
+
+	bitmap_page_entry = _get_new_page(state, ART_BITMAP_PAGE);
+	bitmap.first_blk = bitmap_page_entry->blk_num;
+
+	i = 0;
+	while (i < num_items)
+	{
+		BlockNumber heap_blk = ItemPointerGetBlockNumber(&items[i]);
+		ArtBitmapContainer * c;
+		Size c_size;
+		int num_offsets = 0;
+
+		for (; i < num_items && ItemPointerGetBlockNumber(&items[i]) == heap_blk; i++)
+		{
+			OffsetNumber off = ItemPointerGetOffsetNumber(&items[i]);
+
+			if (num_offsets == 0 || offsets[num_offsets - 1] != off)
+				offsets[num_offsets++] = off;
+		}
+
+		c = _art_bitmap_container_build(heap_blk, offsets, num_offsets);
+		c_size = _art_bitmap_container_size(c);
+
+		if (PageGetFreeSpace(bitmap_page_entry->page) < MAXALIGN(c_size))
+		{
+			ArtPageEntry * next_page_entry = _get_new_page(state, ART_BITMAP_PAGE);
+			ArtDataPageOpaque opaque =
+				(ArtDataPageOpaque) PageGetSpecialPointer(bitmap_page_entry->page);
+
+			opaque->right_link = next_page_entry->blk_num;
+			_art_page_release(bitmap_page_entry);
+			bitmap_page_entry = next_page_entry;
+
+			// Bitmap pages are not referenced until leaf is rewritten
+			_art_xlog_flush_if_full();
+		}
+
+		START_CRIT_SECTION();
+		PageAddItem(bitmap_page_entry->page, (Item) c, c_size,
+					InvalidOffsetNumber, false, false);
+		END_CRIT_SECTION();
+
+		((ArtDataPageOpaque) PageGetSpecialPointer(bitmap_page_entry->page))->n_total++;
+		bitmap_page_entry->dirty = true;
+
+		_page_vacuum_stamp(state, bitmap_page_entry);
+
+		pfree(c);
+	}
+
+	bitmap.last_blk = bitmap_page_entry->blk_num;
+	_art_page_release(bitmap_page_entry);
+
+	// Rewrite first fragment as bitmap leaf
+	new_leaf_size = sizeof(ArtNodeLeaf) + init_leaf->key_len + sizeof(ArtLeafBitmap);
+	new_leaf = (ArtNodeLeaf *) palloc0(new_leaf_size);
+	memcpy(new_leaf, init_leaf, sizeof(ArtNodeLeaf) + init_leaf->key_len);
+
+	new_leaf->flags |= ART_LEAF_BITMAP;
+	new_leaf->num_items = 0;
+	new_leaf->posting_size = sizeof(ArtLeafBitmap);
+	ItemPointerSetInvalid(&new_leaf->next_leaf_iptr);
+	ItemPointerSetInvalid(&new_leaf->last_leaf_iptr);
+	memcpy(ART_LEAF_POSTING(new_leaf), &bitmap, sizeof(ArtLeafBitmap));
+
+	START_CRIT_SECTION();
+	PageIndexTupleOverwrite(leaf_page->page, ItemPointerGetOffsetNumber(&leafEntry->iptr),
+							(Item) new_leaf, new_leaf_size);
+	END_CRIT_SECTION();
+
+	leaf_page->dirty = true;
+
+	// Fragments are not needed anymore, log leaf that no longer points to them
+	if (num_fragments > 0 && _art_xlog_in_progress())
+		_art_xlog_flush();
+
+	for (i = 0; i < num_fragments; i++)
+	{
+		ArtPageEntry * page_entry =
+			_get_page(state, ItemPointerGetBlockNumber(&fragments[i]));
+
+		_page_delete_item(state, page_entry, ItemPointerGetOffsetNumber(&fragments[i]));
+		_art_page_release(page_entry);
+
+		_art_xlog_flush_if_full();
+	}
+
+	pfree(new_leaf);
+	pfree(fragments);
+	pfree(offsets);
+	pfree(items);
+}
+
+/*
+ * Bottom-up deletion. Insert of unchanged key is new version of row whose
+ * older versions are likely in same leaf and may be dead by now. Heap
+ * checks leaf TIDs, ones known deletable are removed from leaf. Returns
+ * true if leaf got smaller.
+ */
+bool
+_leaf_delete_bottomup(ArtState * state, ArtPageEntry * pageEntry, OffsetNumber off,
+					  ArtNodeLeaf * leaf)
+{
+	TM_IndexDeleteOp delstate;
+	ItemPointerData * items;
+	ArtNodeLeaf * new_leaf;
+	bool * deletable;
+	int num_items;
+	int num_live = 0;
+	TransactionId latest_removed_xid;
+
+	if (state->heap_rel == NULL || leaf->num_items == 0 || leaf->num_items > PG_INT16_MAX ||
+		!_art_xlog_can_remove_tids(state->index))
+		return false;
+
+	items = (ItemPointerData *) palloc(sizeof(ItemPointerData) * leaf->num_items);
+	num_items = _art_posting_decode(ART_LEAF_POSTING(leaf), leaf->posting_size, items);
+
+	delstate.irel = state->index;
+	delstate.iblknum = pageEntry->blk_num;
+	delstate.bottomup = true;
+	delstate.bottomupfreespace = Max(BLCKSZ / 16, ART_POSTING_MAX_SIZE(1));
+	delstate.ndeltids = num_items;
+	delstate.deltids = (TM_IndexDelete *) palloc(sizeof(TM_IndexDelete) * num_items);
+	delstate.status = (TM_IndexStatus *) palloc(sizeof(TM_IndexStatus) * num_items);
+
+	// All TIDs are versions of same key, so all are promising
+	for (int i = 0; i < num_items; i++)
+	{
+		delstate.deltids[i].tid = items[i];
+		delstate.deltids[i].id = i;
+		delstate.status[i].idxoffnum = off;
+		delstate.status[i].knowndeletable = false;
+		delstate.status[i].promising = true;
+		delstate.status[i].freespace = Max(leaf->posting_size / num_items, 1);
+	}
+
+	latest_removed_xid = table_index_delete_tuples(state->heap_rel, &delstate);
+
+	// Heap reorders and shrinks deltids, status is still indexed by id
+	deletable = (bool *) palloc0(sizeof(bool) * num_items);
+
+	for (int i = 0; i < delstate.ndeltids; i++)
+	{
+		if (delstate.status[delstate.deltids[i].id].knowndeletable)
+			deletable[delstate.deltids[i].id] = true;
+	}
+
+	for (int i = 0; i < num_items; i++)
+	{
+		if (!deletable[i])
+			items[num_live++] = items[i];
+	}
+
+	if (num_live < num_items)
+	{
+		new_leaf = (ArtNodeLeaf *) palloc(sizeof(ArtNodeLeaf) + leaf->key_len +
+										  ART_POSTING_MAX_SIZE(num_live));
+		memcpy(new_leaf, leaf, sizeof(ArtNodeLeaf) + leaf->key_len);
+		new_leaf->num_items = num_live;
+		new_leaf->posting_size =
+			_art_posting_encode(items, num_live, ART_LEAF_POSTING(new_leaf));
+
+		START_CRIT_SECTION();
+		PageIndexTupleOverwrite(pageEntry->page, off, (Item) new_leaf,
+								_art_node_size((ArtNodeHeader *) new_leaf));
+		((ArtDataPageOpaque) PageGetSpecialPointer(pageEntry->page))->remove_cycle++;
+		END_CRIT_SECTION();
+
+		pageEntry->dirty = true;
+		_art_xlog_set_latest_removed_xid(latest_removed_xid);
+
+		pfree(new_leaf);
+	}
+
+	pfree(deletable);
+	pfree(delstate.status);
+	pfree(delstate.deltids);
+	pfree(items);
+
+	return num_live < num_items;
+}
+
+void
+_update_leaf_item(ArtState * state, ArtNodeEntry * leafEntry, ArtTuple * artTuple)
+{
+	ArtPageEntry * init_leaf_page = 
+		dlist_container(ArtPageEntry, node, leafEntry->page_entry);
+	ArtNodeLeaf * init_leaf = (ArtNodeLeaf*) leafEntry->art_node;
+
+	ArtNodeLeaf * leaf = init_leaf;
+	ArtPageEntry * leaf_page = init_leaf_page;
+	ArtNodeEntry * leaf_node_entry = leafEntry;
+	ArtNodeEntry * new_leaf_entry = NULL;
+	int bitmap_threshold;
+
+	if (init_leaf->flags & ART_LEAF_BITMAP)
+	{
+		_bitmap_add_tid(state, init_leaf, init_leaf_page, &artTuple->iptr);
+		return;
+	}
+
+	// New items are always added to last leaf fragment
+	if (ItemPointerIsValid(&leaf->last_leaf_iptr))
+	{
+		leaf_node_entry = _get_node_from_iptr(state, &leaf->last_leaf_iptr);
+		leaf_page = dlist_container(ArtPageEntry, node, leaf_node_entry->page_entry);
+		leaf = (ArtNodeLeaf*) leaf_node_entry->art_node;
+	}
+
+	if (_leaf_add_item(leaf_page, ItemPointerGetOffsetNumber(&leaf_node_entry->iptr),
+					   leaf, &artTuple->iptr))
+		return;
+
+	// Drop dead versions of row before leaf chain grows for another one
+	if (state->index_unchanged &&
+		_leaf_delete_bottomup(state, leaf_page,
+							  ItemPointerGetOffsetNumber(&leaf_node_entry->iptr), leaf))
+	{
+		// Overwrite moves page data, leaves are read again
+		init_leaf = (ArtNodeLeaf *) _get_node(leafEntry);
+		leafEntry->art_node = (ArtNodeHeader *) init_leaf;
+		leaf = (ArtNodeLeaf *) _get_node(leaf_node_entry);
+		leaf_node_entry->art_node = (ArtNodeHeader *) leaf;
+
+		if (_leaf_add_item(leaf_page, ItemPointerGetOffsetNumber(&leaf_node_entry->iptr),
+						   leaf, &artTuple->iptr))
+			return;
+	}
+
+	// Keys with lots of TIDs switch to bitmap representation
+	bitmap_threshold = _art_bitmap_leaf_threshold(state->index);
+
+	if (bitmap_threshold > 0 &&
+		_leaf_chain_items(state, init_leaf) >= bitmap_threshold)
+	{
+		_leaf_convert_to_bitmap(state, leafEntry, artTuple);
+		return;
+	}
+
+	// Leaf can't grow anymore, chain new fragment, fragments store no key
+	new_leaf_entry = _add_leaf(state, artTuple, artTuple->key_len);
+
+	// Adding new leaf can't move existing items so leaf pointers are still valid
+	START_CRIT_SECTION();
+
+	ItemPointerCopy(&new_leaf_entry->iptr, &leaf->next_leaf_iptr);
+	leaf_page->dirty = true;
+
+	// Update init leaf item to point to last leaf iptr
+	ItemPointerCopy(&new_leaf_entry->iptr, &init_leaf->last_leaf_iptr);
+	init_leaf_page->dirty = true;
+
+	END_CRIT_SECTION();
+}
+
+ArtNodeEntry * 
+_add_leaf(ArtState * state, ArtTuple * artTuple, int keyOffset)
+{
+	return _add_leaf_items(state, artTuple, keyOffset, &artTuple->iptr, 1);
+}
+
+/*
+ * Add new leaf for tuple key with sorted array of TIDs. Only key suffix
+ * starting at keyOffset is stored, preceding bytes are implied by path.
+ */
+ArtNodeEntry * 
+_add_leaf_items(ArtState * state, ArtTuple * artTuple, int keyOffset,
+				ItemPointerData * items, int nitems)
+{
+	ArtPageEntry * new_leaf_page_entry;
+	ArtNodeEntry * new_leaf_node_entry;
+
+	Size leaf_key_size = artTuple->key_len - keyOffset;
+	ArtNodeLeaf * leaf = (ArtNodeLeaf*) palloc0(sizeof(ArtNodeLeaf) + leaf_key_size +
+												ART_POSTING_MAX_SIZE(nitems));
+
+	leaf->key_offset = keyOffset;
+	leaf->key_len = leaf_key_size;
+	leaf->num_items = nitems;
+	
+	memcpy(leaf->data, artTuple->key + keyOffset, leaf_key_size);
+	leaf->posting_size = _art_posting_encode(items, nitems, ART_LEAF_POSTING(leaf));
+
+	new_leaf_page_entry = 
+		_get_page_with_free_space(state,
+								  ART_LEAF_PAGE,
+								  _art_node_size((ArtNodeHeader*) leaf));
+
+	new_leaf_node_entry = _page_add_node(state, new_leaf_page_entry, (ArtNodeHeader*) leaf);
+
+	return new_leaf_node_entry;
+}
+
+/*
+ * Fill child slot for new key placed under key byte at depth. Key ending
+ * at that byte is stored as inline heap TID, otherwise new leaf is added.
+ */
+void
+_new_child_slot(ArtState * state, ArtTuple * artTuple, int depth, ItemPointer slot)
+{
+	if (depth == artTuple->key_len - 1)
+	{
+		ART_CHILD_SET_INLINE(slot, &artTuple->iptr);
+	}
+	else
+	{
+		ArtNodeEntry * leaf_node_entry = _add_leaf(state, artTuple, depth + 1);
+		ItemPointerCopy(&leaf_node_entry->iptr, slot);
+	}
+}
+
+/*
+ * Get TID of leaf holding single TID, false for any other leaf.
+ */
+bool
+_leaf_get_single_tid(ArtNodeLeaf * leaf, ItemPointer tid)
+{
+	if (leaf->num_items != 1 ||
+		(leaf->flags & ART_LEAF_BITMAP) ||
+		ItemPointerIsValid(&leaf->next_leaf_iptr))
+		return false;
+
+	return _art_posting_decode(ART_LEAF_POSTING(leaf), leaf->posting_size, tid) == 1;
+}
+
+/*
+ * Check if leaf placed under key byte at depth can be replaced by inline
+ * TID. Only leaves with single TID and key ending at depth qualify.
+ */
+bool
+_leaf_get_inline_tid(ArtNodeLeaf * leaf, int depth, ItemPointer tid)
+{
+	if (ART_LEAF_KEY_LEN(leaf) - 1 != depth)
+		return false;
+
+	return _leaf_get_single_tid(leaf, tid);
+}
+
+/*
+ * Second TID for key stored inline, move both TIDs to real leaf.
+ */
+void
+_expand_inline_tid(ArtState * state, ArtNodeEntry * nodeEntry,
+				   ItemPointer slot, ArtTuple * artTuple, int depth)
+{
+	ItemPointerData items[2];
+	ArtNodeEntry * leaf_node_entry;
+
+	ART_CHILD_GET_INLINE(slot, &items[0]);
+
+	// Same TID inserted again
+	if (_art_posting_merge_item(items, 1, &artTuple->iptr) == 1)
+		return;
+
+	leaf_node_entry = _add_leaf_items(state, artTuple, depth + 1, items, 2);
+
+	ItemPointerCopy(&leaf_node_entry->iptr, slot);
+	_page_store_node(state, nodeEntry, nodeEntry->art_node);
+}
+
+/*
+ * Make node for sorted bucket items whose keys share first offset bytes.
+ * Items that fit bucket limits are kept as single bucket, otherwise radix
+ * node with common prefix is made, with children made same way. Children
+ * are placed next to placeEntry. Bucket depth is depth.
+ */
+ArtNodeHeader *
+_bucket_make_node(ArtState * state, ArtNodeEntry * placeEntry,
+				  ArtBucketItem * items, int nitems, int depth, int offset)
+{
+	const ArtBucketItem * first = &items[0];
+	const ArtBucketItem * last = &items[nitems - 1];
+	ArtNodeHeader * node;
+	int max_lcp = Min(first->key_len, last->key_len) - offset;
+	int lcp = 0;
+	int num_groups = 0;
+	int i, j;
+
+	// Keys are sorted, so first and last share least bytes
+	while (lcp < max_lcp && first->key[offset + lcp] == last->key[offset + lcp])
+		lcp++;
+
+	if (nitems <= _art_bucket_max_keys(state->index) &&
+		_art_bucket_build_size(lcp, items, nitems, offset + lcp) <= ART_BUCKET_MAX_SIZE)
+		return _art_bucket_build(first->key + offset, lcp, items, nitems, offset + lcp);
+
+	// Keys are prefix free, so every key has byte following common prefix
+	for (i = 0; i < nitems; i++)
+	{
+		if (i == 0 || items[i].key[offset + lcp] != items[i - 1].key[offset + lcp])
+			num_groups++;
+	}
+
+	node = _art_alloc_node(num_groups <= 4 ? NODE_4 :
+						   num_groups <= 16 ? NODE_16 :
+						   num_groups <= 48 ? NODE_48 : NODE_256, lcp);
+	memcpy(ART_NODE_PREFIX(node), first->key + offset, lcp);
+
+	for (i = 0; i < nitems; i = j)
+	{
+		uint8 key_byte = items[i].key[offset + lcp];
+		ItemPointerData slot;
+
+		for (j = i + 1; j < nitems && items[j].key[offset + lcp] == key_byte; j++)
+			;
+
+		_bucket_child_slot(state, placeEntry, items + i, j - i, depth,
+						   offset + lcp + 1, &slot);
+
+		// Node type fits all groups, so node never grows here
+		_add_child(node, key_byte, &slot);
+	}
+
+	return node;
+}
+
+/*
+ * Fill radix node child slot for bucket items, offset includes child key
+ * byte.
+ */
+void
+_bucket_child_slot(ArtState * state, ArtNodeEntry * placeEntry,
+				   ArtBucketItem * items, int nitems, int depth, int offset,
+				   ItemPointer slot)
+{
+	ArtNodeHeader * node;
+	ArtPageEntry * page_entry;
+	ArtNodeEntry * node_entry;
+
+	if (nitems == 1)
+	{
+		ArtBucketItem * item = &items[0];
+
+		if (!ART_CHILD_IS_INLINE(&item->child) || item->key_len == offset)
+		{
+			// Leaf, or inline TID of key ending at child byte
+			ItemPointerCopy(&item->child, slot);
+		}
+		else
+		{
+			// Leaf stores key past child byte, preceding bytes are implied
+			ArtTuple tuple;
+			ItemPointerData tid;
+			ArtNodeEntry * leaf_node_entry;
+
+			tuple.key_len = depth + item->key_len;
+			tuple.key = palloc0(tuple.key_len);
+			memcpy(tuple.key + depth, item->key, item->key_len);
+			ART_CHILD_GET_INLINE(&item->child, &tid);
+
+			leaf_node_entry = _add_leaf_items(state, &tuple, depth + offset, &tid, 1);
+			ItemPointerCopy(&leaf_node_entry->iptr, slot);
+
+			pfree(tuple.key);
+		}
+
+		return;
+	}
+
+	node = _bucket_make_node(state, placeEntry, items, nitems, depth, offset);
+
+	page_entry = _get_node_page(state, placeEntry,
+								_art_page_node_size(node, InvalidBlockNumber));
+	node_entry = _page_add_node(state, page_entry, node);
+
+	ItemPointerCopy(&node_entry->iptr, slot);
+}
+
+/*
+ * New key reached leaf of another key, both keys go to new bucket that
+ * replaces the leaf in parent. Single TID leaf is moved into the bucket.
+ */
+void
+_bucket_split_leaf(ArtState * state, ArtNodeEntry * leafEntry,
+				   ArtNodeEntry * parentEntry, ArtTuple * artTuple, int depth)
+{
+	ArtNodeLeaf * leaf = (ArtNodeLeaf *) leafEntry->art_node;
+	ArtBucketItem items[2];
+	ArtBucketItem * leaf_item;
+	ArtBucketItem * new_item;
+	ArtNodeHeader * node;
+	ArtPageEntry * page_entry;
+	ArtNodeEntry * node_entry;
+	ItemPointerData tid;
+	bool leaf_first;
+	bool inline_leaf;
+
+	leaf_first = _art_leaf_compare(leaf, artTuple->key, artTuple->key_len) < 0;
+	leaf_item = &items[leaf_first ? 0 : 1];
+	new_item = &items[leaf_first ? 1 : 0];
+
+	inline_leaf = _leaf_get_single_tid(leaf, &tid);
+
+	leaf_item->key = &ART_LEAF_KEY_BYTE(leaf, depth);
+	leaf_item->key_len = ART_LEAF_KEY_LEN(leaf) - depth;
+
+	if (inline_leaf)
+		ART_CHILD_SET_INLINE(&leaf_item->child, &tid);
+	else
+		ItemPointerCopy(&leafEntry->iptr, &leaf_item->child);
+
+	new_item->key = artTuple->key + depth;
+	new_item->key_len = artTuple->key_len - depth;
+	ART_CHILD_SET_INLINE(&new_item->child, &artTuple->iptr);
+
+	node = _bucket_make_node(state, parentEntry, items, 2, depth, 0);
+
+	// Leaf key is copied by now, deleting leaf moves page data
+	if (inline_leaf)
+		_page_delete_node(state, leafEntry);
+
+	page_entry = _get_node_page(state, parentEntry,
+								_art_page_node_size(node, InvalidBlockNumber));
+	node_entry = _page_add_node(state, page_entry, node);
+
+	_replace_child_iptr(parentEntry->art_node, artTuple->key[depth - 1],
+						&node_entry->iptr);
+
+	_page_store_child(state, parentEntry, parentEntry->art_node,
+					  artTuple->key[depth - 1], &node_entry->iptr, false);
+}
+
+/*
+ * Insert key into bucket. Existing key gets TID added, new key rebuilds
+ * bucket which bursts into radix nodes if it gets over limits.
+ */
+void
+_bucket_insert(ArtState * state, ArtNodeEntry * nodeEntry, ArtTuple * artTuple,
+			   int depth)
+{
+	ArtNodeHeader * bucket = nodeEntry->art_node;
+	ArtNodeHeader * new_node;
+	ArtBucketItem * items;
+	int num_items = bucket->num_children;
+	bool found;
+	int pos;
+
+	pos = _art_bucket_find(bucket, artTuple->key, artTuple->key_len, depth, &found);
+
+	if (found)
+	{
+		ArtBucketEntry * entry = ART_BUCKET_ENTRY(bucket, pos);
+		ItemPointerData tids[2];
+		ArtNodeEntry * leaf_node_entry;
+		Size size;
+
+		if (!ART_CHILD_IS_INLINE(&entry->child))
+		{
+			// Leaf is updated in place, bucket is not changed
+			leaf_node_entry = _get_node_from_iptr(state, &entry->child);
+			_update_leaf_item(state, leaf_node_entry, artTuple);
+			return;
+		}
+
+		ART_CHILD_GET_INLINE(&entry->child, &tids[0]);
+
+		// Same TID inserted again
+		if (_art_posting_merge_item(tids, 1, &artTuple->iptr) == 1)
+			return;
+
+		leaf_node_entry = _add_leaf_items(state, artTuple, depth + 1, tids, 2);
+
+		size = _art_bucket_size(bucket);
+		new_node = (ArtNodeHeader *) palloc(size);
+		memcpy(new_node, bucket, size);
+		ItemPointerCopy(&leaf_node_entry->iptr, &ART_BUCKET_ENTRY(new_node, pos)->child);
+
+		_page_store_node(state, nodeEntry, new_node);
+		return;
+	}
+
+	// Full keys from bucket depth, new key goes to its sorted position
+	items = (ArtBucketItem *) palloc(sizeof(ArtBucketItem) * (num_items + 1));
+
+	for (int i = 0, j = 0; i <= num_items; i++)
+	{
+		ArtBucketEntry * entry;
+		uint8 * key;
+
+		if (i == pos)
+		{
+			items[i].key = artTuple->key + depth;
+			items[i].key_len = artTuple->key_len - depth;
+			ART_CHILD_SET_INLINE(&items[i].child, &artTuple->iptr);
+			continue;
+		}
+
+		entry = ART_BUCKET_ENTRY(bucket, j++);
+		key = palloc(bucket->prefix_key_len + entry->key_len);
+		memcpy(key, ART_BUCKET_PREFIX(bucket), bucket->prefix_key_len);
+		memcpy(key + bucket->prefix_key_len, entry->key, entry->key_len);
+
+		items[i].key = key;
+		items[i].key_len = bucket->prefix_key_len + entry->key_len;
+		ItemPointerCopy(&entry->child, &items[i].child);
+	}
+
+	new_node = _bucket_make_node(state, nodeEntry, items, num_items + 1, depth, 0);
+
+	_page_store_node(state, nodeEntry, new_node);
+
+	for (int i = 0; i <= num_items; i++)
+	{
+		if (i != pos)
+			pfree((void *) items[i].key);
+	}
+
+	pfree(items);
+}
+
+ArtNodeHeader *
+_add_child_node4(ArtNode4 * n, uint8_t key, ItemPointer iptr)
+{
+	if (n->node.num_children < 4)
+	{
+		int idx = _art_keys_lower_bound(n->keys, n->node.num_children, key);
+
+		// Shift to make room
+		memmove(n->keys + idx + 1, n->keys+idx, n->node.num_children - idx);
+		memmove(n->children + idx + 1, n->children + idx,
+				(n->node.num_children - idx) * sizeof(ItemPointerData));
+
+		n->keys[idx] = key;
+		ItemPointerCopy(iptr, &(n->children[idx]));
+		n->node.num_children++;
+
+		return NULL;
+	}
+	else
+	{
+		ArtNode16 * new_node = (ArtNode16*) _art_alloc_node(NODE_16, n->node.prefix_key_len);
+
+		memcpy(new_node->children, n->children,
+			   sizeof(ItemPointerData) * n->node.num_children);
+		memcpy(new_node->keys, n->keys,
+			   sizeof(uint8_t) * n->node.num_children);
+
+		_art_copy_header((ArtNodeHeader*) new_node, (ArtNodeHeader*) n);
+		_add_child_node16(new_node, key, iptr);
+
+		return (ArtNodeHeader *) new_node;
+	}
+}
+
+ArtNodeHeader * 
+_add_child_node16(ArtNode16 * n, uint8_t key, ItemPointer iptr)
+{
+	if (n->node.num_children < 16)
+	{
+		int idx = _art_keys_lower_bound(n->keys, n->node.num_children, key);
+
+		// Shift to make room
+		memmove(n->keys + idx + 1, n->keys+idx, n->node.num_children - idx);
+		memmove(n->children+idx + 1, n->children+idx,
+				(n->node.num_children - idx) * sizeof(ItemPointerData));
+
+		n->keys[idx] = key;
+		ItemPointerCopy(iptr, &(n->children[idx]));
+		n->node.num_children++;
+
+		return NULL;
+	}
+	else
+	{
+		ArtNode48 * new_node = (ArtNode48*) _art_alloc_node(NODE_48, n->node.prefix_key_len);
+
+		// Copy the child pointers and populate the key map
+		memcpy(new_node->children, n->children, 
+			   sizeof(ItemPointerData) * n->node.num_children);
+
+		for (int i = 0; i <n ->node.num_children; i++)
+		{
+			new_node->keys[n->keys[i]] = i + 1;
+			ART_KEY_BITMAP_SET(new_node->present, n->keys[i]);
+		}
+
+		new_node->used_slots = (UINT64CONST(1) << n->node.num_children) - 1;
+
+		_art_copy_header((ArtNodeHeader*)new_node, (ArtNodeHeader*)n);
+		_add_child_node48(new_node, key, iptr);
+
+		return (ArtNodeHeader*) new_node;
+	}
+}
+
+ArtNodeHeader *
+_add_child_node48(ArtNode48 * n, uint8_t key, ItemPointer iptr)
+{
+	if (n->node.num_children < 48) 
+	{
+		int idx = pg_rightmost_one_pos64(~n->used_slots);
+
+		n->keys[key] = idx + 1;
+		ItemPointerCopy(iptr, &(n->children[idx]));
+		ART_KEY_BITMAP_SET(n->present, key);
+		n->used_slots |= UINT64CONST(1) << idx;
+		n->node.num_children++;
+
+		return NULL;
+	}
+	else
+	{
+		ArtNode256 *new_node = (ArtNode256*) _art_alloc_node(NODE_256, n->node.prefix_key_len);
+
+		for (int i = _art_key_bitmap_next(n->present, 0); i >= 0;
+			 i = _art_key_bitmap_next(n->present, i + 1))
+			ItemPointerCopy(&n->children[n->keys[i] - 1], &new_node->children[i]);
+
+		memcpy(new_node->present, n->present, sizeof(n->present));
+
+		_art_copy_header((ArtNodeHeader*)new_node, (ArtNodeHeader*)n);
+		_add_child_node256(new_node, key, iptr);
+
+		return (ArtNodeHeader*) new_node;
+	}
+}
+
+ArtNodeHeader * 
+_add_child_node256(ArtNode256 * n, uint8_t key, ItemPointer iptr)
+{
+	ItemPointerCopy(iptr, &(n->children[key]));
+	ART_KEY_BITMAP_SET(n->present, key);
+	n->node.num_children++;
+	return NULL;
+}
+
+ArtNodeHeader *
+_add_child(ArtNodeHeader *node, uint8 key, ItemPointer iptr)
+{
+	switch (node->node_type)
+	{
+		case NODE_4:
+			return _add_child_node4((ArtNode4*) node, key, iptr);
+
+		case NODE_16:
+			return _add_child_node16((ArtNode16*) node, key, iptr);
+
+		case NODE_48:
+			return _add_child_node48((ArtNode48*) node, key, iptr);
+
 		case NODE_256:
+			return _add_child_node256((ArtNode256*) node, key, iptr);
+		
+		default:
+			elog(ERROR, "Unknown node type");
+	}
+}
+
+void
+_replace_child_iptr(ArtNodeHeader * node, uint8 key, ItemPointer iptr)
+{
+	ItemPointer child_iptr = _art_find_child_equal(node, key);
+	ItemPointerCopy(iptr, child_iptr);
+}
+
+/*
+ * Get page entry for block, every call should be paired with
+ * _art_page_release.
+ */
+ArtPageEntry *
+_get_page(ArtState * state, BlockNumber blkNum)
+{
+	ArtPageEntry * page_entry;
+	bool is_new_page_entry = false;
+
+	if (IS_MEMORY_BUILD(state))
+	{
+		page_entry = _art_get_page_hash(state->build_state->page_lookup_hash, blkNum);
+
+		if (!page_entry)
+		{
+			page_entry = _art_copy_page(state->index, blkNum);
+			dlist_push_head(&state->pages, &page_entry->node);
+			_art_add_page_hash(state->build_state->page_lookup_hash,
+							   page_entry->blk_num,
+							   page_entry);
+		}
+	}
+	else
+	{
+		page_entry = 
+			dlist_container(ArtPageEntry, node,
+							_art_load_page(state->index, &state->pages, blkNum,
+										   BUFFER_LOCK_EXCLUSIVE, &is_new_page_entry));
+		if (is_new_page_entry)
+			dlist_push_head(&state->pages, &page_entry->node);
+	}
+
+	return page_entry;
+}
+
+/*
+ * Allocate new empty page that is not part of any tail page chain.
+ */
+ArtPageEntry *
+_get_new_page(ArtState * state, uint8 pageType)
+{
+	ArtPageEntry * new_page_entry;
+
+	if (IS_MEMORY_BUILD(state))
+	{
+		new_page_entry = _art_new_page(pageType);
+		new_page_entry->blk_num = state->build_state->num_allocated_pages++;
+		_art_add_page_hash(state->build_state->page_lookup_hash,
+						   new_page_entry->blk_num,
+						   new_page_entry);
+	}
+	else
+	{
+		new_page_entry = _art_get_buffer(state->index, pageType);
+	}
+
+	dlist_push_tail(&state->pages, &new_page_entry->node);
+
+	return new_page_entry;
+}
+
+ArtNodeEntry *
+_get_node_from_iptr(ArtState * state, ItemPointer iptr)
+{
+	ArtNodeEntry * node_entry = (ArtNodeEntry *) palloc0(sizeof(ArtNodeEntry));
+	ArtPageEntry * page_entry = _get_page(state, ItemPointerGetBlockNumber(iptr));
+
+	ItemPointerCopy(iptr, &node_entry->iptr);
+
+	node_entry->page_entry = &page_entry->node;
+	node_entry->art_node = _get_node(node_entry);
+	node_entry->memory_node = false;
+
+	// Radix nodes are modified in memory form and encoded back on update
+	if (node_entry->art_node->node_type != NODE_LEAF &&
+		node_entry->art_node->node_type != NODE_BUCKET)
+	{
+		node_entry->art_node = _art_page_node_decode(node_entry->art_node,
+													 ItemPointerGetBlockNumber(iptr));
+		node_entry->memory_node = true;
+	}
+
+	dlist_push_head(&state->art_nodes, &node_entry->node);
+
+	return node_entry;
+}
+
+
+ArtPageEntry * 
+_get_page_with_free_space(ArtState * state, uint8 pageType, Size itemsz)
+{
+	ArtPageEntry * last_page_entry = NULL;
+	ArtPageEntry * new_page_entry = NULL;
+	dlist_head metadata_page_head;
+	ArtPageEntry * metadata_page_entry = NULL;
+	ArtMetaDataPageOpaque metadata_opaque = NULL;
+
+	Size page_freespace;
+	int fillfactor;
+	ArtDataPageOpaque opaque;
+
+	bool is_new_page_entry = false;
+	bool empty_last_page;
+
+	dlist_node *last_page = NULL;
+	BlockNumber last_page_blk_num;
+
+	if (pageType == ART_NODE_PAGE)
+	{
+		last_page = state->node_last_page;
+	}
+	else
+	{
+		last_page = state->leaf_last_page;
+	}
+
+	empty_last_page = last_page == NULL;
+
+	if (!IS_MEMORY_BUILD(state) && !last_page)
+	{
+		dlist_init(&metadata_page_head);
+
+		metadata_page_entry = _art_get_metadata_page(state->index);
+
+		dlist_push_head(&metadata_page_head, &metadata_page_entry->node);
+	
+		metadata_opaque =
+			(ArtMetaDataPageOpaque) PageGetSpecialPointer(metadata_page_entry->page);
+
+		if (pageType == ART_NODE_PAGE)
+		{
+			last_page_blk_num = metadata_opaque->last_internal_node_blk_num;
+		}
+		else
+		{
+			last_page_blk_num = metadata_opaque->last_leaf_blk_num;
+		}
+
+		last_page =
+			_art_load_page(state->index, &state->pages,
+						   last_page_blk_num,
+						   BUFFER_LOCK_EXCLUSIVE,
+						   &is_new_page_entry);
+
+		if (is_new_page_entry)
+			dlist_push_tail(&state->pages, last_page);
+
+		_art_page_release(metadata_page_entry);
+	}
+
+	last_page_entry = dlist_container(ArtPageEntry, node, last_page);
+
+	page_freespace = PageGetFreeSpace(last_page_entry->page);
+	fillfactor = _art_fillfactor(state->index, pageType);
+
+	// Keep some freespace for LEAF pages, or as much as index fillfactor says
+	if (fillfactor != ART_OPTION_UNSET)
+		page_freespace -= Min(page_freespace, ART_FILLFACTOR_RESERVE(fillfactor));
+	else if (pageType == ART_LEAF_PAGE)
+		page_freespace *= page_leaf_insert_treshold; 
+
+	// Check if tail pages have enough free space
+	if (page_freespace > MAXALIGN(itemsz))
+	{
+		if (metadata_page_entry == NULL && !IS_MEMORY_BUILD(state) && 
+			last_page)
+		{
+			last_page_entry->ref_count++;
+		}
+		return last_page_entry;
+	}
+
+	// Pages with space freed by moved or deleted items are reused first
+	new_page_entry = _get_cached_page(state, pageType, itemsz);
+
+	if (new_page_entry != NULL)
+	{
+		if (empty_last_page && !IS_MEMORY_BUILD(state))
+			_art_page_release(last_page_entry);
+
+		return new_page_entry;
+	}
+
+	if (IS_MEMORY_BUILD(state))
+	{
+		new_page_entry = _art_new_page(pageType == ART_NODE_PAGE ? ART_NODE_PAGE : ART_LEAF_PAGE);
+		new_page_entry->blk_num = state->build_state->num_allocated_pages++;
+		_art_add_page_hash(state->build_state->page_lookup_hash,
+						   new_page_entry->blk_num,
+						   new_page_entry);
+	}
+	else
+	{
+		dlist_init(&metadata_page_head);
+
+		metadata_page_entry = _art_get_metadata_page(state->index);
+
+		metadata_opaque =
+			(ArtMetaDataPageOpaque) PageGetSpecialPointer(metadata_page_entry->page);
+
+		dlist_push_head(&metadata_page_head, &metadata_page_entry->node);
+
+		new_page_entry = 
+			_art_get_buffer(state->index,
+							pageType == ART_NODE_PAGE ? ART_NODE_PAGE : ART_LEAF_PAGE);
+	}
+
+	opaque = (ArtDataPageOpaque) PageGetSpecialPointer(last_page_entry->page);
+	opaque->right_link = new_page_entry->blk_num;
+
+	dlist_push_tail(&state->pages, &new_page_entry->node);
+
+	if (IS_MEMORY_BUILD(state))
+	{
+		if (pageType == ART_NODE_PAGE)
+		{
+			state->build_state->metadata.last_internal_node_blk_num =
+				new_page_entry->blk_num;
+		}
+		else
+		{
+			state->build_state->metadata.last_leaf_blk_num =
+				new_page_entry->blk_num;
+		}
+	}
+	else
+	{
+		if (pageType == ART_NODE_PAGE)
+		{
+			metadata_opaque->last_internal_node_blk_num = new_page_entry->blk_num;
+		}
+		else
+		{
+			metadata_opaque->last_leaf_blk_num = new_page_entry->blk_num;
+		}
+
+		metadata_page_entry->dirty = true;
+
+		// release if we last_data_page
+		if (empty_last_page)
+			_art_page_release(last_page_entry);
+
+		_art_page_release(metadata_page_entry);
+	}
+
+	if (pageType == ART_NODE_PAGE)
+	{
+		state->node_last_page = &new_page_entry->node;
+	}
+	else
+	{
+		state->leaf_last_page =  &new_page_entry->node;
+	}
+
+	return new_page_entry;
+}
+
+/*
+ * Get page for new inner node that is child of parentEntry node. Node is
+ * placed on its parent's page when there is space left, so lookup follows
+ * subtree within one page. Otherwise node goes to tail node page, where
+ * its own children will follow it.
+ */
+ArtPageEntry *
+_get_node_page(ArtState * state, ArtNodeEntry * parentEntry, Size itemsz)
+{
+	if (parentEntry && _art_subtree_node_placement(state->index))
+	{
+		ArtPageEntry * parent_page =
+			dlist_container(ArtPageEntry, node, parentEntry->page_entry);
+		ArtDataPageOpaque opaque =
+			(ArtDataPageOpaque) PageGetSpecialPointer(parent_page->page);
+
+		if ((opaque->page_flags & ART_NODE_PAGE) &&
+			PageGetFreeSpace(parent_page->page) >=
+			MAXALIGN(itemsz) + _art_node_page_reserve(state->index))
+		{
+			if (!IS_MEMORY_BUILD(state))
+				parent_page->ref_count++;
+
+			return parent_page;
+		}
+	}
+
+	return _get_page_with_free_space(state, ART_NODE_PAGE, itemsz);
+}
+
+ArtNodeEntry *
+_page_add_node(ArtState * state, ArtPageEntry * pageEntry, 
+			   ArtNodeHeader * node)
+{
+	ArtNodeEntry * new_node_entry;
+	ItemOffset page_node_offset;
+	ArtDataPageOpaque opaque;
+	Size size = _art_page_node_size(node, pageEntry->blk_num);
+	ArtNodeHeader * page_node;
+
+	// Keys are checked on insert, larger item means broken node
+	if (size > ART_PAGE_SIZE)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("ART index \"%s\" item size %zu exceeds maximum %zu",
+						RelationGetRelationName(state->index), size,
+						(Size) ART_PAGE_SIZE)));
+
+	if (PageGetFreeSpace(pageEntry->page) < MAXALIGN(size))
+		elog(ERROR, "no space for item of size %zu on page %u of ART index \"%s\"",
+			 size, pageEntry->blk_num, RelationGetRelationName(state->index));
+
+	page_node = _art_page_node_encode(node, pageEntry->blk_num);
+
+	new_node_entry = (ArtNodeEntry *) palloc0(sizeof(ArtNodeEntry));
+	opaque = (ArtDataPageOpaque) PageGetSpecialPointer(pageEntry->page);
+
+	new_node_entry->page_entry = &pageEntry->node;
+	new_node_entry->art_node = node;
+	new_node_entry->memory_node = true;
+
+	START_CRIT_SECTION();
+	page_node_offset = 
+		PageAddItem(pageEntry->page, (Item) page_node, size, 0, false, false);
+	if (page_node_offset == InvalidOffsetNumber)
+		elog(ERROR, "failed to add item to page %u of ART index \"%s\"",
+			 pageEntry->blk_num, RelationGetRelationName(state->index));
+	END_CRIT_SECTION();
+
+	if (page_node != node)
+		pfree(page_node);
+
+	ItemPointerSetOffsetNumber(&new_node_entry->iptr, page_node_offset);
+	ItemPointerSetBlockNumber(&new_node_entry->iptr, pageEntry->blk_num);
+
+	dlist_push_head(&state->art_nodes, &new_node_entry->node);
+	pageEntry->dirty = true;
+
+	// page cache
+
+	opaque->n_total++;
+
+	// Item may carry TIDs moved from page bulk delete hasn't swept yet
+	_page_vacuum_stamp(state, pageEntry);
+
+	return new_node_entry;
+}
+
+void
+_page_update_node(ArtNodeEntry * nodeEntry, ArtNodeHeader * node)
+{
+	Offset off = ItemPointerGetOffsetNumber(&nodeEntry->iptr);
+	BlockNumber blk_num = ItemPointerGetBlockNumber(&nodeEntry->iptr);
+	Size nodeSize = _art_page_node_size(node, blk_num);
+	ArtPageEntry * page_entry = dlist_container(ArtPageEntry, node, nodeEntry->page_entry);
+	ArtNodeHeader * page_node = _art_page_node_encode(node, blk_num);
+
+	START_CRIT_SECTION();
+
+	PageIndexTupleOverwrite(page_entry->page, off, (Item) page_node, nodeSize);
+	page_entry->dirty = true;
+	
+	END_CRIT_SECTION();
+
+	if (page_node != node)
+		pfree(page_node);
+}
+
+/*
+ * Remove node item from its page. Remaining items keep their offsets.
+ * Item is marked dead, its line pointer and space are reused once scans
+ * that may still read it are gone, see ArtDataPageOpaqueData.
+ */
+void
+_page_delete_node(ArtState * state, ArtNodeEntry * nodeEntry)
+{
+	_page_delete_item(state, dlist_container(ArtPageEntry, node, nodeEntry->page_entry),
+					  ItemPointerGetOffsetNumber(&nodeEntry->iptr));
+}
+
+void
+_page_delete_item(ArtState * state, ArtPageEntry * pageEntry, OffsetNumber off)
+{
+	ItemId item_id = PageGetItemId(pageEntry->page, off);
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(pageEntry->page);
+	FullTransactionId dead_xid;
+
+	// Nothing scans index being built
+	if (IS_MEMORY_BUILD(state))
+	{
+		PageIndexTupleDeleteNoCompact(pageEntry->page, off);
+		PageSetHasFreeLinePointers(pageEntry->page);
+		pageEntry->dirty = true;
+
+		_page_cache_record(state, pageEntry);
+		return;
+	}
+
+	// Items that died earlier may be freed by now
+	if (_art_page_prune(state->index, pageEntry->page))
+	{
+		pageEntry->dirty = true;
+		_page_cache_record(state, pageEntry);
+	}
+
+	dead_xid = ReadNextFullTransactionId();
+
+	START_CRIT_SECTION();
+	ItemIdMarkDead(item_id);
+	opaque->n_deleted++;
+	opaque->deleted_item_size += ItemIdGetLength(item_id);
+	opaque->dead_xid = dead_xid;
+	opaque->remove_cycle++;
+	END_CRIT_SECTION();
+
+	pageEntry->dirty = true;
+}
+
+/*
+ * Get page cache, from build state during memory build, or from locked
+ * metadata page that caller releases.
+ */
+ArtMetaDataPageOpaque
+_get_page_cache(ArtState * state, dlist_head * metadataHead, ArtPageEntry ** metadataEntry)
+{
+	if (IS_MEMORY_BUILD(state))
+	{
+		*metadataEntry = NULL;
+		return &state->build_state->metadata;
+	}
+
+	dlist_init(metadataHead);
+
+	*metadataEntry = _art_get_metadata_page(state->index);
+	dlist_push_head(metadataHead, &(*metadataEntry)->node);
+
+	return (ArtMetaDataPageOpaque) PageGetSpecialPointer((*metadataEntry)->page);
+}
+
+/*
+ * Remember page with freed space in page cache.
+ */
+void
+_page_cache_record(ArtState * state, ArtPageEntry * pageEntry)
+{
+	dlist_head metadata_page_head;
+	ArtPageEntry * metadata_page_entry;
+	ArtMetaDataPageOpaque metadata;
+
+	metadata = _get_page_cache(state, &metadata_page_head, &metadata_page_entry);
+
+	if (_art_page_cache_put(metadata, pageEntry->blk_num, pageEntry->page) &&
+		metadata_page_entry)
+		metadata_page_entry->dirty = true;
+
+	_art_page_release(metadata_page_entry);
+}
+
+/*
+ * List page that got items moved in for running bulk delete, which may
+ * have swept page already. Page is stamped with bulk delete cycle, so it
+ * is listed once until bulk delete visits it again. Cycle only changes
+ * while bulk delete holds metadata page lock tag exclusively, so it is
+ * read once per insert.
+ */
+void
+_page_vacuum_stamp(ArtState * state, ArtPageEntry * pageEntry)
+{
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(pageEntry->page);
+	ArtPageEntry * metadata_page_entry;
+	ArtMetaDataPageOpaque metadata;
+
+	if (IS_MEMORY_BUILD(state))
+		return;
+
+	if (!state->vacuum_cycle_known)
+	{
+		metadata_page_entry = _art_get_metadata_page(state->index);
+		metadata = (ArtMetaDataPageOpaque) PageGetSpecialPointer(metadata_page_entry->page);
+		state->vacuum_cycle = metadata->vacuum_cycle;
+		state->vacuum_cycle_known = true;
+		_art_page_release(metadata_page_entry);
+	}
+
+	if (state->vacuum_cycle == 0 || opaque->vacuum_cycle == state->vacuum_cycle)
+		return;
+
+	metadata_page_entry = _art_get_metadata_page(state->index);
+	metadata = (ArtMetaDataPageOpaque) PageGetSpecialPointer(metadata_page_entry->page);
+
+	START_CRIT_SECTION();
+
+	opaque->vacuum_cycle = state->vacuum_cycle;
+
+	if (metadata->num_vacuum_blks < ART_VACUUM_BLKS)
+		metadata->vacuum_blks[metadata->num_vacuum_blks++] = pageEntry->blk_num;
+	else
+		metadata->num_vacuum_blks = ART_VACUUM_BLKS_OVERFLOW;
+
+	END_CRIT_SECTION();
+
+	pageEntry->dirty = true;
+	metadata_page_entry->dirty = true;
+
+	_art_page_release(metadata_page_entry);
+}
+
+/*
+ * Get cached page of pageType that has space for item, or NULL. Cached
+ * free space may be obsolete, so it is checked once page is locked. Pages
+ * not held yet are only locked if lock is free, to not wait on other
+ * inserters while holding their pages.
+ */
+ArtPageEntry *
+_get_cached_page(ArtState * state, uint8 pageType, Size itemsz)
+{
+	dlist_head metadata_page_head;
+	ArtPageEntry * metadata_page_entry;
+	ArtMetaDataPageOpaque metadata;
+	ArtPageEntry * page_entry = NULL;
+	int first = ART_PAGE_CACHE_FIRST(pageType);
+
+	metadata = _get_page_cache(state, &metadata_page_head, &metadata_page_entry);
+
+	for (int i = first; i < first + ART_CACHED_PAGES / 2 && page_entry == NULL; i++)
+	{
+		ArtPageCache * cache = &metadata->page_cache[i];
+		ArtDataPageOpaque opaque;
+		dlist_iter iter;
+		Buffer buffer;
+
+		if (cache->blk_num == ART_METADATA_NODE_BLKNO ||
+			cache->free_space < (int) MAXALIGN(itemsz))
+			continue;
+
+		if (IS_MEMORY_BUILD(state))
+			page_entry = _get_page(state, cache->blk_num);
+		else
 		{
-			ArtNode256 * node256 = (ArtNode256 *) node;
-			for (i = 0 ; i < 256; i++)
+			dlist_foreach(iter, &state->pages)
 			{
-				if (ItemPointerIsValid(&node256->children[i]))
+				ArtPageEntry * held = dlist_container(ArtPageEntry, node, iter.cur);
+
+				if (held->blk_num == cache->blk_num)
 				{
-					_update_child_node_parent_iptr(state, &node256->children[i],
-												   &nodeEntry->iptr);
+					page_entry = held;
+					page_entry->ref_count++;
+					break;
 				}
 			}
+
+			if (page_entry == NULL)
+			{
+				buffer = _art_xlog_read_buffer(state->index, cache->blk_num, true);
+
+				if (!BufferIsValid(buffer))
+					continue;
+
+				page_entry = (ArtPageEntry *) palloc0(sizeof(ArtPageEntry));
+				page_entry->blk_num = cache->blk_num;
+				page_entry->buffer = buffer;
+				page_entry->page = BufferGetPage(buffer);
+				page_entry->ref_count = 1;
+				dlist_push_head(&state->pages, &page_entry->node);
+			}
+		}
+
+		opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page_entry->page);
+		cache->free_space = PageGetFreeSpace(page_entry->page);
+
+		if (metadata_page_entry)
+			metadata_page_entry->dirty = true;
+
+		if (!(opaque->page_flags & pageType) ||
+			cache->free_space < (int) MAXALIGN(itemsz))
+		{
+			_art_page_release(page_entry);
+			page_entry = NULL;
 		}
 	}
+
+	_art_page_release(metadata_page_entry);
+
+	return page_entry;
 }
 
-ArtNodeEntry *
-_get_node_from_iptr(ArtState * state, ItemPointer iptr)
+/*
+ * Write in memory node back to its page after child of key was replaced,
+ * or added if add is set. Only that slot of page item is written if it
+ * keeps its encoding, otherwise whole node is stored.
+ */
+void
+_page_store_child(ArtState * state, ArtNodeEntry * nodeEntry, ArtNodeHeader * node,
+				  uint8 key, ItemPointer child, bool add)
 {
-	BlockNumber blk_num = ItemPointerGetBlockNumber(iptr);
-	ArtNodeEntry * node_entry = (ArtNodeEntry *) palloc0(sizeof(ArtNodeEntry));
-	ArtPageEntry * page_entry;
-	bool is_new_page_entry = false;
+	ArtPageEntry * page_entry = dlist_container(ArtPageEntry, node, nodeEntry->page_entry);
+	ArtNodeHeader * page_node = (ArtNodeHeader *)
+		PageGetItem(page_entry->page,
+					PageGetItemId(page_entry->page, ItemPointerGetOffsetNumber(&nodeEntry->iptr)));
+	bool stored;
 
-	if (IS_MEMORY_BUILD(state))
-	{
-		page_entry = _art_get_page_hash(state->build_state->page_lookup_hash, blk_num);
+	START_CRIT_SECTION();
+	stored = _art_page_node_set_child(page_node, page_entry->blk_num, key, child, add);
+	END_CRIT_SECTION();
 
-		if (!page_entry)
-		{
-			page_entry = _art_copy_page(state->index, blk_num);
-			dlist_push_head(&state->pages, &page_entry->node);
-			_art_add_page_hash(state->build_state->page_lookup_hash,
-							   page_entry->blk_num,
-							   page_entry);
-		}
+	if (!stored)
+	{
+		_page_store_node(state, nodeEntry, node);
+		return;
 	}
-	else
+
+	page_entry->dirty = true;
+
+	if (nodeEntry->memory_node && nodeEntry->art_node != node)
+		pfree(nodeEntry->art_node);
+
+	nodeEntry->art_node = node;
+	nodeEntry->memory_node = true;
+}
+
+/*
+ * Write in memory node back to its page. Node that does not fit on its
+ * page anymore is moved to another page, parent slot is updated then which
+ * can move parent as well. Root node is created with reserved size and is
+ * never moved.
+ */
+void
+_page_store_node(ArtState * state, ArtNodeEntry * nodeEntry, ArtNodeHeader * node)
+{
+	ArtNodeEntry * new_node_entry;
+	ArtPageEntry * new_page_entry;
+	ArtNodeEntry * parent_node_entry;
+
+	ArtPageEntry * old_page_entry = dlist_container(ArtPageEntry, node, nodeEntry->page_entry);
+
+	Offset old_off = ItemPointerGetOffsetNumber(&nodeEntry->iptr);
+	Size old_size = ItemIdGetLength(PageGetItemId(old_page_entry->page, old_off));
+	Size new_size = _art_page_node_size(node, old_page_entry->blk_num);
+
+	if (MAXALIGN(new_size) <= MAXALIGN(old_size) ||
+		PageGetExactFreeSpace(old_page_entry->page) >= 
+		 MAXALIGN(new_size) - MAXALIGN(old_size))
 	{
-		page_entry = 
-			dlist_container(ArtPageEntry, node,
-							_art_load_page(state->index, &state->pages, blk_num,
-										   BUFFER_LOCK_EXCLUSIVE, &is_new_page_entry));
-		if (is_new_page_entry)
-			dlist_push_head(&state->pages, &page_entry->node);
+		_page_update_node(nodeEntry, node);
+
+		if (nodeEntry->memory_node && nodeEntry->art_node != node)
+			pfree(nodeEntry->art_node);
+
+		nodeEntry->art_node = node;
+		nodeEntry->memory_node = true;
+
+		return;
 	}
 
-	ItemPointerCopy(iptr, &node_entry->iptr);
+	if (!dlist_has_next(&state->art_nodes, &nodeEntry->node))
+		elog(ERROR, "no space left for ART root node");
 
-	node_entry->page_entry = &page_entry->node;
-	node_entry->art_node = _get_node(node_entry);
-	node_entry->memory_node = false;
+	parent_node_entry = 
+		dlist_container(ArtNodeEntry, node, dlist_next_node(&state->art_nodes, &nodeEntry->node));
 
-	dlist_push_head(&state->art_nodes, &node_entry->node);
+	_page_delete_node(state, nodeEntry);
 
-	return node_entry;
-}
+	// New entry takes ownership of in memory node
+	if (nodeEntry->memory_node && nodeEntry->art_node != node)
+		pfree(nodeEntry->art_node);
 
+	nodeEntry->art_node = NULL;
+	nodeEntry->memory_node = false;
 
-ArtPageEntry * 
-_get_page_with_free_space(ArtState * state, uint8 pageType, Size itemsz)
-{
-	ArtPageEntry * last_page_entry = NULL;
-	ArtPageEntry * new_page_entry = NULL;
-	dlist_head metadata_page_head;
-	ArtPageEntry * metadata_page_entry = NULL;
-	ArtMetaDataPageOpaque metadata_opaque = NULL;
+	new_page_entry = _get_node_page(state, parent_node_entry,
+									_art_page_node_size(node, InvalidBlockNumber));
 
-	Size page_freespace;
-	ArtDataPageOpaque opaque;
+	new_node_entry = _page_add_node(state, new_page_entry, node);
 
-	bool is_new_page_entry = false;
-	bool empty_last_page;
+	// Children are not pointing back to node, only parent slot is updated
+	_replace_child_iptr(parent_node_entry->art_node, nodeEntry->parent_key,
+						&new_node_entry->iptr);
 
-	dlist_node *last_page = NULL;
-	BlockNumber last_page_blk_num;
+	_page_store_child(state, parent_node_entry, parent_node_entry->art_node,
+					  nodeEntry->parent_key, &new_node_entry->iptr, false);
+}
 
-	if (pageType == ART_NODE_PAGE)
+
+ItemPointer
+_node_insert_recursive(ArtState * state,
+					   ArtNodeHeader * node,
+					   ArtTuple *artTuple,
+					   int depth)
+{
+	ArtNodeEntry * node_entry = dlist_container(ArtNodeEntry, node, dlist_head_node(&state->art_nodes));
+	ArtNodeEntry * parent_node_entry = NULL;
+	ArtNodeHeader * parent_node = NULL;
+
+	if (dlist_has_next(&state->art_nodes, &node_entry->node))
 	{
-		last_page = state->node_last_page;
+		parent_node_entry = 
+			dlist_container(ArtNodeEntry, node, 
+							dlist_next_node(&state->art_nodes, &node_entry->node));
+
+		/*
+		 * Whole descent path is kept, node that grows out of its page
+		 * updates its parent which in turn can move.
+		 */
+		parent_node = parent_node_entry->art_node;
 	}
-	else
+
+	if (node->node_type == NODE_LEAF)
 	{
-		last_page = state->leaf_last_page;
+		ArtNodeLeaf * leaf = (ArtNodeLeaf *) node;
+	
+		ArtNodeEntry * leaf_node_entry = node_entry;
+		
+		ArtNode4 * new_node4 = NULL;
+		ArtPageEntry * new_node4_page_entry = NULL;
+		ArtNodeEntry * new_node4_node_entry = NULL;
+
+		ItemPointerData leaf_slot;
+		ItemPointerData new_slot;
+		uint8 leaf_key_byte;
+		int longest_prefix = 0;
+
+		// Check if we are updating an existing value
+		if (!_art_leaf_matches(leaf, artTuple->key, artTuple->key_len))
+		{
+			_update_leaf_item(state, leaf_node_entry, artTuple);
+			return NULL;
+		}
+
+		if (_art_bucket_max_keys(state->index) >= 2)
+		{
+			_bucket_split_leaf(state, leaf_node_entry, parent_node_entry, artTuple, depth);
+			return NULL;
+		}
+
+		// Determine longest prefix
+		longest_prefix = _art_longest_common_prefix(leaf, artTuple->key,
+													artTuple->key_len, depth);
+
+		// New value, we must split the leaf into a node4
+		new_node4 = (ArtNode4 *) _art_alloc_node(NODE_4, longest_prefix);
+		memcpy(ART_NODE_PREFIX(new_node4), artTuple->key + depth, longest_prefix);
+
+		leaf_key_byte = ART_LEAF_KEY_BYTE(leaf, depth+longest_prefix);
+
+		// Existing single TID leaf may end right under new node4, deleting
+		// it moves page data so leaf is not accessed afterwards
+		if (_leaf_get_inline_tid(leaf, depth + longest_prefix, &leaf_slot))
+		{
+			ART_CHILD_SET_INLINE(&leaf_slot, &leaf_slot);
+			_page_delete_node(state, leaf_node_entry);
+		}
+		else
+		{
+			ItemPointerCopy(&leaf_node_entry->iptr, &leaf_slot);
+		}
+
+		_add_child((ArtNodeHeader *) new_node4, leaf_key_byte, &leaf_slot);
+
+		_new_child_slot(state, artTuple, depth + longest_prefix, &new_slot);
+
+		_add_child((ArtNodeHeader *) new_node4, artTuple->key[depth+longest_prefix],
+				   &new_slot);
+
+		new_node4_page_entry = 
+			_get_node_page(state, parent_node_entry,
+						   _art_page_node_size((ArtNodeHeader*) new_node4, InvalidBlockNumber));
+
+		new_node4_node_entry = _page_add_node(state, new_node4_page_entry,
+											  (ArtNodeHeader*) new_node4);
+
+		// update to point to node4
+		_replace_child_iptr(parent_node, artTuple->key[depth - 1],
+							&new_node4_node_entry->iptr);
+
+		_page_store_child(state, parent_node_entry, parent_node,
+						  artTuple->key[depth - 1], &new_node4_node_entry->iptr, false);
+
+		return NULL;
 	}
 
-	empty_last_page = last_page == NULL;
+	if (node->node_type == NODE_BUCKET)
+	{
+		_bucket_insert(state, node_entry, artTuple, depth);
+		return NULL;
+	}
 
-	if (!IS_MEMORY_BUILD(state) && !last_page)
+	if (node->prefix_key_len)
 	{
-		dlist_init(&metadata_page_head);
+		ArtNode4 * new_node4 = NULL;
+		ArtPageEntry * new_node4_page_entry = NULL;
+		ArtNodeEntry * new_node4_node_entry = NULL;
+
+		ItemPointerData new_slot;
+
+		ArtNodeHeader * new_node = NULL;
+		uint8 * prefix = ART_NODE_PREFIX(node);
+
+		// Determine if the prefixes differ, since we need to split
+		int prefix_diff = _art_check_prefix(prefix, node->prefix_key_len,
+											artTuple->key, artTuple->key_len, depth);
+
+		if (prefix_diff >= node->prefix_key_len)
+		{
+			depth += node->prefix_key_len;
+			goto RECURSE_SEARCH;
+		}
+
+		// Create a new node
+		new_node4 = (ArtNode4*) _art_alloc_node(NODE_4, prefix_diff);
+		memcpy(ART_NODE_PREFIX(new_node4), prefix, prefix_diff);
+
+		_add_child((ArtNodeHeader *) new_node4, prefix[prefix_diff], &node_entry->iptr);
+
+		// Adjust the prefix of the old node, node item shrinks
+		new_node = _art_node_set_prefix(node, prefix + prefix_diff + 1,
+										node->prefix_key_len - (prefix_diff + 1));
+
+		_page_store_node(state, node_entry, new_node);
+
+		// Leaf or inline TID for new new node4
+		_new_child_slot(state, artTuple, depth + prefix_diff, &new_slot);
+
+		_add_child((ArtNodeHeader*) new_node4, artTuple->key[depth+prefix_diff],
+				   &new_slot);
+
+		// persist node4 to index
+		new_node4_page_entry = 
+			_get_node_page(state, parent_node_entry,
+						   _art_page_node_size((ArtNodeHeader*) new_node4, InvalidBlockNumber));
+
+
+		new_node4_node_entry = _page_add_node(state, new_node4_page_entry, (ArtNodeHeader*) new_node4);
+
+		// Update parent to point to new node4
+		_replace_child_iptr(parent_node, artTuple->key[depth-1], &new_node4_node_entry->iptr);
+
+		_page_store_child(state, parent_node_entry, parent_node,
+						  artTuple->key[depth-1], &new_node4_node_entry->iptr, false);
+
+		return NULL;
+	}
+
+RECURSE_SEARCH:;
 
-		metadata_page_entry = _art_get_metadata_page(state->index);
+	{
+		ItemPointer iptr;
+		ItemPointerData new_slot;
+		ArtNodeHeader * replaced_node;
 
-		dlist_push_head(&metadata_page_head, &metadata_page_entry->node);
-	
-		metadata_opaque =
-			(ArtMetaDataPageOpaque) PageGetSpecialPointer(metadata_page_entry->page);
+		iptr = _art_find_child_equal(node, artTuple->key[depth]);
 
-		if (pageType == ART_NODE_PAGE)
+		if (ItemPointerIsValid(iptr) && ART_CHILD_IS_INLINE(iptr))
 		{
-			last_page_blk_num = metadata_opaque->last_internal_node_blk_num;
+			_expand_inline_tid(state, node_entry, iptr, artTuple, depth);
+			return NULL;
 		}
-		else
+
+		if (ItemPointerIsValid(iptr))
 		{
-			last_page_blk_num = metadata_opaque->last_leaf_blk_num;
+			ArtNodeEntry * child_node_entry = _get_node_from_iptr(state, iptr);
+			child_node_entry->parent_key = artTuple->key[depth];
+			return _node_insert_recursive(state, child_node_entry->art_node, artTuple, depth + 1);
 		}
 
-		last_page =
-			_art_load_page(state->index, &state->pages,
-						   last_page_blk_num,
-						   BUFFER_LOCK_EXCLUSIVE,
-						   &is_new_page_entry);
+		_new_child_slot(state, artTuple, depth, &new_slot);
 
-		if (is_new_page_entry)
-			dlist_push_tail(&state->pages, last_page);
+		replaced_node = _add_child(node, artTuple->key[depth], &new_slot);
 
-		_art_page_release(metadata_page_entry);
+		if (replaced_node)
+			_page_store_node(state, node_entry, replaced_node);
+		else
+			_page_store_child(state, node_entry, node, artTuple->key[depth],
+							  &new_slot, true);
 	}
 
-	last_page_entry = dlist_container(ArtPageEntry, node, last_page);
+	return NULL;
+}
 
-	page_freespace = PageGetFreeSpace(last_page_entry->page);
+bool
+_node_insert(ArtState * state, ArtTuple * artTuple)
+{
+	ArtNodeEntry * art_node_entry = NULL;
+	ItemPointerData root_itemptr;
 
-	// Keep some freespace for LEAF pages
-	if (pageType == ART_LEAF_PAGE)
-		page_freespace *= page_leaf_insert_treshold; 
+	int depth = 0;
 
-	// Check if tail pages have enough free space
-	if (page_freespace > MAXALIGN(itemsz))
-	{
-		if (metadata_page_entry == NULL && !IS_MEMORY_BUILD(state) && 
-			last_page)
-		{
-			last_page_entry->ref_count++;
-		}
-		return last_page_entry;
-	}
+	ItemPointerSetBlockNumber(&root_itemptr, ART_ROOT_NODE_BLKNO);
+	ItemPointerSetOffsetNumber(&root_itemptr, ART_ROOT_NODE_ITEM);
 
-	// check cached page information for freespace
-	
-	if (IS_MEMORY_BUILD(state))
+	// Jump node of first key byte is reserved and never moves, so descent
+	// can start there without root as parent
+	if (_has_jump_table(state))
 	{
-		new_page_entry = _art_new_page(pageType == ART_NODE_PAGE ? ART_NODE_PAGE : ART_LEAF_PAGE);
-		new_page_entry->blk_num = state->build_state->num_allocated_pages++;
-		_art_add_page_hash(state->build_state->page_lookup_hash,
-						   new_page_entry->blk_num,
-						   new_page_entry);
+		_jump_node_iptr(artTuple->key[0], &root_itemptr);
+		depth = 1;
 	}
-	else
-	{
-		dlist_init(&metadata_page_head);
 
-		metadata_page_entry = _art_get_metadata_page(state->index);
+	// Root node
+	art_node_entry = _get_node_from_iptr(state, &root_itemptr);
 
-		metadata_opaque =
-			(ArtMetaDataPageOpaque) PageGetSpecialPointer(metadata_page_entry->page);
+	_node_insert_recursive(state, art_node_entry->art_node, artTuple, depth);
 
-		dlist_push_head(&metadata_page_head, &metadata_page_entry->node);
+	return true;
+}
 
-		new_page_entry = 
-			_art_get_buffer(state->index,
-							pageType == ART_NODE_PAGE ? ART_NODE_PAGE : ART_LEAF_PAGE);
-	}
+bool
+_has_jump_table(ArtState * state)
+{
+	if (IS_MEMORY_BUILD(state))
+		return (state->build_state->metadata.flags & ART_META_JUMP_TABLE) != 0;
 
-	opaque = (ArtDataPageOpaque) PageGetSpecialPointer(last_page_entry->page);
-	opaque->right_link = new_page_entry->blk_num;
+	return (_art_get_metadata_flags(state->index) & ART_META_JUMP_TABLE) != 0;
+}
 
-	dlist_push_tail(&state->pages, &new_page_entry->node);
+/*
+ * Get item pointer of jump node for first key byte.
+ */
+void
+_jump_node_iptr(uint8 keyByte, ItemPointer iptr)
+{
+	ItemPointerSet(iptr, ART_JUMP_NODE_BLKNO(keyByte), ART_JUMP_NODE_ITEM(keyByte));
+}
 
-	if (IS_MEMORY_BUILD(state))
+/*
+ * Allocate empty root node, with jump table root points to all jump nodes.
+ */
+ArtNodeHeader *
+_alloc_root_node(bool jumpTable)
+{
+	ArtNodeHeader * root = _art_alloc_node(NODE_256, 0);
+
+	root->flags |= ART_NODE_RESERVED;
+
+	if (jumpTable)
 	{
-		if (pageType == ART_NODE_PAGE)
-		{
-			state->build_state->metadata.last_internal_node_blk_num =
-				new_page_entry->blk_num;
-		}
-		else
+		for (int key = 0; key < 256; key++)
 		{
-			state->build_state->metadata.last_leaf_blk_num =
-				new_page_entry->blk_num;
+			ItemPointerData iptr;
+
+			_jump_node_iptr(key, &iptr);
+			_add_child(root, key, &iptr);
 		}
 	}
-	else
+
+	return root;
+}
+
+/*
+ * Add empty jump nodes on dedicated pages following first leaf page.
+ * Jump pages are not part of node tail page chain.
+ */
+void
+_build_jump_nodes(ArtState * state)
+{
+	ArtPageEntry * page_entry = NULL;
+
+	for (int key = 0; key < 256; key++)
 	{
-		if (pageType == ART_NODE_PAGE)
-		{
-			metadata_opaque->last_internal_node_blk_num = new_page_entry->blk_num;
-		}
-		else
+		ArtNodeHeader * jump_node;
+		ArtNodeEntry * jump_node_entry;
+
+		if (ART_JUMP_NODE_ITEM(key) == FirstOffsetNumber)
 		{
-			metadata_opaque->last_leaf_blk_num = new_page_entry->blk_num;
+			page_entry = _get_new_page(state, ART_NODE_PAGE | ART_JUMP_PAGE);
+			Assert(page_entry->blk_num == ART_JUMP_NODE_BLKNO(key));
 		}
 
-		metadata_page_entry->dirty = true;
+		jump_node = _art_alloc_node(NODE_256, 0);
+		jump_node->flags |= ART_NODE_RESERVED;
 
-		// release if we last_data_page
-		if (empty_last_page)
-			_art_page_release(last_page_entry);
+		jump_node_entry = _page_add_node(state, page_entry, jump_node);
+		Assert(ItemPointerGetOffsetNumber(&jump_node_entry->iptr) == ART_JUMP_NODE_ITEM(key));
 
-		_art_page_release(metadata_page_entry);
+		dlist_delete(dlist_head_node(&state->art_nodes));
+		_node_release(jump_node_entry);
 	}
+}
 
-	if (pageType == ART_NODE_PAGE)
-	{
-		state->node_last_page = &new_page_entry->node;
-	}
-	else
+
+void
+_node_release(ArtNodeEntry * node)
+{
+	if (node->memory_node)
+		pfree(node->art_node);
+
+	_art_page_release(dlist_container(ArtPageEntry, node, node->page_entry));
+	
+	pfree(node);
+}
+
+void
+_node_release_list(ArtState * state)
+{
+	dlist_mutable_iter iter;
+	ArtNodeEntry * node_entry;
+
+	dlist_foreach_modify(iter, &state->art_nodes)
 	{
-		state->leaf_last_page =  &new_page_entry->node;
+		node_entry = dlist_container(ArtNodeEntry, node, iter.cur);
+		_node_release(node_entry);
 	}
 
-	return new_page_entry;
+	dlist_init(&state->art_nodes);
 }
 
-ArtNodeEntry *
-_page_add_node(ArtState * state, ArtPageEntry * pageEntry, 
-			   ArtNodeHeader * node)
+/*
+ * Items replaced or removed by cleanup stay on their pages until node
+ * pointing to them is stored, so that tree is consistent whenever changes
+ * are logged. Deferred items past mark belong to subtree of that node.
+ * Item with invalid offset stands for bitmap page of removed leaf.
+ */
+void
+_cleanup_defer_delete(ArtState * state, ItemPointer iptr)
 {
-	ArtNodeEntry * new_node_entry;
-	ItemOffset page_node_offset;
-	ArtDataPageOpaque opaque;
+	if (state->num_cleanup_dead == state->max_cleanup_dead)
+	{
+		state->max_cleanup_dead = Max(state->max_cleanup_dead * 2, 64);
 
-	new_node_entry = (ArtNodeEntry *) palloc0(sizeof(ArtNodeEntry));
-	opaque = (ArtDataPageOpaque) PageGetSpecialPointer(pageEntry->page);
+		if (state->cleanup_dead == NULL)
+			state->cleanup_dead = palloc(sizeof(ItemPointerData) * state->max_cleanup_dead);
+		else
+			state->cleanup_dead = repalloc(state->cleanup_dead,
+										   sizeof(ItemPointerData) * state->max_cleanup_dead);
+	}
 
-	new_node_entry->page_entry = &pageEntry->node;
-	new_node_entry->art_node = node;
-	new_node_entry->memory_node = true;
+	state->cleanup_dead[state->num_cleanup_dead++] = *iptr;
+}
 
-	START_CRIT_SECTION();
-	page_node_offset = 
-		PageAddItem(pageEntry->page, (Item) node, _art_node_size(node), 0, false, false);
-	END_CRIT_SECTION();
+/*
+ * Remove deferred items past mark and log changes. Called after node that
+ * owns mark was stored in place. Deleting items moves page data, nodes of
+ * walk are memory copies. Node is logged first, then items it no longer
+ * points to are removed in as many records as their pages need.
+ */
+void
+_cleanup_flush(ArtState * state, int mark)
+{
+	_art_xlog_flush();
 
-	ItemPointerSetOffsetNumber(&new_node_entry->iptr, page_node_offset);
-	ItemPointerSetBlockNumber(&new_node_entry->iptr, pageEntry->blk_num);
+	for (int i = mark; i < state->num_cleanup_dead; i++)
+	{
+		ItemPointer dead = &state->cleanup_dead[i];
+		ArtPageEntry * page_entry =
+			_get_page(state, ItemPointerGetBlockNumberNoCheck(dead));
 
-	dlist_push_head(&state->art_nodes, &new_node_entry->node);
-	pageEntry->dirty = true;
+		if (ItemPointerGetOffsetNumberNoCheck(dead) == InvalidOffsetNumber)
+			_cleanup_free_bitmap_page(state, page_entry);
+		else
+			_page_delete_item(state, page_entry, ItemPointerGetOffsetNumber(dead));
 
-	// page cache
+		_art_page_release(page_entry);
 
-	opaque->n_total++;
+		_art_xlog_flush_if_full();
+	}
 
-	return new_node_entry;
+	state->num_cleanup_dead = mark;
+
+	_art_xlog_flush();
 }
 
+/*
+ * Store node of cleanup walk. Node that doesn't fit its page, or that
+ * replaces its parent, is moved and caller updates parent slot from
+ * newIptr. Node must not point into page.
+ */
 void
-_page_update_node(ArtNodeEntry * nodeEntry, ArtNodeHeader * node)
+_cleanup_store_node(ArtState * state, ArtNodeEntry * nodeEntry, ArtNodeHeader * node,
+					bool move, ItemPointer newIptr)
 {
-	Offset off = ItemPointerGetOffsetNumber(&nodeEntry->iptr);
-	Size nodeSize = _art_node_size(node);
 	ArtPageEntry * page_entry = dlist_container(ArtPageEntry, node, nodeEntry->page_entry);
+	Offset off = ItemPointerGetOffsetNumber(&nodeEntry->iptr);
+	Size old_size = ItemIdGetLength(PageGetItemId(page_entry->page, off));
+	Size new_size = _art_page_node_size(node, page_entry->blk_num);
+	ArtNodeEntry * new_node_entry;
 
-	START_CRIT_SECTION();
+	if (!move &&
+		(MAXALIGN(new_size) <= MAXALIGN(old_size) ||
+		 PageGetExactFreeSpace(page_entry->page) >= MAXALIGN(new_size) - MAXALIGN(old_size)))
+	{
+		_page_update_node(nodeEntry, node);
+		*newIptr = nodeEntry->iptr;
+		return;
+	}
 
-	PageIndexTupleOverwrite(page_entry->page, off, (Item) node, nodeSize);
-	page_entry->dirty = true;
-	
-	END_CRIT_SECTION();
+	_cleanup_defer_delete(state, &nodeEntry->iptr);
+
+	page_entry = _get_page_with_free_space(state,
+										   node->node_type == NODE_LEAF ?
+										   ART_LEAF_PAGE : ART_NODE_PAGE,
+										   _art_page_node_size(node, InvalidBlockNumber));
+	new_node_entry = _page_add_node(state, page_entry, node);
+	*newIptr = new_node_entry->iptr;
+
+	dlist_delete(&new_node_entry->node);
+	new_node_entry->memory_node = false;
+	_node_release(new_node_entry);
+
+	// Tail page entry may be gone with released node
+	state->node_last_page = NULL;
+	state->leaf_last_page = NULL;
 }
 
-ArtNodeEntry *
-_page_replace_node(ArtState * state,
-				   ArtNodeEntry * oldNodeEntry,
-				   Size oldNodeSize,
-				   ArtNodeHeader * node,
-				   uint8_t key)
+/*
+ * Remove leaf whose fragments have no TIDs left. Returns false if leaf was
+ * removed.
+ */
+bool
+_cleanup_leaf(ArtState * state, ArtNodeEntry * leafEntry)
 {
-	ArtNodeEntry * new_node_entry;
-	ArtPageEntry * new_page_entry;
-	
-	ArtNodeHeader * parent_node;
-	ArtNodeEntry * parent_node_entry = 
-		dlist_container(ArtNodeEntry, node, dlist_next_node(&state->art_nodes, &oldNodeEntry->node));
+	ArtNodeLeaf * leaf = (ArtNodeLeaf *) leafEntry->art_node;
+	ItemPointerData next = leaf->next_leaf_iptr;
 
-	ArtPageEntry * old_page_entry = dlist_container(ArtPageEntry, node, oldNodeEntry->page_entry);
+	if (leaf->flags & ART_LEAF_BITMAP)
+		return _cleanup_bitmap_leaf(state, leafEntry);
 
-	Offset old_off = ItemPointerGetOffsetNumber(&oldNodeEntry->iptr);
-	ArtDataPageOpaque opaque;
+	if (leaf->num_items > 0)
+		return true;
 
-	if (PageGetExactFreeSpace(old_page_entry->page) >= 
-		 MAXALIGN(_art_node_size(node) - oldNodeSize))
+	while (ItemPointerIsValid(&next))
 	{
-		START_CRIT_SECTION();
-		PageIndexTupleOverwrite(old_page_entry->page, old_off, (Item) node, _art_node_size(node));
-		END_CRIT_SECTION();
+		ArtNodeEntry * fragment_entry = _get_node_from_iptr(state, &next);
+		ArtNodeLeaf * fragment = (ArtNodeLeaf *) fragment_entry->art_node;
+		bool empty = fragment->num_items == 0;
 
-		return NULL;
+		next = fragment->next_leaf_iptr;
+		dlist_delete(&fragment_entry->node);
+		_node_release(fragment_entry);
+
+		if (!empty)
+			return true;
 	}
-	else
+
+	next = leaf->next_leaf_iptr;
+	_cleanup_defer_delete(state, &leafEntry->iptr);
+
+	while (ItemPointerIsValid(&next))
 	{
-		START_CRIT_SECTION();
-		PageIndexTupleDeleteNoCompact(old_page_entry->page, old_off);
-		END_CRIT_SECTION();
+		ArtNodeEntry * fragment_entry = _get_node_from_iptr(state, &next);
 
-		old_page_entry->dirty = true;
+		_cleanup_defer_delete(state, &next);
+		next = ((ArtNodeLeaf *) fragment_entry->art_node)->next_leaf_iptr;
+		dlist_delete(&fragment_entry->node);
+		_node_release(fragment_entry);
+	}
 
-		opaque = (ArtDataPageOpaque) PageGetSpecialPointer(old_page_entry->page);
-		opaque->n_deleted++;
-		opaque->deleted_item_size += oldNodeSize;
+	return false;
+}
 
-		new_page_entry = _get_page_with_free_space(state,
-												   ART_NODE_PAGE,
-												   _art_node_size((ArtNodeHeader*) node));
+/*
+ * Remove bitmap leaf whose pages have no containers left, VACUUM keeps
+ * empty pages in chain. Pages are freed with leaf. Returns false if leaf
+ * was removed.
+ */
+bool
+_cleanup_bitmap_leaf(ArtState * state, ArtNodeEntry * leafEntry)
+{
+	ArtLeafBitmap bitmap;
+	BlockNumber blk;
+	int mark = state->num_cleanup_dead;
 
-		new_node_entry = _page_add_node(state, new_page_entry, (ArtNodeHeader*) node);
+	memcpy(&bitmap, ART_LEAF_POSTING((ArtNodeLeaf *) leafEntry->art_node),
+		   sizeof(ArtLeafBitmap));
 
-		parent_node = _get_node(parent_node_entry);
+	for (blk = bitmap.first_blk; BlockNumberIsValid(blk);)
+	{
+		ArtPageEntry * page_entry = _get_page(state, blk);
+		bool empty = PageGetMaxOffsetNumber(page_entry->page) == 0;
+		ItemPointerData page_iptr;
 
-		_replace_child_iptr(parent_node, key, &new_node_entry->iptr);
+		ItemPointerSet(&page_iptr, blk, InvalidOffsetNumber);
+		blk = ((ArtDataPageOpaque) PageGetSpecialPointer(page_entry->page))->right_link;
+		_art_page_release(page_entry);
 
-		_page_update_node(parent_node_entry, parent_node);
+		if (!empty)
+		{
+			state->num_cleanup_dead = mark;
+			return true;
+		}
 
-		return new_node_entry;
+		_cleanup_defer_delete(state, &page_iptr);
 	}
-}
 
+	_cleanup_defer_delete(state, &leafEntry->iptr);
 
-ItemPointer
-_node_insert_recursive(ArtState * state,
-					   ArtNodeHeader * node,
-					   ArtTuple *artTuple,
-					   int depth)
+	return false;
+}
+
+/*
+ * Turn bitmap page of removed leaf into empty leaf page. Scan that read
+ * leaf before it was removed stops at page that is no longer bitmap page,
+ * as leaf had no TIDs left. New bitmap pages are always appended to
+ * index, so page never becomes bitmap page again.
+ */
+void
+_cleanup_free_bitmap_page(ArtState * state, ArtPageEntry * pageEntry)
 {
-	ArtNodeEntry * node_entry = dlist_container(ArtNodeEntry, node, dlist_head_node(&state->art_nodes));
-	ArtNodeEntry * parent_node_entry = NULL;
-	ArtNodeHeader * parent_node = NULL;
+	START_CRIT_SECTION();
+	_art_init_data_page(pageEntry->page, ART_LEAF_PAGE);
+	END_CRIT_SECTION();
+
+	pageEntry->dirty = true;
+
+	_page_cache_record(state, pageEntry);
+}
+
+/*
+ * Drop bucket entries of removed leaves. Returns false if bucket was
+ * removed.
+ */
+bool
+_cleanup_bucket(ArtState * state, ArtNodeEntry * nodeEntry, int depth, ItemPointer newIptr)
+{
+	Size size = _art_bucket_size(nodeEntry->art_node);
+	ArtNodeHeader * bucket = (ArtNodeHeader *) palloc(size);
+	ArtBucketItem * items;
+	int num_live = 0;
+	int mark = state->num_cleanup_dead;
 
-	if (dlist_has_next(&state->art_nodes, &node_entry->node))
+	// Storing children may move page data under bucket item
+	memcpy(bucket, nodeEntry->art_node, size);
+
+	items = (ArtBucketItem *) palloc(sizeof(ArtBucketItem) * bucket->num_children);
+
+	for (int i = 0; i < bucket->num_children; i++)
 	{
-		parent_node_entry = 
-			dlist_container(ArtNodeEntry, node, 
-							dlist_next_node(&state->art_nodes, &node_entry->node));
+		ArtBucketEntry * entry = ART_BUCKET_ENTRY(bucket, i);
+		ItemPointerData slot = entry->child;
 
-		parent_node = parent_node_entry->art_node;
+		// Children done so far are moved copies or deferred, both consistent
+		_art_xlog_flush_if_full();
 
-		/* We can now discard grand parent node (and release page if needed) */
-		if (!IS_MEMORY_BUILD(state) &&
-			dlist_has_next(&state->art_nodes, &parent_node_entry->node))
-		{
-			ArtNodeEntry * grand_parent_node = 
-				dlist_container(ArtNodeEntry,
-								node,
-								dlist_next_node(&state->art_nodes, &parent_node_entry->node));
+		if (!_cleanup_child(state, &slot, depth + bucket->prefix_key_len + entry->key_len))
+			continue;
 
-			dlist_delete(&grand_parent_node->node);
-			_node_release(dlist_container(ArtNodeEntry, node, &grand_parent_node->node));
-		}
+		items[num_live].key = entry->key;
+		items[num_live].key_len = entry->key_len;
+		items[num_live++].child = slot;
 	}
 
-	if (node->node_type == NODE_LEAF)
+	if (num_live == 0)
 	{
-		ArtNodeLeaf * leaf = (ArtNodeLeaf *) node;
-	
-		ArtNodeEntry * leaf_node_entry = node_entry;
-		
-		ArtNodeLeaf * new_leaf = NULL;
-		ArtNodeEntry * new_leaf_node_entry = NULL;
+		_cleanup_defer_delete(state, &nodeEntry->iptr);
+		return false;
+	}
 
-		ArtNode4 * new_node4 = NULL;
-		ArtPageEntry * new_node4_page_entry = NULL;
-		ArtNodeEntry * new_node4_node_entry = NULL;
+	if (num_live < bucket->num_children)
+	{
+		_cleanup_store_node(state, nodeEntry,
+							_art_bucket_build(ART_BUCKET_PREFIX(bucket),
+											  bucket->prefix_key_len,
+											  items, num_live, 0),
+							false, newIptr);
+
+		if (ItemPointerEquals(newIptr, &nodeEntry->iptr))
+			_cleanup_flush(state, mark);
+	}
 
-		int longest_prefix = 0;
+	return true;
+}
 
-		// Check if we are updating an existing value
-		if (!_art_leaf_matches(leaf, artTuple->key, artTuple->key_len))
-		{
-			_update_leaf_item(state, leaf_node_entry, artTuple);
-			return NULL;
-		}
+/*
+ * Merge node that has single child into that child. Child radix node
+ * takes node prefix and key byte in front of its own prefix, child leaf
+ * gets key bytes that were implied by node. Returns false if child can't
+ * be merged, inline TIDs, bitmap leaves and buckets stay under their node.
+ */
+bool
+_cleanup_collapse(ArtState * state, ArtNodeEntry * nodeEntry, uint8 key,
+				  ItemPointer child, int depth, ItemPointer newIptr)
+{
+	ArtNodeHeader * node = nodeEntry->art_node;
+	int path_len = node->prefix_key_len + 1;
+	uint8 * path;
+	ArtNodeEntry * child_entry;
+	ArtNodeHeader * child_node;
+	ArtNodeHeader * new_child = NULL;
+	bool merged = false;
 
-		// Create a new leaf
-		new_leaf_node_entry = _add_leaf(state, NULL, artTuple);
-		new_leaf =  (ArtNodeLeaf *) new_leaf_node_entry->art_node;
-	
-		// Determine longest prefix
-		longest_prefix = _art_longest_common_prefix(leaf, new_leaf, depth);
+	if (ART_CHILD_IS_INLINE(child))
+		return false;
 
-		// New value, we must split the leaf into a node4
-		new_node4 = (ArtNode4 *) _art_alloc_node(NODE_4);
-		new_node4->node.prefix_key_len = longest_prefix;
-		memcpy(new_node4->node.prefix, artTuple->key + depth, 
-			  Min(MAX_PREFIX_KEY_LEN, longest_prefix));
+	path = (uint8 *) palloc(path_len);
+	memcpy(path, ART_NODE_PREFIX(node), node->prefix_key_len);
+	path[path_len - 1] = key;
 
-		_add_child((ArtNodeHeader *) new_node4, leaf->data[depth+longest_prefix],
-				   &leaf_node_entry->iptr);
+	child_entry = _get_node_from_iptr(state, child);
+	child_node = child_entry->art_node;
 
-		_add_child((ArtNodeHeader *) new_node4, new_leaf->data[depth+longest_prefix],
-				   &new_leaf_node_entry->iptr);
+	if (child_node->node_type == NODE_LEAF &&
+		!(((ArtNodeLeaf *) child_node)->flags & ART_LEAF_BITMAP))
+	{
+		ArtNodeLeaf * leaf = (ArtNodeLeaf *) child_node;
+		int missing = leaf->key_offset - depth;
 
-		// Update new node4 parent iptr
-		if (update_parent_iptr)
+		if (missing <= 0)
 		{
-			ItemPointerCopy(&parent_node_entry->iptr, &new_node4->node.parent_iptr);
+			// Leaf already stores key from node depth
+			*newIptr = *child;
+			merged = true;
 		}
+		else if (missing <= path_len)
+		{
+			Size leaf_size = _art_node_size(child_node);
+			ArtNodeLeaf * new_leaf = (ArtNodeLeaf *) palloc(leaf_size + missing);
 
-		new_node4_page_entry = 
-			_get_page_with_free_space(state,
-									  ART_NODE_PAGE,
-									 _art_node_size((ArtNodeHeader*) new_node4));
-
-		new_node4_node_entry = _page_add_node(state, new_node4_page_entry,
-											  (ArtNodeHeader*) new_node4);
+			memcpy(new_leaf, leaf, sizeof(ArtNodeLeaf));
+			memcpy(new_leaf->data, path, missing);
+			memcpy(new_leaf->data + missing, leaf->data, leaf->key_len + leaf->posting_size);
+			new_leaf->key_offset = depth;
+			new_leaf->key_len += missing;
 
-		// Update leaf to parent node
-		if (update_parent_iptr)
-		{
-			ItemPointerCopy(&new_node4_node_entry->iptr, &new_leaf->parent_iptr);
-			_page_update_node(new_leaf_node_entry, (ArtNodeHeader*) new_leaf);
+			new_child = (ArtNodeHeader *) new_leaf;
 		}
+	}
+	else if (child_node->node_type != NODE_BUCKET &&
+			 path_len + child_node->prefix_key_len <= PG_UINT16_MAX)
+	{
+		uint8 * prefix = (uint8 *) palloc(path_len + child_node->prefix_key_len);
 
-		// update to point to node4
-		_replace_child_iptr(parent_node, artTuple->key[depth - 1],
-							&new_node4_node_entry->iptr);
-
-		_page_update_node(parent_node_entry, (ArtNodeHeader*) parent_node);
+		memcpy(prefix, path, path_len);
+		memcpy(prefix + path_len, ART_NODE_PREFIX(child_node), child_node->prefix_key_len);
 
-		return NULL;
+		new_child = _art_node_set_prefix(child_node, prefix,
+										 path_len + child_node->prefix_key_len);
 	}
 
-	if (node->prefix_key_len)
+	if (new_child)
 	{
-		ArtNode4 * new_node4 = NULL;
-		ArtPageEntry * new_node4_page_entry = NULL;
-		ArtNodeEntry * new_node4_node_entry = NULL;
+		// Child changed in place would be logged before parent is replaced
+		_cleanup_store_node(state, child_entry, new_child, true, newIptr);
+		merged = true;
+	}
 
-		ArtNodeLeaf * leaf = NULL;
-		ArtNodeEntry * leaf_node_entry = NULL;
-		
-		ArtNodeLeaf * minimum_leaf = NULL;
+	dlist_delete(&child_entry->node);
+	_node_release(child_entry);
 
-		// Determine if the prefixes differ, since we need to split
+	if (!merged)
+		return false;
 
-		uint8_t prefix_diff = 0;
+	_cleanup_defer_delete(state, &nodeEntry->iptr);
 
-		if(IS_MEMORY_BUILD(state))
-		{
-			prefix_diff = 
-				_art_prefix_mismatch(state->index, node,
-									 state->build_state->page_lookup_hash,
-									 &state->pages,
-								 	 artTuple->key, artTuple->key_len, depth);
-		}
-		else
+	return true;
+}
+
+/*
+ * Clean up children of radix node, then remove node if it has none left,
+ * merge it into its only child, or store it as smallest node type that
+ * fits its children. Reserved nodes keep their type and place.
+ */
+bool
+_cleanup_node(ArtState * state, ArtNodeEntry * nodeEntry, int depth, ItemPointer newIptr)
+{
+	ArtNodeHeader * node = nodeEntry->art_node;
+	bool reserved = (node->flags & ART_NODE_RESERVED) != 0;
+	int child_depth = depth + node->prefix_key_len + 1;
+	uint8 keys[256];
+	ItemPointerData children[256];
+	int num_children = _art_node_children(node, keys, children);
+	int num_live = 0;
+	int mark = state->num_cleanup_dead;
+	bool changed = false;
+	uint8 new_type;
+	ArtNodeHeader * new_node;
+
+	for (int i = 0; i < num_children; i++)
+	{
+		ItemPointerData slot = children[i];
+
+		// Children done so far are moved copies or deferred, both consistent
+		_art_xlog_flush_if_full();
+
+		if (!_cleanup_child(state, &slot, child_depth))
 		{
-			prefix_diff = 
-				_art_prefix_mismatch(state->index, node,
-									 NULL,
-									 NULL,
-								 	 artTuple->key, artTuple->key_len, depth);
+			changed = true;
+			continue;
 		}
 
-		if (prefix_diff >= node->prefix_key_len)
+		changed |= !ItemPointerEquals(&slot, &children[i]);
+		keys[num_live] = keys[i];
+		children[num_live++] = slot;
+	}
+
+	if (!reserved)
+	{
+		if (num_live == 0)
 		{
-			depth += node->prefix_key_len;
-			goto RECURSE_SEARCH;
+			_cleanup_defer_delete(state, &nodeEntry->iptr);
+			return false;
 		}
 
-		// Create a new node
-		new_node4 = (ArtNode4*) _art_alloc_node(NODE_4);
+		if (num_live == 1 &&
+			_cleanup_collapse(state, nodeEntry, keys[0], &children[0], depth, newIptr))
+			return true;
+	}
 
-		new_node4->node.prefix_key_len = prefix_diff;
-		memcpy(new_node4->node.prefix, node->prefix, Min(MAX_PREFIX_KEY_LEN, prefix_diff));
+	new_type = reserved ? node->node_type :
+			   num_live <= 4 ? NODE_4 :
+			   num_live <= 16 ? NODE_16 :
+			   num_live <= 48 ? NODE_48 : NODE_256;
 
-		// Adjust the prefix of the old node
-		if (node->prefix_key_len <= MAX_PREFIX_KEY_LEN)
-		{
-			_add_child((ArtNodeHeader *) new_node4, node->prefix[prefix_diff], &node_entry->iptr);
-			node->prefix_key_len -= (prefix_diff+1);
-			memmove(node->prefix, node->prefix + prefix_diff + 1,
-					Min(MAX_PREFIX_KEY_LEN, node->prefix_key_len));
-			memset(node->prefix + node->prefix_key_len, 0, 
-				   MAX_PREFIX_KEY_LEN - node->prefix_key_len);
-		} 
-		else
-		{
-			node->prefix_key_len -= (prefix_diff+1);
+	if (!changed && new_type == node->node_type)
+		return true;
 
-			if (IS_MEMORY_BUILD(state))
-			{
-				minimum_leaf =
-					_art_minimum_leaf(state->index, node, 
-									  state->build_state->page_lookup_hash,
-									  &state->pages);
-			}
-			else
-			{
-				minimum_leaf = _art_minimum_leaf(state->index, node, NULL, NULL);
-			}
+	new_node = _art_alloc_node(new_type, node->prefix_key_len);
+	new_node->flags = node->flags;
+	memcpy(ART_NODE_PREFIX(new_node), ART_NODE_PREFIX(node), node->prefix_key_len);
 
-			_add_child((ArtNodeHeader *) new_node4, 
-					   minimum_leaf->data[depth+prefix_diff], &node_entry->iptr);
+	// Node type fits all children, so node never grows here
+	for (int i = 0; i < num_live; i++)
+		_add_child(new_node, keys[i], &children[i]);
 
-			memcpy(node->prefix, minimum_leaf->data + depth + prefix_diff + 1,
-					Min(MAX_PREFIX_KEY_LEN, node->prefix_key_len));
-		}
+	_cleanup_store_node(state, nodeEntry, new_node, false, newIptr);
 
-		// Update node for new prefix changes
-		_page_update_node(node_entry, node);
+	if (ItemPointerEquals(newIptr, &nodeEntry->iptr))
+		_cleanup_flush(state, mark);
 
-		// Leaf for new new node4
-		leaf_node_entry = _add_leaf(state, NULL, artTuple);
-		leaf = (ArtNodeLeaf*) leaf_node_entry->art_node;
+	return true;
+}
 
-		_add_child((ArtNodeHeader*) new_node4, artTuple->key[depth+prefix_diff],
-				   &leaf_node_entry->iptr);
+/*
+ * Clean up subtree of node at head of state node list, reached at depth.
+ * Returns false if subtree is empty and was removed, otherwise newIptr
+ * is set to possibly moved subtree root.
+ */
+bool
+_cleanup_subtree(ArtState * state, ArtNodeEntry * nodeEntry, int depth, ItemPointer newIptr)
+{
+	check_stack_depth();
 
-		// Update new node4 parent iptr
-		ItemPointerCopy(&node_entry->iptr, &new_node4->node.parent_iptr);
+	*newIptr = nodeEntry->iptr;
 
-		// persist node4 to index
-		new_node4_page_entry = 
-			_get_page_with_free_space(state,
-									  ART_NODE_PAGE,
-									  _art_node_size((ArtNodeHeader*) new_node4));
+	switch (nodeEntry->art_node->node_type)
+	{
+	case NODE_LEAF:
+		return _cleanup_leaf(state, nodeEntry);
+	case NODE_BUCKET:
+		return _cleanup_bucket(state, nodeEntry, depth, newIptr);
+	default:
+		return _cleanup_node(state, nodeEntry, depth, newIptr);
+	}
+}
 
+/*
+ * Clean up subtree of child slot, slot is updated to moved child. Returns
+ * false if child was removed.
+ */
+bool
+_cleanup_child(ArtState * state, ItemPointer slot, int depth)
+{
+	ArtNodeEntry * child_entry;
+	bool live;
 
-		new_node4_node_entry = _page_add_node(state, new_node4_page_entry, (ArtNodeHeader*) new_node4);
+	if (ART_CHILD_IS_INLINE(slot))
+		return true;
 
-		// Update leaf to new node4
-		if (update_parent_iptr)
-		{
-			ItemPointerCopy(&new_node4_node_entry->iptr, &leaf->parent_iptr);
-			_page_update_node(leaf_node_entry, (ArtNodeHeader*) leaf);
-		}
+	child_entry = _get_node_from_iptr(state, slot);
+	live = _cleanup_subtree(state, child_entry, depth, slot);
 
-		// Update parent to point to new node4
-		_replace_child_iptr(parent_node, artTuple->key[depth-1], &new_node4_node_entry->iptr);
+	dlist_delete(&child_entry->node);
+	_node_release(child_entry);
 
-		_page_update_node(parent_node_entry, parent_node);
+	return live;
+}
 
-		return NULL;
-	}
+/*
+ * Remove empty leaves and nodes left by VACUUM, shrink nodes to their
+ * children count and collapse single child paths. Caller keeps inserts
+ * out of index.
+ */
+void
+_art_cleanup_tree(Relation index)
+{
+	ArtState state;
+	ArtNodeEntry * root_entry;
+	ItemPointerData root_iptr;
+	MemoryContext old_ctx;
 
-RECURSE_SEARCH:;
+	memset(&state, 0, sizeof(ArtState));
+	state.index = index;
+	state.build_ctx = AllocSetContextCreate(CurrentMemoryContext,
+											"ART cleanup temporary context",
+											ALLOCSET_DEFAULT_SIZES);
 
-	{
-		ItemPointer iptr;
-		ArtNodeEntry * leaf_node_entry;
-		ArtNodeHeader * replaced_node;
+	old_ctx = MemoryContextSwitchTo(state.build_ctx);
 
-		iptr = _art_find_child_equal(node, artTuple->key[depth]);
+	_init_state(&state);
 
-		if (ItemPointerIsValid(iptr))
-		{
-			ArtNodeEntry * child_node_entry = _get_node_from_iptr(state, iptr);
-			return _node_insert_recursive(state, child_node_entry->art_node, artTuple, depth + 1);
-		}
+	// Root is reserved, so it is never removed or moved
+	ItemPointerSet(&root_iptr, ART_ROOT_NODE_BLKNO, ART_ROOT_NODE_ITEM);
 
-		leaf_node_entry = _add_leaf(state, &node_entry->iptr, artTuple);
+	_art_xlog_begin(index);
 
-		replaced_node = _add_child(node, artTuple->key[depth], &leaf_node_entry->iptr);
+	PG_TRY();
+	{
+		root_entry = _get_node_from_iptr(&state, &root_iptr);
+		_cleanup_subtree(&state, root_entry, 0, &root_iptr);
 
-		if (replaced_node)
-		{
-			ArtNodeEntry * new_item_node_entry = NULL;
-			new_item_node_entry =
-				_page_replace_node(state, node_entry,
-								   _art_node_size(node),
-								   replaced_node, artTuple->key[depth - node->prefix_key_len -1]);
-		
-			if (new_item_node_entry && update_parent_iptr)
-			{
-				_update_child_list_parent_iptr(state, new_item_node_entry);
-			}
+		// Root is stored in place, so nothing is left deferred
+		Assert(state.num_cleanup_dead == 0);
 
-		}
-		else
-		{
-			_page_update_node(node_entry, node);
-		}
+		_node_release_list(&state);
+
+		_art_xlog_finish();
+	}
+	PG_CATCH();
+	{
+		_art_xlog_abort();
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
 
-	return NULL;
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextDelete(state.build_ctx);
 }
 
-bool
-_node_insert(ArtState * state, ArtTuple * artTuple)
+/*
+ * Insert tuples merged from pending list, each in its own WAL batch like
+ * artinsert. Caller holds share lock on metadata page lock tag.
+ */
+void
+_art_insert_tuples(Relation index, ArtTuple * tuples, int ntuples)
 {
-	ArtNodeEntry * art_node_entry = NULL;
-	ItemPointerData root_itemptr;
+	ArtState state;
+	MemoryContext old_ctx;
 
-	ItemPointerSetBlockNumber(&root_itemptr, ART_ROOT_NODE_BLKNO);
-	ItemPointerSetOffsetNumber(&root_itemptr, ART_ROOT_NODE_ITEM);
+	memset(&state, 0, sizeof(ArtState));
+	state.index = index;
+	state.build_ctx = AllocSetContextCreate(CurrentMemoryContext,
+											"ART merge temporary context",
+											ALLOCSET_DEFAULT_SIZES);
 
-	// Root node
-	art_node_entry = _get_node_from_iptr(state, &root_itemptr);
+	for (int i = 0; i < ntuples; i++)
+	{
+		CHECK_FOR_INTERRUPTS();
 
-	_node_insert_recursive(state, art_node_entry->art_node, artTuple, 0);
+		old_ctx = MemoryContextSwitchTo(state.build_ctx);
 
-	return true;
-}
+		_init_state(&state);
 
+		_art_xlog_begin(index);
 
-void
-_node_release(ArtNodeEntry * node)
-{
-	if (node->memory_node)
-		pfree(node->art_node);
+		PG_TRY();
+		{
+			_node_insert(&state, &tuples[i]);
 
-	_art_page_release(dlist_container(ArtPageEntry, node, node->page_entry));
-	
-	pfree(node);
-}
+			_node_release_list(&state);
 
-void
-_node_release_list(ArtState * state)
-{
-	dlist_mutable_iter iter;
-	ArtNodeEntry * node_entry;
+			_art_xlog_finish();
+		}
+		PG_CATCH();
+		{
+			_art_xlog_abort();
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
 
-	dlist_foreach_modify(iter, &state->art_nodes)
-	{
-		node_entry = dlist_container(ArtNodeEntry, node, iter.cur);
-		_node_release(node_entry);
+		MemoryContextSwitchTo(old_ctx);
+		MemoryContextReset(state.build_ctx);
 	}
 
-	dlist_init(&state->art_nodes);
+	MemoryContextDelete(state.build_ctx);
+}
+
+/*
+ * Reject key whose node or leaf item would not fit on page.
+ */
+void
+_check_key_len(Relation index, ArtTuple * artTuple)
+{
+	if (artTuple->key_len > ART_MAX_KEY_LEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("index row size %d exceeds ART maximum %d for index \"%s\"",
+						artTuple->key_len, (int) ART_MAX_KEY_LEN,
+						RelationGetRelationName(index)),
+				 errdetail("Index row references tuple (%u,%u).",
+						   ItemPointerGetBlockNumber(&artTuple->iptr),
+						   ItemPointerGetOffsetNumber(&artTuple->iptr))));
 }
 
 static void
@@ -1202,14 +3014,7 @@ _art_build_callback(Relation index, ItemPointer tid, Datum * values,
 		return;
 	}
 
-	if (art_tuple->key_len >= ART_PAGE_SIZE)
-	{
-		elog(WARNING, "Row (%d, %d) column value exceeds size (%d)", 
-			 ItemPointerGetBlockNumber(&art_tuple->iptr), ItemPointerGetOffsetNumber(&art_tuple->iptr),
-			 art_tuple->key_len);
-		pfree(art_tuple);
-		return;
-	}
+	_check_key_len(index, art_tuple);
 
 	_node_insert(state, art_tuple);
 
@@ -1238,6 +3043,8 @@ _art_build_callback(Relation index, ItemPointer tid, Datum * values,
 			   state->build_state->metadata.page_cache, 
 			   sizeof(ArtPageCache) * ART_CACHED_PAGES);
 
+		art_metadata.flags = state->build_state->metadata.flags;
+
 		// Reset now complete build memory context
 		MemoryContextReset(state->build_ctx);
 
@@ -1258,6 +3065,8 @@ _art_build_callback(Relation index, ItemPointer tid, Datum * values,
 			   art_metadata.page_cache, 
 			   sizeof(ArtPageCache) * ART_CACHED_PAGES);
 
+		state->build_state->metadata.flags = art_metadata.flags;
+
 		state->build_state->n_tuples = n_tuples;
 		state->build_state->num_allocated_pages = number_allocated_pages;
 
@@ -1309,6 +3118,8 @@ artbuild(Relation heap, Relation index, IndexInfo *indexInfo)
 	old_ctx = MemoryContextSwitchTo(state.build_ctx);
 
 	state.index = index;
+	state.heap_rel = NULL;
+	state.index_unchanged = false;
 	_init_state(&state);
 
 	state.build_state = (ArtBuildState *) palloc0(sizeof(ArtBuildState));
@@ -1334,7 +3145,10 @@ artbuild(Relation heap, Relation index, IndexInfo *indexInfo)
 	state.node_last_page = dlist_tail_node(&state.pages);
 	state.build_state->num_allocated_pages++;
 
-	root_art_node = _art_alloc_node(NODE_256);
+	if (_art_jump_table(index))
+		state.build_state->metadata.flags |= ART_META_JUMP_TABLE;
+
+	root_art_node = _alloc_root_node(_has_jump_table(&state));
 	root_node_entry = _page_add_node(&state, node_page_entry, root_art_node);
 	dlist_delete(dlist_head_node(&state.art_nodes));
 	_node_release(root_node_entry);
@@ -1348,6 +3162,9 @@ artbuild(Relation heap, Relation index, IndexInfo *indexInfo)
 	state.build_state->num_allocated_pages++;
 	state.leaf_last_page = dlist_tail_node(&state.pages);
 
+	if (_has_jump_table(&state))
+		_build_jump_nodes(&state);
+
 	MemoryContextSwitchTo(old_ctx);
 
 	reltuples = table_index_build_scan(heap, index, indexInfo, false, true,
@@ -1394,7 +3211,10 @@ void
 artbuildempty(Relation index)
 {
 	Buffer metadata_buffer, root_buffer, leaf_buffer;
+	ArtNodeHeader * root_art_node;
 	ArtNodeHeader * init_art_node;
+	Size init_art_node_size;
+	bool has_jump_table = _art_jump_table(index);
 
 	metadata_buffer = ReadBufferExtended(index, INIT_FORKNUM, P_NEW, RBM_NORMAL, NULL);
 	LockBuffer(metadata_buffer, BUFFER_LOCK_EXCLUSIVE);
@@ -1406,16 +3226,22 @@ artbuildempty(Relation index)
 	LockBuffer(leaf_buffer, BUFFER_LOCK_EXCLUSIVE);
 
 	// Root Node
-	init_art_node = _art_alloc_node(NODE_256);
+	root_art_node = _alloc_root_node(has_jump_table);
+	init_art_node_size = _art_page_node_size(root_art_node, ART_ROOT_NODE_BLKNO);
+	init_art_node = _art_page_node_encode(root_art_node, ART_ROOT_NODE_BLKNO);
+	pfree(root_art_node);
 
 	START_CRIT_SECTION();
 
 	_art_init_metadata_page(BufferGetPage(metadata_buffer));
+	if (has_jump_table)
+		((ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(metadata_buffer)))->flags |=
+			ART_META_JUMP_TABLE;
 	_art_init_data_page(BufferGetPage(root_buffer), ART_NODE_PAGE);
 	_art_init_data_page(BufferGetPage(leaf_buffer), ART_LEAF_PAGE);
 
 	PageAddItem(BufferGetPage(root_buffer),
-				(Item) init_art_node, _art_node_size(init_art_node),
+				(Item) init_art_node, init_art_node_size,
 				0, false, false);
 
 	MarkBufferDirty(metadata_buffer);
@@ -1432,6 +3258,43 @@ artbuildempty(Relation index)
 	UnlockReleaseBuffer(leaf_buffer);
 
 	pfree(init_art_node);
+
+	if (!has_jump_table)
+		return;
+
+	// Jump pages follow first leaf page, see _build_jump_nodes
+	root_art_node = _art_alloc_node(NODE_256, 0);
+	root_art_node->flags |= ART_NODE_RESERVED;
+	init_art_node_size = _art_page_node_size(root_art_node, InvalidBlockNumber);
+	init_art_node = _art_page_node_encode(root_art_node, InvalidBlockNumber);
+	pfree(root_art_node);
+
+	for (int page = 0; page < ART_JUMP_NUM_PAGES; page++)
+	{
+		Buffer jump_buffer = ReadBufferExtended(index, INIT_FORKNUM, P_NEW, RBM_NORMAL, NULL);
+
+		LockBuffer(jump_buffer, BUFFER_LOCK_EXCLUSIVE);
+		Assert(BufferGetBlockNumber(jump_buffer) == ART_JUMP_FIRST_BLKNO + page);
+
+		START_CRIT_SECTION();
+
+		_art_init_data_page(BufferGetPage(jump_buffer), ART_NODE_PAGE | ART_JUMP_PAGE);
+
+		for (int i = 0; i < ART_JUMP_NODES_PER_PAGE &&
+			 page * ART_JUMP_NODES_PER_PAGE + i < 256; i++)
+			PageAddItem(BufferGetPage(jump_buffer),
+						(Item) init_art_node, init_art_node_size,
+						0, false, false);
+
+		MarkBufferDirty(jump_buffer);
+		log_newpage_buffer(jump_buffer, false);
+
+		END_CRIT_SECTION();
+
+		UnlockReleaseBuffer(jump_buffer);
+	}
+
+	pfree(init_art_node);
 }
 
 bool
@@ -1444,9 +3307,15 @@ artinsert(Relation index, Datum *values, bool *isnull,
 	ArtState  * state = (ArtState *) indexInfo->ii_AmCache;
 	ArtTuple * art_tuple;
 	MemoryContext old_ctx;
+	bool use_pending;
+	bool merge_pending = false;
+	int combine_queue = -1;
 
 	if (state == NULL)
 	{
+		// Index built with other format is not written to
+		_art_get_metadata_flags(index);
+
 		old_ctx = MemoryContextSwitchTo(indexInfo->ii_Context);
 		state = (ArtState *) palloc0(sizeof(ArtState));
 
@@ -1466,6 +3335,9 @@ artinsert(Relation index, Datum *values, bool *isnull,
 
 	_init_state(state);
 
+	state->heap_rel = heapRel;
+	state->index_unchanged = indexUnchanged;
+
 	art_tuple = _art_form_key(index, ht_ctid, values, isnull);
 
 	if (art_tuple->key_len == 0)
@@ -1473,18 +3345,59 @@ artinsert(Relation index, Datum *values, bool *isnull,
 		return false;
 	}
 
-	if (art_tuple->key_len >= ART_PAGE_SIZE)
+	_check_key_len(index, art_tuple);
+
+	use_pending = _art_fast_update(index) &&
+		ART_PENDING_ITEM_SIZE(art_tuple->key_len) <= ART_PENDING_ITEM_MAX_SIZE;
+
+	// Bulk delete sweeps pages in block order, don't move items behind it
+	LockPage(index, ART_METADATA_NODE_BLKNO, ShareLock);
+
+	// Insert into busy index region is handed to its combiner
+	if (!use_pending && _art_combine_publish(index, art_tuple, &combine_queue))
 	{
-		elog(WARNING, "Row (%d, %d) column value exceeds size (%d)", 
-			 ItemPointerGetBlockNumber(&art_tuple->iptr), ItemPointerGetOffsetNumber(&art_tuple->iptr),
-			 art_tuple->key_len);
+		UnlockPage(index, ART_METADATA_NODE_BLKNO, ShareLock);
+
 		pfree(art_tuple);
-		return false;
+		MemoryContextSwitchTo(old_ctx);
+		MemoryContextReset(state->build_ctx);
+
+		return true;
 	}
 
-	_node_insert(state, art_tuple);
+	_art_xlog_begin(index);
 
-	_node_release_list(state);
+	PG_TRY();
+	{
+		if (use_pending)
+			merge_pending = _art_pending_insert(index, art_tuple);
+		else
+		{
+			_node_insert(state, art_tuple);
+
+			_node_release_list(state);
+		}
+
+		_art_xlog_finish();
+	}
+	PG_CATCH();
+	{
+		_art_xlog_abort();
+
+		if (combine_queue >= 0)
+			_art_combine_abort(combine_queue);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (combine_queue >= 0)
+		_art_combine_apply(index, combine_queue);
+
+	if (merge_pending)
+		_art_pending_merge(index, false);
+
+	UnlockPage(index, ART_METADATA_NODE_BLKNO, ShareLock);
 
 	pfree(art_tuple);
 
@@ -9,7 +9,6 @@
 #include "postgres.h"
 
 #include "access/amapi.h"
-#include "access/generic_xlog.h"
 #include "access/reloptions.h"
 #include "catalog/index.h"
 #include "commands/vacuum.h"
@@ -20,6 +19,7 @@
 #include "storage/lmgr.h"
 #include "utils/memutils.h"
 #include "utils/hsearch.h"
+#include "utils/snapmgr.h"
 
 #include "art.h"
 
@@ -37,7 +37,10 @@ _art_init_data_page(Page page, uint8 flags)
 	opaque->deleted_item_size = 0;
 	opaque->n_deleted = 0;
 	opaque->n_total = 0;
+	opaque->remove_cycle = 0;
+	opaque->vacuum_cycle = 0;
 	opaque->right_link = InvalidBlockNumber;
+	opaque->dead_xid = InvalidFullTransactionId;
 }
 
 void
@@ -49,9 +52,19 @@ _art_init_metadata_page(Page page)
 
 	opaque = (ArtMetaDataPageOpaque) PageGetSpecialPointer(page);
 
+	opaque->magic = ART_META_MAGIC;
+	opaque->version = ART_FORMAT_VERSION;
 	opaque->last_internal_node_blk_num = ART_ROOT_NODE_BLKNO;
 	opaque->last_leaf_blk_num = ART_LEAF_NODE_BLKNO;
 	memset(opaque->page_cache, 0, sizeof(ArtPageCache) * ART_CACHED_PAGES);
+	opaque->flags = 0;
+	opaque->pending_head = InvalidBlockNumber;
+	opaque->pending_tail = InvalidBlockNumber;
+	opaque->pending_free = InvalidBlockNumber;
+	opaque->pending_pages = 0;
+	opaque->vacuum_cycle = 0;
+	opaque->last_vacuum_cycle = 0;
+	opaque->num_vacuum_blks = 0;
 }
 
 ArtPageEntry *
@@ -60,14 +73,26 @@ _art_get_metadata_page(Relation index)
 	ArtPageEntry * metadata_page_entry = palloc0(sizeof(ArtPageEntry));
 
 	metadata_page_entry->blk_num = ART_METADATA_NODE_BLKNO;
-	metadata_page_entry->buffer = ReadBuffer(index, ART_METADATA_NODE_BLKNO);
-	LockBuffer(metadata_page_entry->buffer, BUFFER_LOCK_EXCLUSIVE);
+
+	if (_art_xlog_in_progress())
+		metadata_page_entry->buffer =
+			_art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+	else
+	{
+		metadata_page_entry->buffer = ReadBuffer(index, ART_METADATA_NODE_BLKNO);
+		LockBuffer(metadata_page_entry->buffer, BUFFER_LOCK_EXCLUSIVE);
+	}
+
 	metadata_page_entry->page = BufferGetPage(metadata_page_entry->buffer);
 	metadata_page_entry->ref_count = 1;
 
 	return metadata_page_entry;
 }
 
+/*
+ * Copy tree layout part of metadata to metadata page. Pending list fields
+ * are maintained on page only, see art_pending.c.
+ */
 void
 _art_update_metadata_page(Page page, ArtMetaDataPageOpaque metadata)
 {
@@ -77,6 +102,154 @@ _art_update_metadata_page(Page page, ArtMetaDataPageOpaque metadata)
 	opaque->last_internal_node_blk_num = metadata->last_internal_node_blk_num;
 	opaque->last_leaf_blk_num = metadata->last_leaf_blk_num;
 	memcpy(opaque->page_cache, metadata->page_cache, sizeof(ArtPageCache) * ART_CACHED_PAGES);
+	opaque->flags = metadata->flags;
+}
+
+/*
+ * Get layout flags of index. They are only set at build, so they are read
+ * once and kept in relcache entry. Format of index is checked then, so
+ * inserts, scans and VACUUM call this first.
+ */
+uint16
+_art_get_metadata_flags(Relation index)
+{
+	if (index->rd_amcache == NULL)
+	{
+		Buffer buffer;
+		ArtMetaDataPageOpaque metadata;
+		uint32 magic;
+		uint32 version;
+		uint16 metadata_flags;
+		uint16 * flags;
+
+		// Batch may hold metadata page locked already
+		if (_art_xlog_in_progress())
+			buffer = _art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+		else
+		{
+			buffer = ReadBuffer(index, ART_METADATA_NODE_BLKNO);
+			LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		}
+
+		metadata = (ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer));
+		magic = metadata->magic;
+		version = metadata->version;
+		metadata_flags = metadata->flags;
+
+		if (!_art_xlog_release_buffer(buffer))
+			UnlockReleaseBuffer(buffer);
+
+		if (magic != ART_META_MAGIC || version != ART_FORMAT_VERSION)
+			ereport(ERROR,
+					(errcode(ERRCODE_INDEX_CORRUPTED),
+					 errmsg("ART index \"%s\" has unsupported format version %u",
+							RelationGetRelationName(index),
+							magic == ART_META_MAGIC ? version : 1),
+					 errdetail("Current format version is %d.", ART_FORMAT_VERSION),
+					 errhint("REINDEX the index.")));
+
+		flags = MemoryContextAlloc(index->rd_indexcxt, sizeof(uint16));
+		*flags = metadata_flags;
+		index->rd_amcache = flags;
+	}
+
+	return *(uint16 *) index->rd_amcache;
+}
+
+/*
+ * Free items marked dead once every scan that could still hold their item
+ * pointers is finished. Page is exclusively locked in WAL batch, standby
+ * cancels queries that may hold them before replaying batch. Returns true
+ * if space was freed.
+ */
+bool
+_art_page_prune(Relation index, Page page)
+{
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+
+	if (opaque->n_deleted == 0 ||
+		!GlobalVisCheckRemovableFullXid(NULL, opaque->dead_xid) ||
+		!_art_xlog_can_remove_tids(index))
+		return false;
+
+	START_CRIT_SECTION();
+
+	// Going backwards, trailing line pointers are returned to free space
+	for (OffsetNumber off = maxoff; off >= FirstOffsetNumber; off--)
+	{
+		if (ItemIdIsDead(PageGetItemId(page, off)))
+			PageIndexTupleDeleteNoCompact(page, off);
+	}
+
+	PageSetHasFreeLinePointers(page);
+	opaque->n_deleted = 0;
+	opaque->deleted_item_size = 0;
+
+	END_CRIT_SECTION();
+
+	_art_xlog_set_latest_removed_xid(XidFromFullTransactionId(opaque->dead_xid));
+
+	return true;
+}
+
+/*
+ * Remember page with freed space in page cache, replacing cached page
+ * of same type with least free space. Returns true if cache changed.
+ */
+bool
+_art_page_cache_put(ArtMetaDataPageOpaque metadata, BlockNumber blkNum, Page page)
+{
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+	int free_space = PageGetFreeSpace(page);
+	ArtPageCache * victim = NULL;
+	int victim_free_space = 0;
+	int first;
+
+	if (!(opaque->page_flags & (ART_NODE_PAGE | ART_LEAF_PAGE)))
+		return false;
+
+	first = ART_PAGE_CACHE_FIRST(opaque->page_flags & ART_NODE_PAGE);
+
+	for (int i = first; i < first + ART_CACHED_PAGES / 2; i++)
+	{
+		ArtPageCache * cache = &metadata->page_cache[i];
+		int cache_free_space;
+
+		if (cache->blk_num == blkNum)
+		{
+			victim = cache;
+			victim_free_space = -1;
+			break;
+		}
+
+		cache_free_space =
+			cache->blk_num == ART_METADATA_NODE_BLKNO ? -1 : cache->free_space;
+
+		if (victim == NULL || cache_free_space < victim_free_space)
+		{
+			victim = cache;
+			victim_free_space = cache_free_space;
+		}
+	}
+
+	if (victim_free_space >= free_space)
+		return false;
+
+	victim->blk_num = blkNum;
+	victim->free_space = free_space;
+
+	return true;
+}
+
+/*
+ * Jump table consumes first two key bytes, it is only used for fixed
+ * length keys that always have them.
+ */
+bool
+_art_jump_table_supported(Relation index)
+{
+	return TupleDescAttr(index->rd_att, 0)->attlen >= 2;
 }
 
 
@@ -92,10 +265,15 @@ _art_page_release(ArtPageEntry * pageEntry)
 
 	if (pageEntry->ref_count == 1)
 	{
-		if (pageEntry->dirty)
-			MarkBufferDirty(pageEntry->buffer);
-	
-		UnlockReleaseBuffer(pageEntry->buffer);
+		// Batch keeps page locked until its changes are logged
+		if (!_art_xlog_release_buffer(pageEntry->buffer))
+		{
+			if (pageEntry->dirty)
+				MarkBufferDirty(pageEntry->buffer);
+
+			UnlockReleaseBuffer(pageEntry->buffer);
+		}
+
 		dlist_delete(&pageEntry->node);
 		pfree(pageEntry);
 	}
@@ -149,6 +327,9 @@ _art_get_buffer(Relation index, uint8 flags)
 
 	_art_init_data_page(page_entry->page, flags);
 
+	if (_art_xlog_in_progress())
+		_art_xlog_register_buffer(page_entry->buffer, true);
+
 	return page_entry;
 }
 
@@ -175,9 +356,14 @@ _art_load_page(Relation index, dlist_head * pageListHead,
 	page_entry = (ArtPageEntry *) palloc0(sizeof(ArtPageEntry));
 	
 	page_entry->blk_num = blockNum;
-	page_entry->buffer = ReadBuffer(index, blockNum);
 
-	LockBuffer(page_entry->buffer, bufferLockMode);
+	if (bufferLockMode == BUFFER_LOCK_EXCLUSIVE && _art_xlog_in_progress())
+		page_entry->buffer = _art_xlog_read_buffer(index, blockNum, false);
+	else
+	{
+		page_entry->buffer = ReadBuffer(index, blockNum);
+		LockBuffer(page_entry->buffer, bufferLockMode);
+	}
 
 	page_entry->page = BufferGetPage(page_entry->buffer);
 	page_entry->ref_count++;
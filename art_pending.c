@@ -0,0 +1,440 @@
+/*-------------------------------------------------------------------------
+ *
+ * art_pending.c
+ *		ART pending list of fast inserts.
+ *
+ * With fast_update inserts append key and TID to pending list instead of
+ * descending tree. Pending list is chain of pages from pending_head to
+ * pending_tail of metadata page, entries are appended to tail page. Once
+ * list has pending_list_limit of pages, or on VACUUM, its entries are
+ * sorted by key and inserted into tree, and list pages are moved to free
+ * chain of metadata page to be reused by list later.
+ *
+ * Scans read pending list before tree. Merge inserts entries into tree
+ * before they are removed from list, so scan finds entry in either one,
+ * TIDs found in both are returned once. Merge closes tail page it reads
+ * up to, inserts during merge append to new page after it. Scans walk
+ * list locking next page before releasing current one, and pages are
+ * freed in list order, so scan never follows link of page freed ahead of
+ * it.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lmgr.h"
+#include "utils/memutils.h"
+
+#include "art.h"
+
+/* Page lock tag serializing merges, tag of root page is not used otherwise */
+#define ART_PENDING_LOCK_BLKNO ART_ROOT_NODE_BLKNO
+
+/* Freed pages logged at once by merge, last batch is logged with metadata */
+#define ART_PENDING_FREE_BATCH 16
+
+static Buffer _art_pending_new_page(Relation index, ArtMetaDataPageOpaque metadata);
+static void _art_pending_release(Buffer buffer);
+static BlockNumber _art_pending_close(Relation index);
+static ArtTuple * _art_pending_collect(Relation index, BlockNumber tailBlk,
+									   int * ntuples);
+static int _art_pending_tuple_cmp(const void * a, const void * b);
+static void _art_pending_free(Relation index, BlockNumber tailBlk);
+
+
+/*
+ * Append tuple to pending list in WAL batch of caller. Returns true if
+ * list reached its size limit and should be merged.
+ */
+bool
+_art_pending_insert(Relation index, ArtTuple * artTuple)
+{
+	Buffer metadata_buffer = _art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+	ArtMetaDataPageOpaque metadata =
+		(ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(metadata_buffer));
+	Size item_size = ART_PENDING_ITEM_SIZE(artTuple->key_len);
+	ArtPendingItem * item;
+	Buffer buffer = InvalidBuffer;
+	Page page;
+	bool full;
+
+	item = (ArtPendingItem *) palloc0(item_size);
+	item->iptr = artTuple->iptr;
+	item->key_len = artTuple->key_len;
+	memcpy(item->key, artTuple->key, artTuple->key_len);
+
+	if (BlockNumberIsValid(metadata->pending_tail))
+	{
+		buffer = _art_xlog_read_buffer(index, metadata->pending_tail, false);
+		page = BufferGetPage(buffer);
+
+		// Tail is full or is being merged, list continues on new page
+		if ((((ArtDataPageOpaque) PageGetSpecialPointer(page))->page_flags & ART_PENDING_CLOSED) ||
+			PageGetFreeSpace(page) < MAXALIGN(item_size))
+		{
+			Buffer new_buffer = _art_pending_new_page(index, metadata);
+
+			START_CRIT_SECTION();
+			((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link =
+				BufferGetBlockNumber(new_buffer);
+			metadata->pending_tail = BufferGetBlockNumber(new_buffer);
+			metadata->pending_pages++;
+			END_CRIT_SECTION();
+
+			_art_pending_release(buffer);
+			buffer = new_buffer;
+		}
+	}
+	else
+	{
+		buffer = _art_pending_new_page(index, metadata);
+
+		START_CRIT_SECTION();
+		metadata->pending_head = BufferGetBlockNumber(buffer);
+		metadata->pending_tail = BufferGetBlockNumber(buffer);
+		metadata->pending_pages = 1;
+		END_CRIT_SECTION();
+	}
+
+	page = BufferGetPage(buffer);
+
+	START_CRIT_SECTION();
+
+	if (PageAddItem(page, (Item) item, item_size, InvalidOffsetNumber,
+					false, false) == InvalidOffsetNumber)
+		elog(ERROR, "failed to add item to ART pending list page");
+
+	((ArtDataPageOpaque) PageGetSpecialPointer(page))->n_total++;
+
+	END_CRIT_SECTION();
+
+	full = metadata->pending_pages >=
+		Max((Size) _art_pending_list_limit(index) * 1024 / BLCKSZ, 1);
+
+	_art_pending_release(buffer);
+
+	// List links and metadata are logged in one record
+	_art_xlog_flush();
+	_art_pending_release(metadata_buffer);
+
+	pfree(item);
+
+	return full;
+}
+
+/*
+ * Get empty page for pending list, page freed by previous merge if there
+ * is one.
+ */
+Buffer
+_art_pending_new_page(Relation index, ArtMetaDataPageOpaque metadata)
+{
+	Buffer buffer;
+
+	if (BlockNumberIsValid(metadata->pending_free))
+	{
+		buffer = _art_xlog_read_buffer(index, metadata->pending_free, false);
+
+		START_CRIT_SECTION();
+		metadata->pending_free =
+			((ArtDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer)))->right_link;
+		_art_init_data_page(BufferGetPage(buffer), ART_PENDING_PAGE);
+		END_CRIT_SECTION();
+	}
+	else
+	{
+		ArtPageEntry * page_entry = _art_get_buffer(index, ART_PENDING_PAGE);
+
+		buffer = page_entry->buffer;
+		pfree(page_entry);
+	}
+
+	return buffer;
+}
+
+/*
+ * Release changed page of WAL batch.
+ */
+void
+_art_pending_release(Buffer buffer)
+{
+	if (!_art_xlog_release_buffer(buffer))
+	{
+		MarkBufferDirty(buffer);
+		UnlockReleaseBuffer(buffer);
+	}
+}
+
+/*
+ * Merge pending list into tree. Merge running in another backend is waited
+ * for only if wait is set, otherwise merge is skipped.
+ */
+void
+_art_pending_merge(Relation index, bool wait)
+{
+	MemoryContext merge_ctx;
+	MemoryContext old_ctx;
+	BlockNumber tail_blk;
+
+	// Bulk delete sweeps pages in block order, don't move items behind it.
+	// Taken before merge lock, so that merge in VACUUM never waits.
+	LockPage(index, ART_METADATA_NODE_BLKNO, ShareLock);
+
+	if (wait)
+		LockPage(index, ART_PENDING_LOCK_BLKNO, ExclusiveLock);
+	else if (!ConditionalLockPage(index, ART_PENDING_LOCK_BLKNO, ExclusiveLock))
+	{
+		UnlockPage(index, ART_METADATA_NODE_BLKNO, ShareLock);
+		return;
+	}
+
+	merge_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  "ART pending merge context",
+									  ALLOCSET_DEFAULT_SIZES);
+	old_ctx = MemoryContextSwitchTo(merge_ctx);
+
+	tail_blk = _art_pending_close(index);
+
+	if (BlockNumberIsValid(tail_blk))
+	{
+		ArtTuple * tuples;
+		int ntuples;
+
+		tuples = _art_pending_collect(index, tail_blk, &ntuples);
+
+		// Inserts in key order descend along previous insert path
+		pg_qsort(tuples, ntuples, sizeof(ArtTuple), _art_pending_tuple_cmp);
+
+		_art_insert_tuples(index, tuples, ntuples);
+
+		_art_pending_free(index, tail_blk);
+	}
+
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextDelete(merge_ctx);
+
+	UnlockPage(index, ART_PENDING_LOCK_BLKNO, ExclusiveLock);
+	UnlockPage(index, ART_METADATA_NODE_BLKNO, ShareLock);
+}
+
+/*
+ * Close tail page of pending list for appends. Returns its block number,
+ * invalid block if list is empty.
+ */
+BlockNumber
+_art_pending_close(Relation index)
+{
+	BlockNumber tail_blk = InvalidBlockNumber;
+
+	_art_xlog_begin(index);
+
+	PG_TRY();
+	{
+		Buffer metadata_buffer =
+			_art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+		ArtMetaDataPageOpaque metadata =
+			(ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(metadata_buffer));
+
+		if (BlockNumberIsValid(metadata->pending_head))
+		{
+			Buffer buffer;
+
+			tail_blk = metadata->pending_tail;
+			buffer = _art_xlog_read_buffer(index, tail_blk, false);
+
+			START_CRIT_SECTION();
+			((ArtDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer)))->page_flags |=
+				ART_PENDING_CLOSED;
+			END_CRIT_SECTION();
+
+			_art_pending_release(buffer);
+		}
+
+		// Metadata is unchanged, batch releases it as is
+		_art_xlog_release_buffer(metadata_buffer);
+
+		_art_xlog_finish();
+	}
+	PG_CATCH();
+	{
+		_art_xlog_abort();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return tail_blk;
+}
+
+/*
+ * Read entries of pending list pages up to closed tail page. Pages are not
+ * changed until they are freed by this merge, except by VACUUM sweep that
+ * removes dead entries. Dead entries read before that are inserted into
+ * tree pages listed for the sweep to revisit, see art_vacuum.c.
+ */
+ArtTuple *
+_art_pending_collect(Relation index, BlockNumber tailBlk, int * ntuples)
+{
+	Buffer buffer = ReadBuffer(index, ART_METADATA_NODE_BLKNO);
+	BlockNumber blk;
+	ArtTuple * tuples;
+	int max_tuples = 1024;
+
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	blk = ((ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer)))->pending_head;
+	UnlockReleaseBuffer(buffer);
+
+	tuples = (ArtTuple *) palloc(sizeof(ArtTuple) * max_tuples);
+	*ntuples = 0;
+
+	for (;;)
+	{
+		Page page;
+		OffsetNumber maxoff;
+		BlockNumber next_blk;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buffer = ReadBuffer(index, blk);
+		LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buffer);
+		maxoff = PageGetMaxOffsetNumber(page);
+
+		for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+		{
+			ArtPendingItem * item =
+				(ArtPendingItem *) PageGetItem(page, PageGetItemId(page, off));
+			ArtTuple * tuple;
+
+			if (*ntuples == max_tuples)
+			{
+				max_tuples *= 2;
+				tuples = (ArtTuple *) repalloc_huge(tuples, sizeof(ArtTuple) * max_tuples);
+			}
+
+			tuple = &tuples[(*ntuples)++];
+			tuple->iptr = item->iptr;
+			tuple->key_len = item->key_len;
+			tuple->key = palloc(item->key_len);
+			memcpy(tuple->key, item->key, item->key_len);
+		}
+
+		next_blk = ((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link;
+		UnlockReleaseBuffer(buffer);
+
+		if (blk == tailBlk)
+			break;
+
+		blk = next_blk;
+	}
+
+	return tuples;
+}
+
+int
+_art_pending_tuple_cmp(const void * a, const void * b)
+{
+	const ArtTuple * ta = (const ArtTuple *) a;
+	const ArtTuple * tb = (const ArtTuple *) b;
+	int cmp = memcmp(ta->key, tb->key, Min(ta->key_len, tb->key_len));
+
+	if (cmp != 0)
+		return cmp;
+
+	if (ta->key_len != tb->key_len)
+		return ta->key_len < tb->key_len ? -1 : 1;
+
+	return ItemPointerCompare((ItemPointer) &ta->iptr, (ItemPointer) &tb->iptr);
+}
+
+/*
+ * Move merged pages from head of pending list up to closed tail page to
+ * free chain. Freed pages keep list order link until tail is freed, so
+ * list stays readable after crash in between. Pages are locked in list
+ * order after metadata page, like scans do.
+ */
+void
+_art_pending_free(Relation index, BlockNumber tailBlk)
+{
+	_art_xlog_begin(index);
+
+	PG_TRY();
+	{
+		Buffer metadata_buffer =
+			_art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+		ArtMetaDataPageOpaque metadata =
+			(ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(metadata_buffer));
+		BlockNumber blk = metadata->pending_head;
+		BlockNumber next_blk;
+		uint32 num_freed = 0;
+
+		for (;;)
+		{
+			Buffer buffer = _art_xlog_read_buffer(index, blk, false);
+			Page page = BufferGetPage(buffer);
+
+			next_blk = ((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link;
+
+			START_CRIT_SECTION();
+			_art_init_data_page(page, ART_PENDING_PAGE);
+			((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link =
+				blk == tailBlk ? metadata->pending_free : next_blk;
+			END_CRIT_SECTION();
+
+			_art_pending_release(buffer);
+			num_freed++;
+
+			if (blk == tailBlk)
+				break;
+
+			if (num_freed % ART_PENDING_FREE_BATCH == 0)
+				_art_xlog_flush();
+
+			blk = next_blk;
+		}
+
+		START_CRIT_SECTION();
+
+		metadata->pending_free = metadata->pending_head;
+		metadata->pending_head = next_blk;
+		metadata->pending_pages -= num_freed;
+
+		if (!BlockNumberIsValid(next_blk))
+		{
+			metadata->pending_tail = InvalidBlockNumber;
+			metadata->pending_pages = 0;
+		}
+
+		END_CRIT_SECTION();
+
+		// Pages since last flush are logged with metadata, so that free
+		// chain never joins list
+		_art_xlog_flush();
+		_art_pending_release(metadata_buffer);
+
+		_art_xlog_finish();
+	}
+	PG_CATCH();
+	{
+		_art_xlog_abort();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * Compare pending entry key with key, keys are compared bytewise like
+ * in tree.
+ */
+int32
+_art_pending_compare(const ArtPendingItem * item, const uint8 * key, uint32 keyLen)
+{
+	int cmp = memcmp(item->key, key, Min(item->key_len, keyLen));
+
+	if (cmp != 0)
+		return cmp;
+
+	return (int32) item->key_len - (int32) keyLen;
+}
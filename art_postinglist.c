@@ -0,0 +1,186 @@
+/*-------------------------------------------------------------------------
+ *
+ * art_postinglist.c
+ *		Routines for dealing with compressed posting lists of ART leaves.
+ *
+ * Heap TIDs of a leaf are kept sorted and stored as a varbyte encoded
+ * list of deltas, same idea as GIN posting lists.  Each TID is converted
+ * to a 64-bit integer (block number in the high bits, offset in the low
+ * ART_POSTING_OFFSET_BITS bits) and the difference to the previous TID is
+ * written 7 bits per byte, high bit set if more bytes follow.  The first
+ * TID is encoded as a delta from zero.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "art.h"
+
+/*
+ * Heap offsets never exceed MaxHeapTuplesPerPage, 11 bits are enough for
+ * any supported block size.
+ */
+#define ART_POSTING_OFFSET_BITS 11
+
+static inline uint64
+_itemptr_to_uint64(const ItemPointer iptr)
+{
+	uint64 val;
+
+	val = ItemPointerGetBlockNumberNoCheck(iptr);
+	val <<= ART_POSTING_OFFSET_BITS;
+	val |= ItemPointerGetOffsetNumberNoCheck(iptr);
+
+	return val;
+}
+
+static inline void
+_uint64_to_itemptr(uint64 val, ItemPointer iptr)
+{
+	ItemPointerSetOffsetNumber(iptr, val & ((1 << ART_POSTING_OFFSET_BITS) - 1));
+	val >>= ART_POSTING_OFFSET_BITS;
+	ItemPointerSetBlockNumber(iptr, val);
+}
+
+static inline int
+_encode_varbyte(uint64 val, uint8 *ptr)
+{
+	uint8 *p = ptr;
+
+	while (val > 0x7F)
+	{
+		*(p++) = 0x80 | (val & 0x7F);
+		val >>= 7;
+	}
+	*(p++) = (uint8) val;
+
+	return p - ptr;
+}
+
+static inline uint64
+_decode_varbyte(const uint8 **ptr)
+{
+	const uint8 *p = *ptr;
+	uint64 val = 0;
+	int shift = 0;
+
+	for (;;)
+	{
+		uint64 c = *(p++);
+
+		val |= (c & 0x7F) << shift;
+		if (!(c & 0x80))
+			break;
+		shift += 7;
+	}
+
+	*ptr = p;
+	return val;
+}
+
+
+/*
+ * Encode sorted array of TIDs into dest. dest must have room for
+ * ART_POSTING_MAX_SIZE(nitems) bytes. Returns number of bytes written.
+ */
+int
+_art_posting_encode(const ItemPointerData *items, int nitems, uint8 *dest)
+{
+	uint64 prev = 0;
+	uint8 *p = dest;
+
+	for (int i = 0; i < nitems; i++)
+	{
+		uint64 val = _itemptr_to_uint64((ItemPointer) &items[i]);
+
+		Assert(i == 0 || val > prev);
+
+		p += _encode_varbyte(val - prev, p);
+		prev = val;
+	}
+
+	return p - dest;
+}
+
+/*
+ * Decode posting list of nbytes into dest array. Returns number of
+ * decoded TIDs.
+ */
+int
+_art_posting_decode(const uint8 *src, int nbytes, ItemPointerData *dest)
+{
+	const uint8 *p = src;
+	const uint8 *end = src + nbytes;
+	uint64 val = 0;
+	int nitems = 0;
+
+	while (p < end)
+	{
+		val += _decode_varbyte(&p);
+		_uint64_to_itemptr(val, &dest[nitems++]);
+	}
+
+	return nitems;
+}
+
+/*
+ * Return last (largest) TID of encoded posting list.
+ */
+void
+_art_posting_last(const uint8 *src, int nbytes, ItemPointer last)
+{
+	const uint8 *p = src;
+	const uint8 *end = src + nbytes;
+	uint64 val = 0;
+
+	while (p < end)
+		val += _decode_varbyte(&p);
+
+	_uint64_to_itemptr(val, last);
+}
+
+/*
+ * Append item to the end of encoded posting list. Item must be greater
+ * than last TID in list. Returns number of bytes appended at dest.
+ */
+int
+_art_posting_append(uint8 *dest, const ItemPointer last, const ItemPointer item)
+{
+	uint64 prev = last ? _itemptr_to_uint64(last) : 0;
+	uint64 val = _itemptr_to_uint64(item);
+
+	Assert(val > prev);
+
+	return _encode_varbyte(val - prev, dest);
+}
+
+/*
+ * Merge single item into sorted array of nitems TIDs. Array must have
+ * room for one more element. Returns new number of items, item is not
+ * added if already present in list.
+ */
+int
+_art_posting_merge_item(ItemPointerData *items, int nitems, const ItemPointer item)
+{
+	int low = 0;
+	int high = nitems;
+
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		int32 cmp = ItemPointerCompare(&items[mid], item);
+
+		if (cmp == 0)
+			return nitems;
+		else if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	memmove(&items[low + 1], &items[low], sizeof(ItemPointerData) * (nitems - low));
+	ItemPointerCopy(item, &items[low]);
+
+	return nitems + 1;
+}
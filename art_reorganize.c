@@ -0,0 +1,581 @@
+/*-------------------------------------------------------------------------
+ *
+ * art_reorganize.c
+ *		Rewrite of ART index into depth-first page order.
+ *
+ * Inserts place nodes and leaves wherever free space is found, and nodes
+ * that outgrow their page item are relocated, so over time the tree gets
+ * scattered across the file. art_reorganize() walks the tree depth-first
+ * and builds fresh, densely packed page images in memory: nodes of a
+ * subtree end up on the same or adjacent node pages, and leaves follow
+ * in key order on leaf pages.
+ *
+ * New image is built while holding ExclusiveLock, which blocks writers
+ * but lets readers run. It is written to new relfilenode, which replaces
+ * old one when transaction commits, like REINDEX does. Only the swap takes
+ * AccessExclusiveLock. It is not waited for in lock queue: a reader that
+ * then tries to write to the index would wait for ExclusiveLock held here
+ * while we wait for it. Lock is retried instead, and reorganize gives up
+ * after lock_timeout, or ART_REORG_SWAP_TIMEOUT if that is not set.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/xact.h"
+#include "access/xloginsert.h"
+#include "commands/tablecmds.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/latch.h"
+#include "storage/lmgr.h"
+#include "storage/proc.h"
+#include "storage/smgr.h"
+#include "utils/acl.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+
+#include "art.h"
+
+/* Time to retry swap lock when lock_timeout is not set, in milliseconds */
+#define ART_REORG_SWAP_TIMEOUT 60000
+
+/* Delay between swap lock attempts, in milliseconds */
+#define ART_REORG_SWAP_RETRY_DELAY 10
+
+/*
+ * State of index image being built. Block numbers of new image match
+ * indexes in pages[].
+ */
+typedef struct ArtReorgState
+{
+	Relation index;
+	Page * pages;					/* new index image */
+	BlockNumber num_pages;			/* number of pages in image */
+	BlockNumber max_pages;			/* allocated length of pages[] */
+	BlockNumber limit_pages;		/* memory limit for image in pages */
+	BlockNumber node_blk;			/* node page being filled */
+	BlockNumber leaf_blk;			/* leaf page being filled */
+	Size node_reserve;				/* free space kept on node pages */
+	Size leaf_reserve;				/* free space kept on leaf pages */
+} ArtReorgState;
+
+static BlockNumber _reorg_new_page(ArtReorgState * rs, uint8 flags);
+static void _reorg_add_item(ArtReorgState * rs, BlockNumber blk, Item item,
+							Size size, ItemPointer newIptr);
+static void * _reorg_read_item(ArtReorgState * rs, ItemPointer iptr, Size * size);
+static void _reorg_lock_swap(Relation index);
+static void _reorg_copy_children(ArtReorgState * rs, ArtNodeHeader * node);
+static void _reorg_copy_node(ArtReorgState * rs, ItemPointer iptr, ItemPointer newIptr);
+static void _reorg_copy_reserved(ArtReorgState * rs, ItemPointer iptr, bool copyChildren);
+static void _reorg_copy_leaf(ArtReorgState * rs, ArtNodeLeaf * leaf, Size size,
+							 ItemPointer newIptr);
+static void _reorg_copy_bitmap(ArtReorgState * rs, ArtNodeLeaf * leaf);
+static void _reorg_write_pages(ArtReorgState * rs);
+
+
+/*
+ * Append new data page to image. Node and leaf pages are chained to
+ * previous page of same type as regular inserts do.
+ */
+BlockNumber
+_reorg_new_page(ArtReorgState * rs, uint8 flags)
+{
+	BlockNumber blk = rs->num_pages;
+
+	if (rs->num_pages >= rs->limit_pages)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("index \"%s\" is too large to reorganize",
+						RelationGetRelationName(rs->index)),
+				 errhint("Increase art.build_max_memory or use REINDEX.")));
+
+	if (rs->num_pages >= rs->max_pages)
+	{
+		rs->max_pages *= 2;
+		rs->pages = (Page *) repalloc(rs->pages, sizeof(Page) * rs->max_pages);
+	}
+
+	rs->pages[blk] = (Page) palloc(BLCKSZ);
+	_art_init_data_page(rs->pages[blk], flags);
+	rs->num_pages++;
+
+	if (flags == ART_NODE_PAGE || flags == ART_LEAF_PAGE)
+	{
+		BlockNumber * tail = (flags == ART_NODE_PAGE) ? &rs->node_blk : &rs->leaf_blk;
+
+		if (BlockNumberIsValid(*tail))
+			((ArtDataPageOpaque) PageGetSpecialPointer(rs->pages[*tail]))->right_link = blk;
+
+		*tail = blk;
+	}
+
+	return blk;
+}
+
+void
+_reorg_add_item(ArtReorgState * rs, BlockNumber blk, Item item, Size size,
+				ItemPointer newIptr)
+{
+	Page page = rs->pages[blk];
+	OffsetNumber off;
+
+	off = PageAddItem(page, item, size, InvalidOffsetNumber, false, false);
+
+	if (off == InvalidOffsetNumber)
+		elog(ERROR, "failed to add item to reorganized ART index \"%s\"",
+			 RelationGetRelationName(rs->index));
+
+	((ArtDataPageOpaque) PageGetSpecialPointer(page))->n_total++;
+
+	ItemPointerSet(newIptr, blk, off);
+}
+
+/*
+ * Copy item of old index.
+ */
+void *
+_reorg_read_item(ArtReorgState * rs, ItemPointer iptr, Size * size)
+{
+	Buffer buffer = ReadBuffer(rs->index, ItemPointerGetBlockNumber(iptr));
+	Page page;
+	ItemId item_id;
+	void * item;
+
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+	item_id = PageGetItemId(page, ItemPointerGetOffsetNumber(iptr));
+
+	*size = ItemIdGetLength(item_id);
+	item = palloc(*size);
+	memcpy(item, PageGetItem(page, item_id), *size);
+
+	UnlockReleaseBuffer(buffer);
+
+	return item;
+}
+
+/*
+ * Copy children of in memory node in key order and point its slots to
+ * new locations. Inline TIDs are kept as they are.
+ */
+void
+_reorg_copy_children(ArtReorgState * rs, ArtNodeHeader * node)
+{
+	const uint64 * present = NULL;
+	const uint8 * keys = NULL;
+
+	if (node->node_type == NODE_48)
+		present = ((ArtNode48 *) node)->present;
+	else if (node->node_type == NODE_256)
+		present = ((ArtNode256 *) node)->present;
+	else
+		keys = node->node_type == NODE_4 ? ((ArtNode4 *) node)->keys :
+			   ((ArtNode16 *) node)->keys;
+
+	// NODE_4 and NODE_16 keys are sorted, others are enumerated by bitmap
+	for (int i = present ? _art_key_bitmap_next(present, 0) : 0;
+		 present ? i >= 0 : i < node->num_children;
+		 i = present ? _art_key_bitmap_next(present, i + 1) : i + 1)
+	{
+		uint8 key = present ? i : keys[i];
+		ItemPointer child = _art_find_child_equal(node, key);
+
+		if (child == NULL || !ItemPointerIsValid(child) || ART_CHILD_IS_INLINE(child))
+			continue;
+
+		_reorg_copy_node(rs, child, child);
+	}
+}
+
+/*
+ * Copy subtree at iptr, node is placed after its children so that
+ * children on same page are referenced by page offset.
+ */
+void
+_reorg_copy_node(ArtReorgState * rs, ItemPointer iptr, ItemPointer newIptr)
+{
+	ArtNodeHeader * page_node;
+	ArtNodeHeader * node;
+	ArtNodeHeader * encoded;
+	Size size;
+
+	check_stack_depth();
+	CHECK_FOR_INTERRUPTS();
+
+	page_node = (ArtNodeHeader *) _reorg_read_item(rs, iptr, &size);
+
+	if (page_node->node_type == NODE_LEAF)
+	{
+		_reorg_copy_leaf(rs, (ArtNodeLeaf *) page_node, size, newIptr);
+		return;
+	}
+
+	node = _art_page_node_decode(page_node, ItemPointerGetBlockNumber(iptr));
+	pfree(page_node);
+
+	if (node->node_type == NODE_BUCKET)
+	{
+		for (int i = 0; i < node->num_children; i++)
+		{
+			ItemPointer child = &ART_BUCKET_ENTRY(node, i)->child;
+
+			if (!ART_CHILD_IS_INLINE(child))
+				_reorg_copy_node(rs, child, child);
+		}
+	}
+	else
+		_reorg_copy_children(rs, node);
+
+	size = _art_page_node_size(node, rs->node_blk);
+
+	if (PageGetFreeSpace(rs->pages[rs->node_blk]) < MAXALIGN(size) + rs->node_reserve)
+	{
+		_reorg_new_page(rs, ART_NODE_PAGE);
+		size = _art_page_node_size(node, rs->node_blk);
+	}
+
+	encoded = _art_page_node_encode(node, rs->node_blk);
+	_reorg_add_item(rs, rs->node_blk, (Item) encoded, size, newIptr);
+
+	if (encoded != node)
+		pfree(encoded);
+	pfree(node);
+}
+
+/*
+ * Copy reserved node to same position in new image. Its size doesn't
+ * depend on placement of children, so it is added first to keep its
+ * position and overwritten once children are copied.
+ */
+void
+_reorg_copy_reserved(ArtReorgState * rs, ItemPointer iptr, bool copyChildren)
+{
+	BlockNumber blk = ItemPointerGetBlockNumber(iptr);
+	ItemPointerData new_iptr;
+	ArtNodeHeader * page_node;
+	ArtNodeHeader * node;
+	ArtNodeHeader * encoded;
+	Size size;
+
+	page_node = (ArtNodeHeader *) _reorg_read_item(rs, iptr, &size);
+	node = _art_page_node_decode(page_node, blk);
+	pfree(page_node);
+
+	Assert(node->flags & ART_NODE_RESERVED);
+
+	size = _art_page_node_size(node, blk);
+	encoded = _art_page_node_encode(node, blk);
+	_reorg_add_item(rs, blk, (Item) encoded, size, &new_iptr);
+	pfree(encoded);
+
+	if (!ItemPointerEquals(&new_iptr, iptr))
+		elog(ERROR, "reserved node moved in reorganized ART index \"%s\"",
+			 RelationGetRelationName(rs->index));
+
+	if (copyChildren)
+		_reorg_copy_children(rs, node);
+
+	encoded = _art_page_node_encode(node, blk);
+	if (!PageIndexTupleOverwrite(rs->pages[blk], ItemPointerGetOffsetNumber(iptr),
+								 (Item) encoded, size))
+		elog(ERROR, "failed to overwrite reserved node of reorganized ART index \"%s\"",
+			 RelationGetRelationName(rs->index));
+
+	pfree(encoded);
+	pfree(node);
+}
+
+/*
+ * Copy leaf with all its fragments. Fragments are written from the last
+ * one, so next pointer of each fragment is known when it is written.
+ */
+void
+_reorg_copy_leaf(ArtReorgState * rs, ArtNodeLeaf * leaf, Size size,
+				 ItemPointer newIptr)
+{
+	ArtNodeLeaf ** fragments;
+	Size * sizes;
+	int num_fragments = 0;
+	int max_fragments = 8;
+	ItemPointerData next_iptr;
+	ItemPointerData last_iptr;
+
+	if (leaf->flags & ART_LEAF_BITMAP)
+	{
+		_reorg_copy_bitmap(rs, leaf);
+
+		if (PageGetFreeSpace(rs->pages[rs->leaf_blk]) < MAXALIGN(size) + rs->leaf_reserve)
+			_reorg_new_page(rs, ART_LEAF_PAGE);
+
+		_reorg_add_item(rs, rs->leaf_blk, (Item) leaf, size, newIptr);
+		pfree(leaf);
+		return;
+	}
+
+	fragments = (ArtNodeLeaf **) palloc(sizeof(ArtNodeLeaf *) * max_fragments);
+	sizes = (Size *) palloc(sizeof(Size) * max_fragments);
+
+	fragments[num_fragments] = leaf;
+	sizes[num_fragments++] = size;
+
+	while (ItemPointerIsValid(&leaf->next_leaf_iptr))
+	{
+		if (num_fragments >= max_fragments)
+		{
+			max_fragments *= 2;
+			fragments = (ArtNodeLeaf **) repalloc(fragments,
+												  sizeof(ArtNodeLeaf *) * max_fragments);
+			sizes = (Size *) repalloc(sizes, sizeof(Size) * max_fragments);
+		}
+
+		leaf = (ArtNodeLeaf *) _reorg_read_item(rs, &leaf->next_leaf_iptr, &size);
+		fragments[num_fragments] = leaf;
+		sizes[num_fragments++] = size;
+	}
+
+	ItemPointerSetInvalid(&next_iptr);
+	ItemPointerSetInvalid(&last_iptr);
+
+	for (int i = num_fragments - 1; i >= 0; i--)
+	{
+		ArtNodeLeaf * fragment = fragments[i];
+
+		ItemPointerCopy(&next_iptr, &fragment->next_leaf_iptr);
+
+		if (i == 0 && num_fragments > 1)
+			ItemPointerCopy(&last_iptr, &fragment->last_leaf_iptr);
+		else
+			ItemPointerSetInvalid(&fragment->last_leaf_iptr);
+
+		if (PageGetFreeSpace(rs->pages[rs->leaf_blk]) < MAXALIGN(sizes[i]) + rs->leaf_reserve)
+			_reorg_new_page(rs, ART_LEAF_PAGE);
+
+		_reorg_add_item(rs, rs->leaf_blk, (Item) fragment, sizes[i], &next_iptr);
+
+		if (i == num_fragments - 1)
+			ItemPointerCopy(&next_iptr, &last_iptr);
+
+		pfree(fragment);
+	}
+
+	ItemPointerCopy(&next_iptr, newIptr);
+
+	pfree(fragments);
+	pfree(sizes);
+}
+
+/*
+ * Copy bitmap page chain of bitmap leaf as is, and point leaf to copy.
+ */
+void
+_reorg_copy_bitmap(ArtReorgState * rs, ArtNodeLeaf * leaf)
+{
+	ArtLeafBitmap bitmap;
+	BlockNumber blk;
+	BlockNumber prev_blk = InvalidBlockNumber;
+
+	memcpy(&bitmap, ART_LEAF_POSTING(leaf), sizeof(ArtLeafBitmap));
+
+	blk = bitmap.first_blk;
+
+	while (BlockNumberIsValid(blk))
+	{
+		Buffer buffer = ReadBuffer(rs->index, blk);
+		BlockNumber new_blk = _reorg_new_page(rs, ART_BITMAP_PAGE);
+		Page page = rs->pages[new_blk];
+
+		LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		memcpy(page, BufferGetPage(buffer), BLCKSZ);
+		UnlockReleaseBuffer(buffer);
+
+		blk = ((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link;
+		((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link = InvalidBlockNumber;
+
+		if (BlockNumberIsValid(prev_blk))
+			((ArtDataPageOpaque) PageGetSpecialPointer(rs->pages[prev_blk]))->right_link = new_blk;
+		else
+			bitmap.first_blk = new_blk;
+
+		prev_blk = new_blk;
+	}
+
+	bitmap.last_blk = prev_blk;
+	memcpy(ART_LEAF_POSTING(leaf), &bitmap, sizeof(ArtLeafBitmap));
+}
+
+/*
+ * Write new image to new relfilenode of index. Old one is dropped at
+ * commit, so scans and crash recovery see either whole old or whole new
+ * index. Pages are written bypassing shared buffers and WAL logged as new
+ * pages, like nbtree build does.
+ */
+void
+_reorg_write_pages(ArtReorgState * rs)
+{
+	Relation index = rs->index;
+	bool use_wal;
+
+	RelationSetNewRelfilenode(index, index->rd_rel->relpersistence);
+	CommandCounterIncrement();
+
+	use_wal = RelationNeedsWAL(index);
+
+	for (BlockNumber blk = 0; blk < rs->num_pages; blk++)
+	{
+		Page page = rs->pages[blk];
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (use_wal)
+			log_newpage(&index->rd_node, MAIN_FORKNUM, blk, page, true);
+
+		PageSetChecksumInplace(page, blk);
+		smgrextend(RelationGetSmgr(index), MAIN_FORKNUM, blk, (char *) page, true);
+	}
+
+	if (use_wal)
+		smgrimmedsync(RelationGetSmgr(index), MAIN_FORKNUM);
+
+	// New relfilenode has no init fork yet, see index_build()
+	if (index->rd_rel->relpersistence == RELPERSISTENCE_UNLOGGED)
+	{
+		smgrcreate(RelationGetSmgr(index), INIT_FORKNUM, false);
+		artbuildempty(index);
+	}
+}
+
+
+/*
+ * Upgrade to AccessExclusiveLock without queueing behind readers, which
+ * may wait for ExclusiveLock we hold.
+ */
+void
+_reorg_lock_swap(Relation index)
+{
+	int timeout = LockTimeout > 0 ? LockTimeout : ART_REORG_SWAP_TIMEOUT;
+	int waited = 0;
+
+	while (!ConditionalLockRelation(index, AccessExclusiveLock))
+	{
+		if (waited >= timeout)
+			ereport(ERROR,
+					(errcode(ERRCODE_LOCK_NOT_AVAILABLE),
+					 errmsg("could not lock ART index \"%s\" to swap in reorganized pages",
+							RelationGetRelationName(index)),
+					 errdetail("Transactions using the index did not finish within %d ms.",
+							   timeout),
+					 errhint("Retry when the index is less busy, or use REINDEX.")));
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 ART_REORG_SWAP_RETRY_DELAY, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		waited += ART_REORG_SWAP_RETRY_DELAY;
+	}
+}
+
+PG_FUNCTION_INFO_V1(art_reorganize);
+Datum
+art_reorganize(PG_FUNCTION_ARGS)
+{
+	Oid index_oid = PG_GETARG_OID(0);
+	ArtReorgState rs;
+	ArtMetaDataPageOpaqueData metadata;
+	ItemPointerData root_iptr;
+	MemoryContext reorg_ctx;
+	MemoryContext old_ctx;
+	int fillfactor;
+
+	/* Writers are blocked, readers keep going until pages are swapped */
+	rs.index = index_open(index_oid, ExclusiveLock);
+
+	if (rs.index->rd_indam->ambuild != artbuild)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not an ART index",
+						RelationGetRelationName(rs.index))));
+
+	if (!pg_class_ownercheck(index_oid, GetUserId()))
+		aclcheck_error(ACLCHECK_NOT_OWNER, OBJECT_INDEX,
+					   RelationGetRelationName(rs.index));
+
+	if (RELATION_IS_OTHER_TEMP(rs.index))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot reorganize temporary indexes of other sessions")));
+
+	// Open cursors of this session would read dropped relfilenode
+	CheckTableNotInUse(rs.index, "art_reorganize");
+
+	// New layout is built from tree only
+	_art_pending_merge(rs.index, true);
+
+	reorg_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  "ART reorganize context",
+									  ALLOCSET_DEFAULT_SIZES);
+	old_ctx = MemoryContextSwitchTo(reorg_ctx);
+
+	rs.max_pages = 64;
+	rs.pages = (Page *) palloc(sizeof(Page) * rs.max_pages);
+	rs.num_pages = 0;
+	rs.limit_pages = Max((BlockNumber) ((Size) build_max_memory * 1024 * 1024 / BLCKSZ),
+						 ART_LEAF_NODE_BLKNO + 1);
+	rs.node_blk = InvalidBlockNumber;
+	rs.leaf_blk = InvalidBlockNumber;
+	rs.node_reserve = _art_node_page_reserve(rs.index);
+	fillfactor = _art_fillfactor(rs.index, ART_LEAF_PAGE);
+	rs.leaf_reserve = fillfactor != ART_OPTION_UNSET ? ART_FILLFACTOR_RESERVE(fillfactor) : 0;
+
+	/* Fixed pages: metadata, root node page and first leaf page */
+	rs.pages[ART_METADATA_NODE_BLKNO] = (Page) palloc(BLCKSZ);
+	_art_init_metadata_page(rs.pages[ART_METADATA_NODE_BLKNO]);
+	rs.num_pages++;
+
+	_reorg_new_page(&rs, ART_NODE_PAGE);
+	_reorg_new_page(&rs, ART_LEAF_PAGE);
+
+	metadata.flags = _art_get_metadata_flags(rs.index);
+
+	/* Jump pages keep their fixed position after first leaf page */
+	if (metadata.flags & ART_META_JUMP_TABLE)
+	{
+		for (int page = 0; page < ART_JUMP_NUM_PAGES; page++)
+			_reorg_new_page(&rs, ART_NODE_PAGE | ART_JUMP_PAGE);
+	}
+
+	/* Root and jump nodes can't move, their children are rewritten */
+	ItemPointerSet(&root_iptr, ART_ROOT_NODE_BLKNO, ART_ROOT_NODE_ITEM);
+	_reorg_copy_reserved(&rs, &root_iptr, !(metadata.flags & ART_META_JUMP_TABLE));
+
+	if (metadata.flags & ART_META_JUMP_TABLE)
+	{
+		for (int key = 0; key < 256; key++)
+		{
+			ItemPointerData jump_iptr;
+
+			ItemPointerSet(&jump_iptr, ART_JUMP_NODE_BLKNO(key), ART_JUMP_NODE_ITEM(key));
+			_reorg_copy_reserved(&rs, &jump_iptr, true);
+		}
+	}
+
+	metadata.last_internal_node_blk_num = rs.node_blk;
+	metadata.last_leaf_blk_num = rs.leaf_blk;
+	memset(metadata.page_cache, 0, sizeof(ArtPageCache) * ART_CACHED_PAGES);
+	_art_update_metadata_page(rs.pages[ART_METADATA_NODE_BLKNO], &metadata);
+
+	/* Swap in new image, scans of old one must be finished */
+	_reorg_lock_swap(rs.index);
+	_reorg_write_pages(&rs);
+
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextDelete(reorg_ctx);
+
+	index_close(rs.index, NoLock);
+
+	PG_RETURN_VOID();
+}
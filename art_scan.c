@@ -9,6 +9,7 @@
 #include "postgres.h"
 
 #include "access/relscan.h"
+#include "access/tableam.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "storage/bufmgr.h"
@@ -29,16 +30,50 @@ typedef struct ArtScanOpaqueData
 	dlist_head leaf_entry_head;
 	dlist_node * leaf_page_entry;
 	ArtPageEntry * leaf_page;
-	OffsetNumber leaf_num_items;
-	OffsetNumber leaf_current_item;
+	int leaf_num_items;
+	int leaf_current_item;
 	ItemPointerData * leaf_iptr;
+	ItemPointerData * inline_iptr;	/* matching TIDs stored inline in nodes */
+	int inline_num_items;
+	int inline_max_items;
+	BlockNumber bitmap_blk;			/* next page of current bitmap leaf */
+	ItemPointerData kill_iptr;		/* current leaf fragment */
+	uint16 kill_cycle;				/* remove cycle of its page when read */
+	int * killed_items;				/* TID array positions reported dead */
+	int num_killed;
+	Relation heap_rel;				/* heap of scan, set when TIDs are killed */
+	ItemPointerData * pending_iptr;	/* sorted matching TIDs of pending list */
+	int num_pending;
+	bool pending_returned;			/* pending TIDs returned, tree TIDs follow */
 	bool fetching;
+	/* point lookup specialized for key width, NULL for generic search */
+	void (*lookup) (struct ArtScanOpaqueData * so, ItemPointer iptr, int depth);
 } ArtScanOpaqueData;
 
 typedef ArtScanOpaqueData *ArtScanOpaque;
 
 static void _art_search(ArtScanOpaque scanOpaque, ArtNodeHeader * rootArtNode,
 					    ItemPointer iptr, bool range, bool checkRange, int depth);
+static void _art_scan_add_inline(ArtScanOpaque so, ItemPointer slot,
+								 bool range, bool compare);
+static bool _art_scan_cmp_matches(StrategyNumber strategy, int32 cmp);
+static void _art_search_bucket(ArtScanOpaque so, ArtNodeHeader * bucket,
+							   bool range, bool compare, int depth);
+static void _art_lookup_fixed(ArtScanOpaque so, ItemPointer iptr, int depth,
+							  const int keyWidth);
+static void _art_lookup_fixed4(ArtScanOpaque so, ItemPointer iptr, int depth);
+static void _art_lookup_fixed8(ArtScanOpaque so, ItemPointer iptr, int depth);
+static void _art_lookup_fixed16(ArtScanOpaque so, ItemPointer iptr, int depth);
+static void _art_scan_begin(IndexScanDesc scan);
+static void _art_scan_pending(ArtScanOpaque so);
+static int _art_itemptr_cmp(const void * a, const void * b);
+static void _art_scan_skip_pending(ArtScanOpaque so);
+static void _art_scan_bitmap_page(ArtScanOpaque so);
+static bool _art_scan_next_items(ArtScanOpaque so);
+static void _art_kill_items(ArtScanOpaque so);
+static void _art_kill_leaf_items(ArtScanOpaque so, Page page);
+static TransactionId _art_kill_latest_removed_xid(ArtScanOpaque so, OffsetNumber off,
+												  ItemPointerData * dead, int numDead);
 static int _art_find_cmp_order(const pairingheap_node * a,
 							   const pairingheap_node * b,
 							   void * arg);
@@ -117,7 +152,9 @@ _art_search(ArtScanOpaque scanOpaque, ArtNodeHeader * node,
 				return;
 			}
 
-			cmp = _art_compare_key(leaf->data[depth-1], scanOpaque->art_tuple->key[depth-1]);
+			// Path up to leaf equals scan key, compare remaining suffix
+			cmp = _art_leaf_compare(leaf, scanOpaque->art_tuple->key,
+									scanOpaque->art_tuple->key_len);
 
 			if (scanOpaque->sk_strategy == BTLessStrategyNumber)
 			{
@@ -162,30 +199,56 @@ _art_search(ArtScanOpaque scanOpaque, ArtNodeHeader * node,
 		return;
 	}
 
-	// Bail if the prefix does not match
-	if (node->prefix_key_len)
+	if (node->node_type == NODE_BUCKET)
+	{
+		_art_search_bucket(scanOpaque, node, range, compare, depth);
+		return;
+	}
+
+	// Bail if the prefix does not match, subtrees that are not compared
+	// anymore are taken whole
+	if (node->prefix_key_len && (!range || compare))
 	{
 		prefix_len = 
-			_art_check_prefix(node, scanOpaque->art_tuple->key,
+			_art_check_prefix(ART_PAGE_NODE_PREFIX(node), node->prefix_key_len,
+							  scanOpaque->art_tuple->key,
 							  scanOpaque->art_tuple->key_len, depth);
 
-		if (prefix_len != Min(MAX_PREFIX_KEY_LEN, node->prefix_key_len))
-			return;
-	
-		depth = depth + node->prefix_key_len;
+		if (prefix_len != node->prefix_key_len)
+		{
+			int32 cmp;
+
+			if (!range)
+				return;
+
+			// Whole subtree is either inside or outside of scan range
+			cmp = _art_compare_key(ART_PAGE_NODE_PREFIX(node)[prefix_len],
+								   scanOpaque->art_tuple->key[depth + prefix_len]);
+
+			if (((scanOpaque->sk_strategy == BTLessStrategyNumber ||
+				  scanOpaque->sk_strategy == BTLessEqualStrategyNumber) && cmp > 0) ||
+				((scanOpaque->sk_strategy == BTGreaterStrategyNumber ||
+				  scanOpaque->sk_strategy == BTGreaterEqualStrategyNumber) && cmp < 0))
+				return;
+
+			compare = false;
+		}
 	}
+
+	depth = depth + node->prefix_key_len;
 	
 	if (!range)
 	{
-		ItemPointer iptr =
-			_art_find_child_equal(node, scanOpaque->art_tuple->key[depth]);
+		ItemPointerData child;
 
-		if (iptr != NULL)
-			_art_add_queue_itemptr(children_queue, iptr, true);
+		if (_art_page_node_find_child(node, ItemPointerGetBlockNumber(iptr),
+									  scanOpaque->art_tuple->key[depth], &child))
+			_art_add_queue_itemptr(children_queue, &child, true);
 	}
 	else
 	{
-		_art_find_child_range(node, scanOpaque->art_tuple->key[depth],
+		_art_find_child_range(node, ItemPointerGetBlockNumber(iptr),
+							  compare ? scanOpaque->art_tuple->key[depth] : 0,
 							  scanOpaque->sk_strategy,
 							  children_queue, compare);
 	}
@@ -200,6 +263,14 @@ _art_search(ArtScanOpaque scanOpaque, ArtNodeHeader * node,
 		ArtQueueItemPointer * scan_item_ptr = 
 			(ArtQueueItemPointer *) pairingheap_remove_first(children_queue);
 
+		if (ART_CHILD_IS_INLINE(&scan_item_ptr->iptr))
+		{
+			_art_scan_add_inline(scanOpaque, &scan_item_ptr->iptr,
+								 range, scan_item_ptr->compare);
+			pfree(scan_item_ptr);
+			continue;
+		}
+
 		node = _art_get_node_from_iptr(scanOpaque->index, &scan_item_ptr->iptr,
 									   &next_node_buffer, BUFFER_LOCK_SHARE);
 
@@ -221,6 +292,192 @@ _art_search(ArtScanOpaque scanOpaque, ArtNodeHeader * node,
 	}
 }
 
+/*
+ * Point lookup of fixed width key. Only one node is visited at each level,
+ * so descent is iterative without children queue and keeps node page
+ * locked only while node is read. keyWidth is constant in specialized
+ * variants below, so depth bounds are folded by compiler. Prefix and leaf
+ * compares still take their length from node, they stay variable memcmp.
+ */
+pg_attribute_always_inline void
+_art_lookup_fixed(ArtScanOpaque so, ItemPointer iptr, int depth, const int keyWidth)
+{
+	const uint8 * key = so->art_tuple->key;
+	ItemPointerData child = *iptr;
+	Buffer buffer = InvalidBuffer;
+
+	Assert(so->art_tuple->key_len == keyWidth);
+
+	while (depth < keyWidth)
+	{
+		BlockNumber blk = ItemPointerGetBlockNumber(&child);
+		ArtNodeHeader * node;
+		Page page;
+
+		if (!BufferIsValid(buffer) || BufferGetBlockNumber(buffer) != blk)
+		{
+			if (BufferIsValid(buffer))
+				UnlockReleaseBuffer(buffer);
+
+			buffer = ReadBuffer(so->index, blk);
+			LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		}
+
+		page = BufferGetPage(buffer);
+		node = _art_page_get_node(so->index, page, &child);
+
+		if (node->node_type == NODE_LEAF)
+		{
+			ArtNodeLeaf * leaf = (ArtNodeLeaf *) node;
+
+			if (ART_LEAF_KEY_LEN(leaf) == keyWidth &&
+				memcmp(leaf->data, key + leaf->key_offset, leaf->key_len) == 0)
+				_art_add_queue_itemptr(so->leaf_list_queue, &child, false);
+			break;
+		}
+
+		if (node->node_type == NODE_BUCKET)
+		{
+			_art_search_bucket(so, node, false, true, depth);
+			break;
+		}
+
+		// Prefix is always shorter than remaining key
+		if (node->prefix_key_len)
+		{
+			if (depth + node->prefix_key_len >= keyWidth ||
+				memcmp(ART_PAGE_NODE_PREFIX(node), key + depth, node->prefix_key_len) != 0)
+				break;
+
+			depth += node->prefix_key_len;
+		}
+
+		if (!_art_page_node_find_child(node, blk, key[depth], &child))
+			break;
+
+		// Key ending at child byte is scan key, all keys have same width
+		if (ART_CHILD_IS_INLINE(&child))
+		{
+			_art_scan_add_inline(so, &child, false, false);
+			break;
+		}
+
+		depth++;
+	}
+
+	if (BufferIsValid(buffer))
+		UnlockReleaseBuffer(buffer);
+}
+
+void
+_art_lookup_fixed4(ArtScanOpaque so, ItemPointer iptr, int depth)
+{
+	_art_lookup_fixed(so, iptr, depth, 4);
+}
+
+void
+_art_lookup_fixed8(ArtScanOpaque so, ItemPointer iptr, int depth)
+{
+	_art_lookup_fixed(so, iptr, depth, 8);
+}
+
+void
+_art_lookup_fixed16(ArtScanOpaque so, ItemPointer iptr, int depth)
+{
+	_art_lookup_fixed(so, iptr, depth, 16);
+}
+
+/*
+ * Check if key compared to scan key with result cmp satisfies scan strategy.
+ */
+bool
+_art_scan_cmp_matches(StrategyNumber strategy, int32 cmp)
+{
+	switch (strategy)
+	{
+		case BTLessStrategyNumber:
+			return cmp < 0;
+		case BTLessEqualStrategyNumber:
+			return cmp <= 0;
+		case BTEqualStrategyNumber:
+			return cmp == 0;
+		case BTGreaterEqualStrategyNumber:
+			return cmp >= 0;
+		case BTGreaterStrategyNumber:
+			return cmp > 0;
+	}
+
+	return false;
+}
+
+/*
+ * Collect matching keys of bucket. Bucket holds full keys below its depth,
+ * so entries are compared with scan key directly, equality search uses
+ * binary search.
+ */
+void
+_art_search_bucket(ArtScanOpaque so, ArtNodeHeader * bucket,
+				   bool range, bool compare, int depth)
+{
+	int first = 0;
+	int last = bucket->num_children - 1;
+
+	if (!range)
+	{
+		bool found;
+
+		first = last = _art_bucket_find(bucket, so->art_tuple->key,
+										so->art_tuple->key_len, depth, &found);
+		if (!found)
+			return;
+	}
+
+	for (int i = first; i <= last; i++)
+	{
+		ItemPointer child = &ART_BUCKET_ENTRY(bucket, i)->child;
+
+		if (range && compare &&
+			!_art_scan_cmp_matches(so->sk_strategy,
+								   _art_bucket_compare(bucket, i, so->art_tuple->key,
+													   so->art_tuple->key_len, depth)))
+			continue;
+
+		if (ART_CHILD_IS_INLINE(child))
+			_art_scan_add_inline(so, child, false, false);
+		else
+			_art_add_queue_itemptr(so->leaf_list_queue, child, false);
+	}
+}
+
+/*
+ * Collect TID stored inline in child slot. Its key ends at child byte, so
+ * child that still needs comparison holds key equal to scan key.
+ */
+void
+_art_scan_add_inline(ArtScanOpaque so, ItemPointer slot, bool range, bool compare)
+{
+	if (range && compare &&
+		(so->sk_strategy == BTLessStrategyNumber ||
+		 so->sk_strategy == BTGreaterStrategyNumber))
+		return;
+
+	if (so->inline_iptr == NULL)
+	{
+		so->inline_max_items = 64;
+		so->inline_num_items = 0;
+		so->inline_iptr = palloc(sizeof(ItemPointerData) * so->inline_max_items);
+	}
+	else if (so->inline_num_items == so->inline_max_items)
+	{
+		so->inline_max_items *= 2;
+		so->inline_iptr = repalloc(so->inline_iptr,
+								   sizeof(ItemPointerData) * so->inline_max_items);
+	}
+
+	ART_CHILD_GET_INLINE(slot, &so->inline_iptr[so->inline_num_items]);
+	so->inline_num_items++;
+}
+
 
 IndexScanDesc
 artbeginscan(Relation r, int nkeys, int norderbys)
@@ -228,6 +485,9 @@ artbeginscan(Relation r, int nkeys, int norderbys)
 	IndexScanDesc scan;
 	ArtScanOpaque so;
 
+	// Index built with other format is not read
+	_art_get_metadata_flags(r);
+
 	scan = RelationGetIndexScan(r, nkeys, norderbys);
 
 	so = (ArtScanOpaque) palloc0(sizeof(ArtScanOpaqueData));
@@ -239,7 +499,31 @@ artbeginscan(Relation r, int nkeys, int norderbys)
 	so->leaf_page_entry = NULL;
 	so->leaf_current_item = 0;
 	so->leaf_iptr = NULL;
-
+	so->inline_iptr = NULL;
+	so->inline_num_items = 0;
+	so->bitmap_blk = InvalidBlockNumber;
+	ItemPointerSetInvalid(&so->kill_iptr);
+	so->killed_items = NULL;
+	so->num_killed = 0;
+	so->pending_iptr = NULL;
+	so->num_pending = 0;
+	so->pending_returned = false;
+
+	switch (TupleDescAttr(r->rd_att, 0)->attlen)
+	{
+		case 4:
+			so->lookup = _art_lookup_fixed4;
+			break;
+		case 8:
+			so->lookup = _art_lookup_fixed8;
+			break;
+		case 16:
+			so->lookup = _art_lookup_fixed16;
+			break;
+		default:
+			so->lookup = NULL;
+			break;
+	}
 
 	scan->opaque = so;
 
@@ -253,11 +537,31 @@ artrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
 {
 	ArtScanOpaque so = (ArtScanOpaque) scan->opaque;
 
+	_art_kill_items(so);
+
 	if (so->art_tuple)
 		pfree(so->art_tuple);
 
+	if (so->leaf_iptr)
+		pfree(so->leaf_iptr);
+
+	if (so->inline_iptr)
+		pfree(so->inline_iptr);
+
+	if (so->pending_iptr)
+		pfree(so->pending_iptr);
+
 	so->art_tuple = NULL;
 	so->leaf_iptr = NULL;
+	so->inline_iptr = NULL;
+	so->pending_iptr = NULL;
+	so->num_pending = 0;
+	so->pending_returned = false;
+	so->inline_num_items = 0;
+	so->leaf_num_items = 0;
+	so->leaf_current_item = 0;
+	so->bitmap_blk = InvalidBlockNumber;
+	so->fetching = false;
 
 	/* Update scan key, if a new one is given */
 	if (scankey && scan->numberOfKeys > 0)
@@ -274,108 +578,544 @@ artendscan(IndexScanDesc scan)
 {
 	ArtScanOpaque so = (ArtScanOpaque) scan->opaque;
 
-	_art_page_release(so->leaf_page);
-	
+	_art_kill_items(so);
+
 	if (so->art_tuple)
 		pfree(so->art_tuple);
 
 	if (so->leaf_iptr)
 		pfree(so->leaf_iptr);
 
+	if (so->inline_iptr)
+		pfree(so->inline_iptr);
+
+	if (so->pending_iptr)
+		pfree(so->pending_iptr);
+
 	pfree(so);
 }
 
 
-bool
-artgettuple(IndexScanDesc scan, ScanDirection dir)
+void
+_art_scan_begin(IndexScanDesc scan)
 {
 	ArtNodeHeader * root_node;
 	ArtScanOpaque so = (ArtScanOpaque) scan->opaque;
-	ArtQueueItemPointer * leaf_iptr = NULL;
 	ItemPointerData root_iptr;
-	BlockNumber leaf_page_blk_num;
-	OffsetNumber leaf_page_offset;
-	bool is_new_page_entry = false;
+	int depth = 0;
+
+	if (so->fetching)
+		return;
 
-	if (!so->fetching)
 	{
 		Datum search_datum [1] = { scan->keyData[0].sk_argument };
 		bool is_nulls[1] = { false };
 
 		so->art_tuple =
 			_art_form_key(so->index, NULL, search_datum, is_nulls);
+	}
+
+	so->sk_strategy = scan->keyData->sk_strategy;
+	so->leaf_list_queue = pairingheap_allocate(_art_find_cmp_order, NULL);
+
+	// Pending list is read before tree, see art_pending.c
+	_art_scan_pending(so);
 
-		so->sk_strategy = scan->keyData->sk_strategy;
-		so->leaf_list_queue = pairingheap_allocate(_art_find_cmp_order, NULL);
+	ItemPointerSet(&root_iptr, ART_ROOT_NODE_BLKNO, 1);
 
-		ItemPointerSet(&root_iptr, ART_ROOT_NODE_BLKNO, 1);
+	// Point lookup starts at jump node of first key byte
+	if (so->sk_strategy == BTEqualStrategyNumber &&
+		(_art_get_metadata_flags(scan->indexRelation) & ART_META_JUMP_TABLE))
+	{
+		ItemPointerSet(&root_iptr, ART_JUMP_NODE_BLKNO(so->art_tuple->key[0]),
+					   ART_JUMP_NODE_ITEM(so->art_tuple->key[0]));
+		depth = 1;
+	}
 
+	if (so->sk_strategy == BTEqualStrategyNumber && so->lookup != NULL)
+		so->lookup(so, &root_iptr, depth);
+	else
+	{
 		root_node = _art_get_node_from_iptr(scan->indexRelation, &root_iptr,
 											&so->node_page_buffer, BUFFER_LOCK_SHARE);
 
-		_art_search(so, root_node, &root_iptr, 
-					so->sk_strategy != BTEqualStrategyNumber, true, 0);
+		_art_search(so, root_node, &root_iptr,
+					so->sk_strategy != BTEqualStrategyNumber, true, depth);
 
 		UnlockReleaseBuffer(so->node_page_buffer);
+	}
 
-		so->fetching = true;
+	so->fetching = true;
+}
+
+/*
+ * Collect TIDs of pending list entries that match scan key. They are
+ * returned before tree TIDs, which skip TIDs merged into tree meanwhile.
+ *
+ * Next page is locked before current one is released. Merge frees pages
+ * holding metadata page, locking pages in list order, so it can't pass
+ * scan and link tail it frees to free chain ahead of scan.
+ */
+void
+_art_scan_pending(ArtScanOpaque so)
+{
+	Buffer buffer = ReadBuffer(so->index, ART_METADATA_NODE_BLKNO);
+	Buffer next_buffer = InvalidBuffer;
+	BlockNumber blk;
+	int max_pending = 0;
+	int num_unique = 0;
+
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	blk = ((ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer)))->pending_head;
+
+	if (BlockNumberIsValid(blk))
+	{
+		next_buffer = ReadBuffer(so->index, blk);
+		LockBuffer(next_buffer, BUFFER_LOCK_SHARE);
 	}
 
-	if (so->leaf_iptr == NULL ||
-	    so->leaf_num_items == so->leaf_current_item)
+	UnlockReleaseBuffer(buffer);
+
+	while (BufferIsValid(next_buffer))
 	{
-		ArtNodeLeaf * leaf = NULL;
+		Page page;
+		OffsetNumber maxoff;
 
-		if (so->leaf_iptr)
-			pfree(so->leaf_iptr);
+		buffer = next_buffer;
+		next_buffer = InvalidBuffer;
+		page = BufferGetPage(buffer);
+		maxoff = PageGetMaxOffsetNumber(page);
 
-		so->leaf_iptr = NULL;
+		for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+		{
+			ArtPendingItem * item =
+				(ArtPendingItem *) PageGetItem(page, PageGetItemId(page, off));
 
-		if(pairingheap_is_empty(so->leaf_list_queue))
+			if (!_art_scan_cmp_matches(so->sk_strategy,
+									   _art_pending_compare(item, so->art_tuple->key,
+															so->art_tuple->key_len)))
+				continue;
+
+			if (so->num_pending == max_pending)
+			{
+				max_pending = Max(max_pending * 2, 64);
+				so->pending_iptr = so->pending_iptr ?
+					repalloc(so->pending_iptr, sizeof(ItemPointerData) * max_pending) :
+					palloc(sizeof(ItemPointerData) * max_pending);
+			}
+
+			so->pending_iptr[so->num_pending++] = item->iptr;
+		}
+
+		blk = ((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link;
+
+		if (BlockNumberIsValid(blk))
 		{
-			return false;
+			next_buffer = ReadBuffer(so->index, blk);
+			LockBuffer(next_buffer, BUFFER_LOCK_SHARE);
 		}
 
-		leaf_iptr =
-			(ArtQueueItemPointer *) pairingheap_remove_first(so->leaf_list_queue);
+		UnlockReleaseBuffer(buffer);
+	}
+
+	if (so->num_pending == 0)
+		return;
+
+	pg_qsort(so->pending_iptr, so->num_pending, sizeof(ItemPointerData), _art_itemptr_cmp);
+
+	// Entry left in list by failed merge may be appended again
+	for (int i = 0; i < so->num_pending; i++)
+	{
+		if (num_unique == 0 ||
+			!ItemPointerEquals(&so->pending_iptr[i], &so->pending_iptr[num_unique - 1]))
+			so->pending_iptr[num_unique++] = so->pending_iptr[i];
+	}
+
+	so->num_pending = num_unique;
+}
+
+int
+_art_itemptr_cmp(const void * a, const void * b)
+{
+	return ItemPointerCompare((ItemPointer) a, (ItemPointer) b);
+}
+
+/*
+ * Remove TIDs already returned from pending list from scan TID array.
+ */
+void
+_art_scan_skip_pending(ArtScanOpaque so)
+{
+	int num_items = 0;
+
+	if (so->num_pending == 0 || so->leaf_iptr == NULL)
+		return;
+
+	for (int i = 0; i < so->leaf_num_items; i++)
+	{
+		if (bsearch(&so->leaf_iptr[i], so->pending_iptr, so->num_pending,
+					sizeof(ItemPointerData), _art_itemptr_cmp) == NULL)
+			so->leaf_iptr[num_items++] = so->leaf_iptr[i];
+	}
+
+	so->leaf_num_items = num_items;
+}
+
+/*
+ * Decode all containers of current bitmap leaf page into scan TID array.
+ */
+void
+_art_scan_bitmap_page(ArtScanOpaque so)
+{
+	Buffer buffer;
+	Page page;
+	OffsetNumber maxoff;
+	OffsetNumber off;
+	int num_items = 0;
+
+	buffer = ReadBuffer(so->index, so->bitmap_blk);
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	// Leaf was removed by cleanup and its pages freed, it had no TIDs left
+	if (!(((ArtDataPageOpaque) PageGetSpecialPointer(page))->page_flags & ART_BITMAP_PAGE))
+	{
+		so->bitmap_blk = InvalidBlockNumber;
+		UnlockReleaseBuffer(buffer);
+		return;
+	}
+
+	for (off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		ArtBitmapContainer * c =
+			(ArtBitmapContainer *) PageGetItem(page, PageGetItemId(page, off));
+		num_items += c->num_items;
+	}
+
+	so->leaf_iptr = palloc(sizeof(ItemPointerData) * Max(num_items, 1));
+
+	for (off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		ArtBitmapContainer * c =
+			(ArtBitmapContainer *) PageGetItem(page, PageGetItemId(page, off));
+		so->leaf_num_items +=
+			_art_bitmap_container_decode(c, so->leaf_iptr + so->leaf_num_items);
+	}
+
+	so->bitmap_blk = ((ArtDataPageOpaque) PageGetSpecialPointer(page))->right_link;
+
+	UnlockReleaseBuffer(buffer);
+}
+
+/*
+ * Load TIDs of next leaf fragment, or next page of bitmap leaf, into scan
+ * TID array. Returns false if there are no more leaves to read.
+ */
+bool
+_art_scan_next_items(ArtScanOpaque so)
+{
+	ArtQueueItemPointer * leaf_iptr = NULL;
+	ArtNodeLeaf * leaf = NULL;
+	BlockNumber leaf_page_blk_num;
+	OffsetNumber leaf_page_offset;
+	bool is_new_page_entry = false;
+
+	_art_kill_items(so);
+
+	if (so->leaf_iptr)
+		pfree(so->leaf_iptr);
+
+	so->leaf_iptr = NULL;
+	so->leaf_num_items =  0;
+	so->leaf_current_item = 0;
+
+	// Pending list TIDs go first, tree TIDs then skip them
+	if (so->num_pending > 0 && !so->pending_returned)
+	{
+		so->leaf_iptr = palloc(sizeof(ItemPointerData) * so->num_pending);
+		memcpy(so->leaf_iptr, so->pending_iptr, sizeof(ItemPointerData) * so->num_pending);
+		so->leaf_num_items = so->num_pending;
+		so->pending_returned = true;
+		return true;
+	}
+
+	// TIDs stored inline in nodes are returned next, as single batch
+	if (so->inline_iptr)
+	{
+		so->leaf_iptr = so->inline_iptr;
+		so->leaf_num_items = so->inline_num_items;
+		so->inline_iptr = NULL;
+		so->inline_num_items = 0;
+		_art_scan_skip_pending(so);
+		return true;
+	}
+
+	if (BlockNumberIsValid(so->bitmap_blk))
+	{
+		_art_scan_bitmap_page(so);
+		_art_scan_skip_pending(so);
+		return true;
+	}
+
+	if(pairingheap_is_empty(so->leaf_list_queue))
+	{
+		return false;
+	}
+
+	leaf_iptr =
+		(ArtQueueItemPointer *) pairingheap_remove_first(so->leaf_list_queue);
+
+	leaf_page_blk_num = ItemPointerGetBlockNumber(&leaf_iptr->iptr);
+	leaf_page_offset = ItemPointerGetOffsetNumber(&leaf_iptr->iptr);
+
+	so->leaf_page_entry = _art_load_page(so->index, &so->leaf_entry_head,
+										 leaf_page_blk_num,
+										 BUFFER_LOCK_SHARE, &is_new_page_entry);
+
+	if (!is_new_page_entry)
+	{
+		_art_page_release(so->leaf_page);
+	}
+	else
+	{
+		dlist_push_tail(&so->leaf_entry_head, so->leaf_page_entry);
+		so->leaf_page = dlist_container(ArtPageEntry, node, so->leaf_page_entry);
+	}
+
+	// Leaf removed since it was queued is kept dead with its contents
+	leaf = (ArtNodeLeaf *) _art_page_get_node(so->index, so->leaf_page->page,
+											  &leaf_iptr->iptr);
+
+	if (leaf->node_type != NODE_LEAF)
+		elog(ERROR, "ART index \"%s\" has no leaf at (%u,%u)",
+			 RelationGetRelationName(so->index), leaf_page_blk_num, leaf_page_offset);
+
+	if (ItemPointerIsValid(&leaf->next_leaf_iptr))
+	{
+		_art_add_queue_itemptr(so->leaf_list_queue, 
+							   &leaf->next_leaf_iptr, false);
+	}
+
+	if (leaf->flags & ART_LEAF_BITMAP)
+	{
+		ArtLeafBitmap bitmap;
+
+		// TIDs are read page by page on following calls
+		memcpy(&bitmap, ART_LEAF_POSTING(leaf), sizeof(ArtLeafBitmap));
+		so->bitmap_blk = bitmap.first_blk;
+	}
+	else
+	{
+		so->leaf_iptr = palloc0(sizeof(ItemPointerData) * leaf->num_items);
+		so->leaf_num_items = _art_posting_decode(ART_LEAF_POSTING(leaf), leaf->posting_size,
+												 so->leaf_iptr);
+
+		ItemPointerCopy(&leaf_iptr->iptr, &so->kill_iptr);
+		so->kill_cycle =
+			((ArtDataPageOpaque) PageGetSpecialPointer(so->leaf_page->page))->remove_cycle;
+
+		_art_scan_skip_pending(so);
+	}
+
+	_art_page_release(so->leaf_page);
+	so->leaf_page = NULL;
 
-		leaf_page_blk_num = ItemPointerGetBlockNumber(&leaf_iptr->iptr);
-		leaf_page_offset = ItemPointerGetOffsetNumber(&leaf_iptr->iptr);
+	pfree(leaf_iptr);
 
-		so->leaf_num_items =  0;
-		so->leaf_current_item = 0;
+	return true;
+}
+
+/*
+ * Remove TIDs reported dead from current leaf fragment. Removal is skipped
+ * if page can't be locked right away, VACUUM gets them later. TIDs removed
+ * from page since fragment was read may have been reused by heap, and
+ * fragment item may have been replaced, so nothing is removed then.
+ */
+void
+_art_kill_items(ArtScanOpaque so)
+{
+	Buffer buffer;
+
+	if (so->num_killed == 0 || !_art_xlog_can_remove_tids(so->index))
+	{
+		if (so->killed_items)
+			pfree(so->killed_items);
+
+		ItemPointerSetInvalid(&so->kill_iptr);
+		so->killed_items = NULL;
+		so->num_killed = 0;
+		return;
+	}
 
-		so->leaf_page_entry = _art_load_page(scan->indexRelation, &so->leaf_entry_head,
-											 leaf_page_blk_num,
-											 BUFFER_LOCK_SHARE, &is_new_page_entry);
+	buffer = ReadBuffer(so->index, ItemPointerGetBlockNumber(&so->kill_iptr));
 
-		if (!is_new_page_entry)
+	if (ConditionalLockBuffer(buffer))
+	{
+		// Batch logs changes of page and releases it
+		_art_xlog_begin(so->index);
+		_art_xlog_register_buffer(buffer, false);
+
+		PG_TRY();
 		{
-			_art_page_release(so->leaf_page);
+			_art_kill_leaf_items(so, BufferGetPage(buffer));
+			_art_xlog_finish();
 		}
-		else
+		PG_CATCH();
 		{
-			dlist_push_tail(&so->leaf_entry_head, so->leaf_page_entry);
-			so->leaf_page = dlist_container(ArtPageEntry, node, so->leaf_page_entry);
+			_art_xlog_abort();
+			PG_RE_THROW();
 		}
+		PG_END_TRY();
+	}
+	else
+		ReleaseBuffer(buffer);
 
-		leaf = 
-			(ArtNodeLeaf *) PageGetItem(so->leaf_page->page,
-										PageGetItemId(so->leaf_page->page, leaf_page_offset));
+	pfree(so->killed_items);
 
-		if (ItemPointerIsValid(&leaf->next_leaf_iptr))
-		{
-			_art_add_queue_itemptr(so->leaf_list_queue, 
-								   &leaf->next_leaf_iptr, false);
-		}
-		
-		so->leaf_num_items = leaf->num_items;
-		so->leaf_iptr = palloc0(sizeof(ItemPointerData) * leaf->num_items);
-		memcpy(so->leaf_iptr, &leaf->data[leaf->key_len], sizeof(ItemPointerData) *leaf->num_items);
-	
-		_art_page_release(so->leaf_page);
+	ItemPointerSetInvalid(&so->kill_iptr);
+	so->killed_items = NULL;
+	so->num_killed = 0;
+}
+
+/*
+ * Remove killed TIDs from leaf fragment on locked page, if fragment is
+ * still the one they were read from.
+ */
+void
+_art_kill_leaf_items(ArtScanOpaque so, Page page)
+{
+	OffsetNumber off = ItemPointerGetOffsetNumber(&so->kill_iptr);
+	ItemId item_id;
+	ArtNodeLeaf * leaf;
+	ItemPointerData * items;
+	ItemPointerData * dead;
+	ArtNodeLeaf * new_leaf;
+	int num_items;
+	int num_live = 0;
+	int num_dead = 0;
+	int k = 0;
+
+	if (((ArtDataPageOpaque) PageGetSpecialPointer(page))->remove_cycle != so->kill_cycle ||
+		off > PageGetMaxOffsetNumber(page))
+		return;
+
+	// Dead leaf is not in tree anymore, it only serves running scans
+	item_id = PageGetItemId(page, off);
+
+	if (!ItemIdIsNormal(item_id))
+		return;
+
+	leaf = (ArtNodeLeaf *) PageGetItem(page, item_id);
+
+	if (leaf->node_type != NODE_LEAF || (leaf->flags & ART_LEAF_BITMAP))
+		return;
+
+	items = palloc(sizeof(ItemPointerData) * (leaf->num_items + 1));
+	dead = palloc(sizeof(ItemPointerData) * (leaf->num_items + 1));
+	num_items = _art_posting_decode(ART_LEAF_POSTING(leaf), leaf->posting_size, items);
+
+	// Both lists are in TID order
+	for (int i = 0; i < num_items; i++)
+	{
+		while (k < so->num_killed &&
+			   ItemPointerCompare(&so->leaf_iptr[so->killed_items[k]], &items[i]) < 0)
+			k++;
+
+		if (k < so->num_killed &&
+			ItemPointerEquals(&so->leaf_iptr[so->killed_items[k]], &items[i]))
+			dead[num_dead++] = items[i];
+		else
+			items[num_live++] = items[i];
+	}
+
+	if (num_dead > 0)
+	{
+		if (so->heap_rel && XLogStandbyInfoActive() && RelationNeedsWAL(so->index))
+			_art_xlog_set_latest_removed_xid(_art_kill_latest_removed_xid(so, off, dead,
+																		  num_dead));
+
+		new_leaf = (ArtNodeLeaf *) palloc(sizeof(ArtNodeLeaf) + leaf->key_len +
+										  ART_POSTING_MAX_SIZE(num_live));
+
+		memcpy(new_leaf, leaf, sizeof(ArtNodeLeaf) + leaf->key_len);
+		new_leaf->num_items = num_live;
+		new_leaf->posting_size =
+			_art_posting_encode(items, num_live, ART_LEAF_POSTING(new_leaf));
+
+		START_CRIT_SECTION();
+		PageIndexTupleOverwrite(page, off, (Item) new_leaf,
+								_art_node_size((ArtNodeHeader *) new_leaf));
+		END_CRIT_SECTION();
+
+		pfree(new_leaf);
+	}
 
-		pfree(leaf_iptr);
+	pfree(dead);
+	pfree(items);
+}
+
+/*
+ * Newest xid of heap tuples of killed TIDs, hot standby cancels queries
+ * that may still see them. Heap checks TIDs known dead like for btree.
+ */
+TransactionId
+_art_kill_latest_removed_xid(ArtScanOpaque so, OffsetNumber off,
+							 ItemPointerData * dead, int numDead)
+{
+	TM_IndexDeleteOp delstate;
+	TransactionId latest_removed_xid;
+
+	delstate.irel = so->index;
+	delstate.iblknum = ItemPointerGetBlockNumber(&so->kill_iptr);
+	delstate.bottomup = false;
+	delstate.bottomupfreespace = 0;
+	delstate.ndeltids = numDead;
+	delstate.deltids = (TM_IndexDelete *) palloc(sizeof(TM_IndexDelete) * numDead);
+	delstate.status = (TM_IndexStatus *) palloc(sizeof(TM_IndexStatus) * numDead);
+
+	for (int i = 0; i < numDead; i++)
+	{
+		delstate.deltids[i].tid = dead[i];
+		delstate.deltids[i].id = i;
+		delstate.status[i].idxoffnum = off;
+		delstate.status[i].knowndeletable = true;
+		delstate.status[i].promising = false;
+		delstate.status[i].freespace = 0;
+	}
+
+	latest_removed_xid = table_index_delete_tuples(so->heap_rel, &delstate);
+
+	pfree(delstate.status);
+	pfree(delstate.deltids);
+
+	return latest_removed_xid;
+}
+
+bool
+artgettuple(IndexScanDesc scan, ScanDirection dir)
+{
+	ArtScanOpaque so = (ArtScanOpaque) scan->opaque;
+
+	_art_scan_begin(scan);
+
+	// Previously returned heap tuple is dead to everyone
+	if (scan->kill_prior_tuple && ItemPointerIsValid(&so->kill_iptr) &&
+		so->leaf_current_item > 0)
+	{
+		if (so->killed_items == NULL)
+			so->killed_items = palloc(sizeof(int) * so->leaf_num_items);
+
+		so->heap_rel = scan->heapRelation;
+
+		so->killed_items[so->num_killed++] = so->leaf_current_item - 1;
+	}
+
+	while (so->leaf_iptr == NULL ||
+		   so->leaf_num_items == so->leaf_current_item)
+	{
+		if (!_art_scan_next_items(so))
+			return false;
 	}
 
 	ItemPointerCopy(&so->leaf_iptr[so->leaf_current_item], &scan->xs_heaptid);
@@ -384,3 +1124,24 @@ artgettuple(IndexScanDesc scan, ScanDirection dir)
 
 	return true;
 }
+
+
+int64
+artgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
+{
+	ArtScanOpaque so = (ArtScanOpaque) scan->opaque;
+	int64 ntids = 0;
+
+	_art_scan_begin(scan);
+
+	// Whole leaf fragments and bitmap pages are added at once
+	while (_art_scan_next_items(so))
+	{
+		if (so->leaf_num_items > 0)
+			tbm_add_tuples(tbm, so->leaf_iptr, so->leaf_num_items, false);
+
+		ntids += so->leaf_num_items;
+	}
+
+	return ntids;
+}
@@ -5,61 +5,78 @@
 
 #include "art.h"
 
-#ifdef __i386__
-    #include <emmintrin.h>
-#else
-#ifdef __amd64__
-    #include <emmintrin.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define ART_HAVE_AVX2
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static uint64 _keys_eq_mask_scalar(const uint8 * keys, int numBlocks, uint8 key);
+static uint64 _keys_le_mask_scalar(const uint8 * keys, int numBlocks, uint8 key);
+#if defined(__SSE2__)
+static uint64 _keys_eq_mask_sse2(const uint8 * keys, int numBlocks, uint8 key);
+static uint64 _keys_le_mask_sse2(const uint8 * keys, int numBlocks, uint8 key);
+#endif
+#ifdef ART_HAVE_AVX2
+static uint64 _keys_eq_mask_avx2(const uint8 * keys, int numBlocks, uint8 key);
+static uint64 _keys_le_mask_avx2(const uint8 * keys, int numBlocks, uint8 key);
+#endif
+#if defined(__aarch64__)
+static uint64 _keys_eq_mask_neon(const uint8 * keys, int numBlocks, uint8 key);
+static uint64 _keys_le_mask_neon(const uint8 * keys, int numBlocks, uint8 key);
+#endif
+
+static const ArtKeyKernels art_key_kernels_scalar = {
+	"scalar", _keys_eq_mask_scalar, _keys_le_mask_scalar
+};
+#if defined(__SSE2__)
+static const ArtKeyKernels art_key_kernels_sse2 = {
+	"sse2", _keys_eq_mask_sse2, _keys_le_mask_sse2
+};
+#endif
+#ifdef ART_HAVE_AVX2
+static const ArtKeyKernels art_key_kernels_avx2 = {
+	"avx2", _keys_eq_mask_avx2, _keys_le_mask_avx2
+};
 #endif
+#if defined(__aarch64__)
+static const ArtKeyKernels art_key_kernels_neon = {
+	"neon", _keys_eq_mask_neon, _keys_le_mask_neon
+};
 #endif
 
+const ArtKeyKernels * art_key_kernels = &art_key_kernels_scalar;
+
 
 /**
- * Allocate ART node
+ * Allocate ART node with room for prefix of prefixLen bytes
  */
 ArtNodeHeader *
-_art_alloc_node(uint8 type)
+_art_alloc_node(uint8 type, uint16 prefixLen)
 {
 	ArtNodeHeader * n;
 
-	switch (type)
-	{
-	case NODE_4:
-		n = (ArtNodeHeader*) palloc0(sizeof(ArtNode4));
-		break;
-	case NODE_16:
-		n = (ArtNodeHeader*) palloc0(sizeof(ArtNode16));
-		break;
-	case NODE_48:
-		n = (ArtNodeHeader*) palloc0(sizeof(ArtNode48));
-		break;
-	case NODE_256:
-		n = (ArtNodeHeader*) palloc0(sizeof(ArtNode256));
-		break;
-	default:
-		elog(ERROR, "Invalid ART NODE");
-	}
+	n = (ArtNodeHeader*) palloc0(_art_node_body_size(type) + prefixLen);
 
 	n->node_type = type;
+	n->prefix_key_len = prefixLen;
 	return n;
 }
 
 
 /**
- * Get ART node size
+ * Get size of ART node without its prefix, prefix is stored right after it
  */
 Size
-_art_node_size(ArtNodeHeader * node)
+_art_node_body_size(uint8 type)
 {
-	switch (node->node_type)
+	switch (type)
 	{
-	case NODE_LEAF:
-		{
-			ArtNodeLeaf * leaf = (ArtNodeLeaf *) node;
-			return sizeof(ArtNodeLeaf) + 
-					leaf->key_len + 
-					leaf->num_items * sizeof(ItemPointerData);
-		}
 	case NODE_4:
 		return sizeof(ArtNode4);
 	case NODE_16:
@@ -68,19 +85,62 @@ _art_node_size(ArtNodeHeader * node)
 		return sizeof(ArtNode48);
 	case NODE_256:
 		return sizeof(ArtNode256);
+	default:
+		elog(ERROR, "Invalid ART NODE");
 	}
 
 	return 0;
 }
 
 
+/**
+ * Get ART node size
+ */
+Size
+_art_node_size(ArtNodeHeader * node)
+{
+	if (node->node_type == NODE_LEAF)
+	{
+		ArtNodeLeaf * leaf = (ArtNodeLeaf *) node;
+		return sizeof(ArtNodeLeaf) + 
+				leaf->key_len + 
+				leaf->posting_size;
+	}
+
+	if (node->node_type == NODE_BUCKET)
+		return _art_bucket_size(node);
+
+	return _art_node_body_size(node->node_type) + node->prefix_key_len;
+}
+
+
+/*
+ * Copy children count and prefix, dest must be allocated with room for
+ * src prefix.
+ */
 void
 _art_copy_header(ArtNodeHeader *dest, ArtNodeHeader *src)
 {
+	Assert(dest->prefix_key_len == src->prefix_key_len);
+
 	dest->num_children = src->num_children;
-	dest->prefix_key_len = src->prefix_key_len;
-	memcpy(dest->prefix, src->prefix, Min(MAX_PREFIX_KEY_LEN, src->prefix_key_len));
-	ItemPointerCopy(&dest->parent_iptr, &src->parent_iptr);
+	memcpy(ART_NODE_PREFIX(dest), ART_NODE_PREFIX(src), src->prefix_key_len);
+}
+
+/*
+ * Return palloc'd copy of node with prefix replaced by prefixLen bytes
+ * of prefix.
+ */
+ArtNodeHeader *
+_art_node_set_prefix(ArtNodeHeader *n, const uint8 *prefix, uint16 prefixLen)
+{
+	ArtNodeHeader * new_node = _art_alloc_node(n->node_type, prefixLen);
+
+	memcpy(new_node, n, _art_node_body_size(n->node_type));
+	new_node->prefix_key_len = prefixLen;
+	memcpy(ART_NODE_PREFIX(new_node), prefix, prefixLen);
+
+	return new_node;
 }
 
 void
@@ -92,6 +152,251 @@ _art_add_queue_itemptr(pairingheap * queue, ItemPointer iptr, bool compare)
 	pairingheap_add(queue, &item->ph_node);
 }
 
+/*
+ * Key search kernels, see ArtKeyKernels.
+ */
+uint64
+_keys_eq_mask_scalar(const uint8 * keys, int numBlocks, uint8 key)
+{
+	uint64 mask = 0;
+
+	for (int i = 0; i < numBlocks * ART_KEY_BLOCK; i++)
+	{
+		if (keys[i] == key)
+			mask |= UINT64CONST(1) << i;
+	}
+
+	return mask;
+}
+
+uint64
+_keys_le_mask_scalar(const uint8 * keys, int numBlocks, uint8 key)
+{
+	uint64 mask = 0;
+
+	for (int i = 0; i < numBlocks * ART_KEY_BLOCK; i++)
+	{
+		if (keys[i] <= key)
+			mask |= UINT64CONST(1) << i;
+	}
+
+	return mask;
+}
+
+#if defined(__SSE2__)
+uint64
+_keys_eq_mask_sse2(const uint8 * keys, int numBlocks, uint8 key)
+{
+	__m128i k = _mm_set1_epi8((char) key);
+	uint64 mask = 0;
+
+	for (int b = 0; b < numBlocks; b++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (keys + b * ART_KEY_BLOCK));
+
+		mask |= (uint64) (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(v, k)) <<
+				(b * ART_KEY_BLOCK);
+	}
+
+	return mask;
+}
+
+uint64
+_keys_le_mask_sse2(const uint8 * keys, int numBlocks, uint8 key)
+{
+	__m128i k = _mm_set1_epi8((char) key);
+	uint64 mask = 0;
+
+	// Unsigned v <= k iff min(v, k) == v
+	for (int b = 0; b < numBlocks; b++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (keys + b * ART_KEY_BLOCK));
+
+		mask |= (uint64) (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, k), v)) <<
+				(b * ART_KEY_BLOCK);
+	}
+
+	return mask;
+}
+#endif
+
+#ifdef ART_HAVE_AVX2
+__attribute__((target("avx2")))
+uint64
+_keys_eq_mask_avx2(const uint8 * keys, int numBlocks, uint8 key)
+{
+	__m256i k = _mm256_set1_epi8((char) key);
+	uint64 mask = 0;
+	int b = 0;
+
+	for (; b + 2 <= numBlocks; b += 2)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (keys + b * ART_KEY_BLOCK));
+
+		mask |= (uint64) (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, k)) <<
+				(b * ART_KEY_BLOCK);
+	}
+
+	if (b < numBlocks)
+		mask |= _keys_eq_mask_sse2(keys + b * ART_KEY_BLOCK, 1, key) << (b * ART_KEY_BLOCK);
+
+	return mask;
+}
+
+__attribute__((target("avx2")))
+uint64
+_keys_le_mask_avx2(const uint8 * keys, int numBlocks, uint8 key)
+{
+	__m256i k = _mm256_set1_epi8((char) key);
+	uint64 mask = 0;
+	int b = 0;
+
+	for (; b + 2 <= numBlocks; b += 2)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (keys + b * ART_KEY_BLOCK));
+
+		mask |= (uint64) (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, k), v)) <<
+				(b * ART_KEY_BLOCK);
+	}
+
+	if (b < numBlocks)
+		mask |= _keys_le_mask_sse2(keys + b * ART_KEY_BLOCK, 1, key) << (b * ART_KEY_BLOCK);
+
+	return mask;
+}
+#endif
+
+#if defined(__aarch64__)
+/*
+ * NEON has no movemask, compare result bytes are weighted by their bit
+ * within each half and summed.
+ */
+static inline uint64
+_neon_movemask(uint8x16_t cmp)
+{
+	static const uint8 weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+									  1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t bits = vandq_u8(cmp, vld1q_u8(weights));
+
+	return (uint64) vaddv_u8(vget_low_u8(bits)) |
+		   ((uint64) vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+uint64
+_keys_eq_mask_neon(const uint8 * keys, int numBlocks, uint8 key)
+{
+	uint8x16_t k = vdupq_n_u8(key);
+	uint64 mask = 0;
+
+	for (int b = 0; b < numBlocks; b++)
+		mask |= _neon_movemask(vceqq_u8(vld1q_u8(keys + b * ART_KEY_BLOCK), k)) <<
+				(b * ART_KEY_BLOCK);
+
+	return mask;
+}
+
+uint64
+_keys_le_mask_neon(const uint8 * keys, int numBlocks, uint8 key)
+{
+	uint8x16_t k = vdupq_n_u8(key);
+	uint64 mask = 0;
+
+	for (int b = 0; b < numBlocks; b++)
+		mask |= _neon_movemask(vcleq_u8(vld1q_u8(keys + b * ART_KEY_BLOCK), k)) <<
+				(b * ART_KEY_BLOCK);
+
+	return mask;
+}
+#endif
+
+/*
+ * Choose key search kernels for CPU we are running on.
+ */
+void
+_art_select_key_kernels(void)
+{
+#if defined(__aarch64__)
+	art_key_kernels = &art_key_kernels_neon;
+#elif defined(__SSE2__)
+	art_key_kernels = &art_key_kernels_sse2;
+#ifdef ART_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		art_key_kernels = &art_key_kernels_avx2;
+#endif
+#endif
+
+	elog(DEBUG1, "ART key search kernels: %s", art_key_kernels->name);
+}
+
+/*
+ * Mask of key positions below numKeys.
+ */
+static inline uint64
+_keys_valid_mask(int numKeys)
+{
+	return numKeys >= 64 ? ~UINT64CONST(0) : (UINT64CONST(1) << numKeys) - 1;
+}
+
+/*
+ * Copy keys into block padded buffer, kernels may read past numKeys.
+ */
+static inline int
+_keys_load(uint8 * buf, const uint8 * keys, int numKeys)
+{
+	Assert(numKeys <= ART_KEY_BLOCK * ART_KEY_BLOCKS_MAX);
+
+	memcpy(buf, keys, numKeys);
+	return (numKeys + ART_KEY_BLOCK - 1) / ART_KEY_BLOCK;
+}
+
+/*
+ * Find index of key in keys, -1 if not found.
+ */
+int
+_art_keys_find(const uint8 * keys, int numKeys, uint8 key)
+{
+	uint8 buf[ART_KEY_BLOCK * ART_KEY_BLOCKS_MAX];
+	int num_blocks = _keys_load(buf, keys, numKeys);
+	uint64 mask = art_key_kernels->eq_mask(buf, num_blocks, key) &
+				  _keys_valid_mask(numKeys);
+
+	return mask ? pg_rightmost_one_pos64(mask) : -1;
+}
+
+/*
+ * Number of sorted keys less than key, that is insert position of key.
+ */
+int
+_art_keys_lower_bound(const uint8 * keys, int numKeys, uint8 key)
+{
+	uint8 buf[ART_KEY_BLOCK * ART_KEY_BLOCKS_MAX];
+	int num_blocks;
+
+	if (key == 0)
+		return 0;
+
+	num_blocks = _keys_load(buf, keys, numKeys);
+	return pg_popcount64(art_key_kernels->le_mask(buf, num_blocks, key - 1) &
+						 _keys_valid_mask(numKeys));
+}
+
+/*
+ * Number of sorted keys less or equal to key.
+ */
+int
+_art_keys_upper_bound(const uint8 * keys, int numKeys, uint8 key)
+{
+	uint8 buf[ART_KEY_BLOCK * ART_KEY_BLOCKS_MAX];
+	int num_blocks = _keys_load(buf, keys, numKeys);
+
+	return pg_popcount64(art_key_kernels->le_mask(buf, num_blocks, key) &
+						 _keys_valid_mask(numKeys));
+}
+
+/*
+ * Find child of in memory node.
+ */
 ItemPointer
 _art_find_child_equal(ArtNodeHeader * n, uint8 key)
 {
@@ -112,48 +417,17 @@ _art_find_child_equal(ArtNodeHeader * n, uint8 key)
 		case NODE_16:
 		{
 			ArtNode16 *node16 = (ArtNode16 *) n;
-			int mask, bitfield;
-
-// support non-86 architectures
-#ifdef __i386__
-			// Compare the key to all 16 stored keys
-			__m128i cmp;
-			cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c),
-					_mm_loadu_si128((__m128i*)p.p2->keys));
-			
-			// Use a mask to ignore children that don't exist
-			mask = (1 << n->num_children) - 1;
-			bitfield = _mm_movemask_epi8(cmp) & mask;
-#else
-#ifdef __amd64__
-			// Compare the key to all 16 stored keys
-			__m128i cmp;
-			cmp = _mm_cmpeq_epi8(_mm_set1_epi8(key),
-					_mm_loadu_si128((__m128i*)node16->keys));
-
-			// Use a mask to ignore children that don't exist
-			mask = (1 << n->num_children) - 1;
-			bitfield = _mm_movemask_epi8(cmp) & mask;
-#else
-			// Compare the key to all 16 stored keys
-			bitfield = 0;
-			for (i = 0; i < 16; ++i) {
-				if (p.p2->keys[i] == c)
-					bitfield |= (1 << i);
-			}
 
-			// Use a mask to ignore children that don't exist
-			mask = (1 << n->num_children) - 1;
-			bitfield &= mask;
-#endif
-#endif
-			/*
-			 * If we have a match (any bit set) then we can
-			 * return the pointer match using ctz to get
-			 * the index.
-			 */
-			if (bitfield)
-				return &node16->children[__builtin_ctz(bitfield)];
+			uint64 mask;
+
+			// keys[] is exactly one key block, no copy needed
+			StaticAssertStmt(sizeof(node16->keys) == ART_KEY_BLOCK,
+							 "NODE_16 keys must fill key block");
+
+			mask = art_key_kernels->eq_mask(node16->keys, 1, key) &
+				   _keys_valid_mask(n->num_children);
+			if (mask)
+				return &node16->children[pg_rightmost_one_pos64(mask)];
 		}
 		break;
 
@@ -179,353 +453,845 @@ _art_find_child_equal(ArtNodeHeader * n, uint8 key)
 }
 
 
-void
-_art_find_child_range(ArtNodeHeader * n, uint8 key,
-					  StrategyNumber skStrategy,
-					  pairingheap * childrenQueue,
-					  bool compare)
+/*
+ * Get key bytes and children of in memory node in key order. Arrays must
+ * have room for node children. Returns number of children.
+ */
+int
+_art_node_children(const ArtNodeHeader * n, uint8 * keys, ItemPointerData * children)
 {
-	int i;
+	const uint64 * present = NULL;
+	int num = 0;
+
 	switch (n->node_type)
 	{
 		case NODE_4:
-		{
-			ArtNode4 *node4 = (ArtNode4 *) n;
-			for (i = 0 ; i < n->num_children; i++)
-			{
-				uint8 child_key = node4->keys[i];
-				int32 cmp = 0;
-
-				if (!compare)
-				{
-					_art_add_queue_itemptr(childrenQueue, &node4->children[i], false);
-					continue;
-				}
-
- 				cmp = _art_compare_key(child_key, key);
-
-				if (skStrategy == BTLessStrategyNumber ||
-					skStrategy == BTLessEqualStrategyNumber)
-				{
-					if (cmp < 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node4->children[i], false);
-					}
-					else if (cmp == 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node4->children[i], true);
-					}
-					else
-					{
-						break;
-					}
-				}
-
-				else if (skStrategy == BTGreaterStrategyNumber ||
-						 skStrategy == BTGreaterEqualStrategyNumber)
-				{
-					if (cmp > 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node4->children[i], false);
-					}
-					else if (cmp == 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node4->children[i], true);
-					}
-					else
-					{
-						break;
-					}
-				}
-			}
-		}
-		break;
-
 		case NODE_16:
 		{
-			ArtNode16 *node16 = (ArtNode16 *) n;
-
-			for (i = 0 ; i < n->num_children; i++)
-			{
-				uint8 child_key = node16->keys[i];
-				int32 cmp = 0;
-
-				if (!compare)
-				{
-					_art_add_queue_itemptr(childrenQueue, &node16->children[i], false);
-					continue;
-				}
-
-				cmp = _art_compare_key(child_key, key);
-
-				if (skStrategy == BTLessStrategyNumber ||
-					skStrategy == BTLessEqualStrategyNumber)
-				{
-					if (cmp < 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node16->children[i], false);
-					}
-					else if (cmp == 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node16->children[i], true);
-					}
-					else
-					{
-						break;
-					}
-				}
-
-				else if (skStrategy == BTGreaterStrategyNumber ||
-						 skStrategy == BTGreaterEqualStrategyNumber)
-				{
-					if (cmp > 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node16->children[i], false);
-					}
-					else if (cmp == 0)
-					{
-						_art_add_queue_itemptr(childrenQueue, &node16->children[i], true);
-					}
-					else
-					{
-						break;
-					}
-				}
-			}
+			const uint8 * node_keys = n->node_type == NODE_4 ?
+				((const ArtNode4 *) n)->keys : ((const ArtNode16 *) n)->keys;
+			const ItemPointerData * node_children = n->node_type == NODE_4 ?
+				((const ArtNode4 *) n)->children : ((const ArtNode16 *) n)->children;
+
+			memcpy(keys, node_keys, n->num_children);
+			memcpy(children, node_children, sizeof(ItemPointerData) * n->num_children);
+			return n->num_children;
 		}
-		break;
 
 		case NODE_48:
-		{
-			ArtNode48 *node48 = (ArtNode48 *) n;
-			uint32 start = 0;
-			uint32 end = 256;
-
-			if (compare)
-			{
-				switch (skStrategy)
-				{
-					case BTLessStrategyNumber:
-					case BTLessEqualStrategyNumber:
-					{
-						end = key + 1;
-					}
-					break;
-
-					case BTGreaterStrategyNumber:
-					case BTGreaterEqualStrategyNumber:
-					{
-						start = key;
-					}
-					break;
-				}
-			}
-
-			for (i = start; i < end; i++)
-			{
-				if (node48->keys[i])
-					_art_add_queue_itemptr(childrenQueue, &node48->children[node48->keys[i]-1],
-										   compare ? i == key : false);
-			}
-		}
-		break;
+			present = ((const ArtNode48 *) n)->present;
+			break;
 
 		case NODE_256:
-		{
-			ArtNode256 *node256 = (ArtNode256 *) n;
-			uint32 start = 0;
-			uint32 end = 256;
-
-			if (compare)
-			{
-				switch (skStrategy)
-				{
-					case BTLessStrategyNumber:
-					case BTLessEqualStrategyNumber:
-					{
-						end = key + 1;
-					}
-					break;
-
-					case BTGreaterStrategyNumber:
-					case BTGreaterEqualStrategyNumber:
-					{
-						start = key;
-					}
-					break;
-				}
-			}
+			present = ((const ArtNode256 *) n)->present;
+			break;
 
-			for (i = start; i < end; i++)
-			{
-				if (ItemPointerIsValid(&node256->children[i]))
-					_art_add_queue_itemptr(childrenQueue, &node256->children[i],
-										   compare ? i == key : false);
-			}
-		}
-		break;
+		default:
+			elog(ERROR, "Invalid ART NODE");
 	}
-}
-
-ArtNodeHeader *
-_art_get_node_from_iptr(Relation index, ItemPointer iptr,
-					    Buffer * nodeBuffer, int bufferLockMode)
-{
-	Page page;
-	Offset off;
 
-	*nodeBuffer = ReadBuffer(index, ItemPointerGetBlockNumber(iptr));
-	LockBuffer(*nodeBuffer, bufferLockMode);
-	page = BufferGetPage(*nodeBuffer);
-	off = ItemPointerGetOffsetNumber(iptr);
+	for (int key = _art_key_bitmap_next(present, 0); key >= 0;
+		 key = _art_key_bitmap_next(present, key + 1))
+	{
+		keys[num] = key;
+		children[num++] = *_art_find_child_equal((ArtNodeHeader *) n, key);
+	}
 
-	return (ArtNodeHeader *) 
-		PageGetItem(page, PageGetItemId(page, off));
+	return num;
 }
 
-ArtNodeLeaf *
-_art_minimum_leaf(Relation index, ArtNodeHeader * n,
-				  HTAB * pageHashLookup, dlist_head * pageListHead)
+/*
+ * Remove child of key byte from in memory node. Node is not shrunk to
+ * smaller type.
+ */
+void
+_art_node_remove_child(ArtNodeHeader * n, uint8 key)
 {
-	int idx = 0;
-	ItemPointer iptr = NULL;
-	ArtNodeHeader * min_child_node;
-	Buffer next_node_buffer;
-
 	switch (n->node_type)
 	{
-		case NODE_LEAF:
-		{
-			return (ArtNodeLeaf *) n;
-		}
-
 		case NODE_4:
-		{
-			iptr = &(((ArtNode4*)n)->children[0]);
-			break;
-		}
-
 		case NODE_16:
 		{
-			iptr = &(((ArtNode16*)n)->children[0]);
+			uint8 * keys = n->node_type == NODE_4 ?
+				((ArtNode4 *) n)->keys : ((ArtNode16 *) n)->keys;
+			ItemPointerData * children = n->node_type == NODE_4 ?
+				((ArtNode4 *) n)->children : ((ArtNode16 *) n)->children;
+			int idx = _art_keys_find(keys, n->num_children, key);
+
+			if (idx < 0)
+				return;
+
+			memmove(keys + idx, keys + idx + 1, n->num_children - idx - 1);
+			memmove(children + idx, children + idx + 1,
+					sizeof(ItemPointerData) * (n->num_children - idx - 1));
+			n->num_children--;
 			break;
 		}
 
 		case NODE_48:
 		{
-			while (!((const ArtNode48*)n)->keys[idx])
-				idx++;
+			ArtNode48 * node48 = (ArtNode48 *) n;
+			int idx = node48->keys[key] - 1;
+
+			if (idx < 0)
+				return;
 
-			idx = ((const ArtNode48*)n)->keys[idx] - 1;
-			iptr = &(((ArtNode48*)n)->children[idx]);
+			ItemPointerSetInvalid(&node48->children[idx]);
+			node48->keys[key] = 0;
+			node48->used_slots &= ~(UINT64CONST(1) << idx);
+			ART_KEY_BITMAP_CLEAR(node48->present, key);
+			n->num_children--;
 			break;
 		}
 
 		case NODE_256:
 		{
-			while (!ItemPointerIsValid(&((const ArtNode256 *)n)->children[idx])) 
-				idx++;
+			ArtNode256 * node256 = (ArtNode256 *) n;
 
-			iptr = &(((ArtNode256*)n)->children[idx]);
-			break;
-		}
-	}
-
-	if (pageHashLookup)
-	{
-		BlockNumber node_block_number = ItemPointerGetBlockNumber(iptr);
-		BlockNumber node_offset = ItemPointerGetOffsetNumber(iptr);
-
-		ArtPageEntry * node_page = 
-			_art_get_page_hash(pageHashLookup, node_block_number);
+			if (!ART_KEY_BITMAP_TEST(node256->present, key))
+				return;
 
-		if (!node_page)
-		{
-			node_page = _art_copy_page(index, node_block_number);
-			dlist_push_head(pageListHead, &node_page->node);
-			_art_add_page_hash(pageHashLookup,
-							   node_block_number,
-							   node_page);
+			ItemPointerSetInvalid(&node256->children[key]);
+			ART_KEY_BITMAP_CLEAR(node256->present, key);
+			n->num_children--;
+			break;
 		}
 
-		min_child_node =
-			(ArtNodeHeader *) PageGetItem(node_page->page,
-									PageGetItemId(node_page->page, node_offset));
+		default:
+			elog(ERROR, "Invalid ART NODE");
 	}
-	else
-	{
-		min_child_node = 
-			_art_get_node_from_iptr(index, iptr, &next_node_buffer, BUFFER_LOCK_SHARE);
-	}
-
-	return _art_minimum_leaf(index, min_child_node, pageHashLookup, pageListHead);
 }
 
-
-int
-_art_leaf_matches(const ArtNodeLeaf * n, const uint8 * key, uint16 key_len)
+/*
+ * Decode child slot of page node into child item pointer.
+ */
+static inline void
+_page_node_child(const ArtNodeHeader * n, BlockNumber blkNum, uint16 slot,
+				 ItemPointer child)
 {
-	if (n->key_len != key_len )
-		return 1;
-
-	return memcmp(n->data, key, key_len);
+	if (ART_SLOT_IS_FAR(slot))
+		*child = ART_PAGE_NODE_FAR(n)[ART_SLOT_FAR_INDEX(slot)];
+	else
+		ItemPointerSet(child, blkNum, slot);
 }
 
-int
-_art_longest_common_prefix(ArtNodeLeaf *l1, ArtNodeLeaf *l2, int depth)
+/*
+ * Find index of key in sorted keys of page node, -1 if not found.
+ */
+static inline int
+_page_node_find_index(const ArtNodeHeader * n, uint8 key)
 {
-	int max_cmp = Min(l1->key_len, l2->key_len) - depth;
-	int idx;
+	const uint8 * keys = ((const ArtPageNodeSorted *) n)->keys;
+	int num_children = n->num_children;
 
-	for (idx = 0; idx < max_cmp; idx++)
+	switch (n->node_type)
 	{
-		if (l1->data[depth + idx] != l2->data[depth + idx])
-			return idx;
-	}
-
-	return idx;
+		case NODE_4:
+			for (int i = 0; i < num_children; i++)
+			{
+				if (keys[i] == key)
+					return i;
+			}
+			break;
+
+		case NODE_16:
+		case NODE_48:
+			return _art_keys_find(keys, num_children, key);
+	}
+
+	return -1;
 }
 
+/*
+ * Find child of page node stored at block blkNum. Returns false if there
+ * is no child for key.
+ */
+bool
+_art_page_node_find_child(const ArtNodeHeader * n, BlockNumber blkNum, uint8 key,
+						  ItemPointer child)
+{
+	uint16 slot = ART_SLOT_EMPTY;
 
-int
-_art_prefix_mismatch(Relation index, ArtNodeHeader *node,
-					 HTAB * pageHashLookup, dlist_head * pageHeadList,
-					 const uint8 *key, uint32 key_len, int depth)
+	if (n->node_type == NODE_256)
+		slot = ((const ArtPageNode256 *) n)->children[key];
+	else
+	{
+		int i = _page_node_find_index(n, key);
+
+		if (i >= 0)
+			slot = ART_PAGE_NODE_SLOTS(n)[i];
+	}
+
+	if (slot == ART_SLOT_EMPTY)
+		return false;
+
+	_page_node_child(n, blkNum, slot, child);
+	return true;
+}
+
+
+/*
+ * Queue child of page node if its key byte is inside of scan range.
+ * Children equal to scan key byte need to be compared further.
+ */
+static inline void
+_queue_child_range(pairingheap * childrenQueue,
+				   const ArtNodeHeader * n, BlockNumber blkNum, uint16 slot,
+				   uint8 childKey, uint8 key, StrategyNumber skStrategy,
+				   bool compare)
 {
+	ItemPointerData child;
+	int32 cmp = 0;
 
-	int max_cmp = Min(Min(MAX_PREFIX_KEY_LEN, node->prefix_key_len), key_len - depth);
-	int idx;
-	for (idx = 0; idx < max_cmp; idx++)
+	if (compare)
 	{
-		if (node->prefix[idx] != key[depth+idx])
-			return idx;
+		cmp = _art_compare_key(childKey, key);
+
+		if (((skStrategy == BTLessStrategyNumber ||
+			  skStrategy == BTLessEqualStrategyNumber) && cmp > 0) ||
+			((skStrategy == BTGreaterStrategyNumber ||
+			  skStrategy == BTGreaterEqualStrategyNumber) && cmp < 0))
+			return;
 	}
 
-	if (node->prefix_key_len > MAX_PREFIX_KEY_LEN)
+	_page_node_child(n, blkNum, slot, &child);
+	_art_add_queue_itemptr(childrenQueue, &child, compare && cmp == 0);
+}
+
+void
+_art_find_child_range(const ArtNodeHeader * n, BlockNumber blkNum, uint8 key,
+					  StrategyNumber skStrategy,
+					  pairingheap * childrenQueue,
+					  bool compare)
+{
+	int i;
+
+	if (n->node_type == NODE_256)
 	{
-		ArtNodeLeaf *l = _art_minimum_leaf(index, node, pageHashLookup, pageHeadList);
-		max_cmp = Min(l->key_len, key_len)- depth;
-		for (; idx < max_cmp; idx++)
+		const ArtPageNode256 *node256 = (const ArtPageNode256 *) n;
+		bool less = skStrategy == BTLessStrategyNumber ||
+					skStrategy == BTLessEqualStrategyNumber;
+
+		// Children outside of range are skipped without visiting their slots
+		for (i = _art_key_bitmap_next(node256->present, compare && !less ? key : 0);
+			 i >= 0 && !(compare && less && i > key);
+			 i = _art_key_bitmap_next(node256->present, i + 1))
+			_queue_child_range(childrenQueue, n, blkNum, node256->children[i],
+							   i, key, skStrategy, compare);
+	}
+	else
+	{
+		const ArtPageNodeSorted *sorted = (const ArtPageNodeSorted *) n;
+		const uint16 *slots = ART_PAGE_NODE_SLOTS(n);
+		int first = 0;
+		int last = n->num_children;
+
+		// Keys are sorted, range bound gives slice of children to visit
+		if (compare)
 		{
-			if (l->data[idx+depth] != key[depth+idx])
-				return idx;
+			if (skStrategy == BTLessStrategyNumber ||
+				skStrategy == BTLessEqualStrategyNumber)
+				last = _art_keys_upper_bound(sorted->keys, n->num_children, key);
+			else
+				first = _art_keys_lower_bound(sorted->keys, n->num_children, key);
 		}
+
+		for (i = first; i < last; i++)
+			_queue_child_range(childrenQueue, n, blkNum, slots[i],
+							   sorted->keys[i], key, skStrategy, compare);
 	}
-	return idx;
 }
 
 
+/*
+ * Get size of page node body without far child table and prefix.
+ */
+Size
+_art_page_node_body_size(const ArtNodeHeader * node)
+{
+	switch (node->node_type)
+	{
+	case NODE_4:
+	case NODE_16:
+	case NODE_48:
+		return offsetof(ArtPageNodeSorted, keys) +
+			   TYPEALIGN(sizeof(uint16), node->num_children) +
+			   node->num_children * sizeof(uint16);
+	case NODE_256:
+		return sizeof(ArtPageNode256);
+	default:
+		elog(ERROR, "Invalid ART NODE");
+	}
+
+	return 0;
+}
+
+/*
+ * Get children array and its length of in memory node.
+ */
+static inline ItemPointerData *
+_node_children(const ArtNodeHeader * node, int * nchildren)
+{
+	switch (node->node_type)
+	{
+	case NODE_4:
+		*nchildren = 4;
+		return ((ArtNode4 *) node)->children;
+	case NODE_16:
+		*nchildren = 16;
+		return ((ArtNode16 *) node)->children;
+	case NODE_48:
+		*nchildren = 48;
+		return ((ArtNode48 *) node)->children;
+	case NODE_256:
+		*nchildren = 256;
+		return ((ArtNode256 *) node)->children;
+	default:
+		elog(ERROR, "Invalid ART NODE");
+	}
+
+	return NULL;
+}
+
+/*
+ * Child referenced by page local offset, inline TIDs are always far.
+ */
+static inline bool
+_child_is_local(ItemPointer child, BlockNumber blkNum)
+{
+	return BlockNumberIsValid(blkNum) &&
+		   !ART_CHILD_IS_INLINE(child) &&
+		   ItemPointerGetBlockNumberNoCheck(child) == blkNum;
+}
+
+/*
+ * Get page item size of in memory node once stored at block blkNum.
+ * With invalid block all children are counted as far, which is upper
+ * bound of size on any page.
+ */
+Size
+_art_page_node_size(const ArtNodeHeader * node, BlockNumber blkNum)
+{
+	ItemPointerData * children;
+	int nchildren;
+	int nfar = 0;
+
+	if (node->node_type == NODE_LEAF || node->node_type == NODE_BUCKET)
+		return _art_node_size((ArtNodeHeader *) node);
+
+	children = _node_children(node, &nchildren);
+
+	if (node->flags & ART_NODE_RESERVED)
+		nfar = nchildren;
+	else if (node->node_type == NODE_256)
+	{
+		const uint64 * present = ((const ArtNode256 *) node)->present;
+
+		for (int i = _art_key_bitmap_next(present, 0); i >= 0;
+			 i = _art_key_bitmap_next(present, i + 1))
+		{
+			if (!_child_is_local(&children[i], blkNum))
+				nfar++;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < nchildren; i++)
+		{
+			if (ItemPointerIsValid(&children[i]) && !_child_is_local(&children[i], blkNum))
+				nfar++;
+		}
+	}
+
+	return _art_page_node_body_size(node) +
+		   nfar * sizeof(ItemPointerData) + node->prefix_key_len;
+}
+
+/*
+ * Encode child of node being encoded into page slot.
+ */
+static inline uint16
+_page_node_slot(ArtNodeHeader * pageNode, BlockNumber blkNum, ItemPointer child)
+{
+	if (!ItemPointerIsValid(child))
+		return ART_SLOT_EMPTY;
+
+	if (_child_is_local(child, blkNum))
+		return ItemPointerGetOffsetNumber(child);
+
+	ART_PAGE_NODE_FAR(pageNode)[pageNode->num_far] = *child;
+	return ART_SLOT_FAR | pageNode->num_far++;
+}
+
+/*
+ * Encode in memory node into page form for block blkNum. Children on
+ * same block are referenced by offset, others by far table.
+ */
+ArtNodeHeader *
+_art_page_node_encode(const ArtNodeHeader * node, BlockNumber blkNum)
+{
+	ArtNodeHeader * page_node;
+	ItemPointerData * children;
+	uint8 * keys;
+	uint16 * slots;
+	int nchildren;
+	int i;
+
+	if (node->node_type == NODE_LEAF || node->node_type == NODE_BUCKET)
+		return (ArtNodeHeader *) node;
+
+	page_node = (ArtNodeHeader *) palloc0(_art_page_node_size(node, blkNum));
+	page_node->node_type = node->node_type;
+	page_node->flags = node->flags;
+	page_node->num_children = node->num_children;
+	page_node->prefix_key_len = node->prefix_key_len;
+	page_node->num_far = 0;
+
+	children = _node_children(node, &nchildren);
+	keys = ((ArtPageNodeSorted *) page_node)->keys;
+	slots = ART_PAGE_NODE_SLOTS(page_node);
+
+	switch (node->node_type)
+	{
+	case NODE_4:
+	case NODE_16:
+		memcpy(keys, node->node_type == NODE_4 ? ((ArtNode4 *) node)->keys :
+			   ((ArtNode16 *) node)->keys, node->num_children);
+
+		for (i = 0; i < node->num_children; i++)
+			slots[i] = _page_node_slot(page_node, blkNum, &children[i]);
+		break;
+	case NODE_48:
+	{
+		const ArtNode48 * node48 = (const ArtNode48 *) node;
+
+		i = 0;
+		for (int key = _art_key_bitmap_next(node48->present, 0); key >= 0;
+			 key = _art_key_bitmap_next(node48->present, key + 1))
+		{
+			keys[i] = key;
+			slots[i++] = _page_node_slot(page_node, blkNum,
+										 &children[node48->keys[key] - 1]);
+		}
+		break;
+	}
+	default:
+	{
+		const uint64 * present = ((const ArtNode256 *) node)->present;
+
+		slots = ((ArtPageNode256 *) page_node)->children;
+		memcpy(((ArtPageNode256 *) page_node)->present, present,
+			   sizeof(((ArtPageNode256 *) page_node)->present));
+
+		for (i = _art_key_bitmap_next(present, 0); i >= 0;
+			 i = _art_key_bitmap_next(present, i + 1))
+			slots[i] = _page_node_slot(page_node, blkNum, &children[i]);
+		break;
+	}
+	}
+
+	memcpy(ART_PAGE_NODE_PREFIX(page_node), ART_NODE_PREFIX(node), node->prefix_key_len);
+
+	return page_node;
+}
+
+/*
+ * Set child of key in page node stored at block blkNum in place, key is
+ * added to NODE_256 if add is set. Returns false without changing node if
+ * slot can't be set keeping item size and other slots, node is encoded
+ * again then. Caller is in critical section.
+ */
+bool
+_art_page_node_set_child(ArtNodeHeader * pageNode, BlockNumber blkNum, uint8 key,
+						 ItemPointer child, bool add)
+{
+	bool local = _child_is_local(child, blkNum);
+	uint16 * slot = NULL;
+
+	if (!ItemPointerIsValid(child))
+		return false;
+
+	switch (pageNode->node_type)
+	{
+	case NODE_4:
+	case NODE_16:
+	case NODE_48:
+	{
+		const uint8 * keys = ((ArtPageNodeSorted *) pageNode)->keys;
+
+		// Adding key to sorted form shifts keys and slots after it
+		if (add)
+			return false;
+
+		for (int i = 0; i < pageNode->num_children; i++)
+		{
+			if (keys[i] == key)
+			{
+				slot = &ART_PAGE_NODE_SLOTS(pageNode)[i];
+				break;
+			}
+		}
+		break;
+	}
+	case NODE_256:
+	{
+		ArtPageNode256 * page_node256 = (ArtPageNode256 *) pageNode;
+
+		if (ART_KEY_BITMAP_TEST(page_node256->present, key) == add)
+			return false;
+
+		// New far child would need far table entry
+		if (add && !local)
+			return false;
+
+		slot = &page_node256->children[key];
+
+		if (add)
+		{
+			ART_KEY_BITMAP_SET(page_node256->present, key);
+			pageNode->num_children++;
+			*slot = ItemPointerGetOffsetNumber(child);
+			return true;
+		}
+		break;
+	}
+	default:
+		return false;
+	}
+
+	if (slot == NULL || ART_SLOT_IS_FAR(*slot) == local)
+		return false;
+
+	if (local)
+		*slot = ItemPointerGetOffsetNumber(child);
+	else
+		ART_PAGE_NODE_FAR(pageNode)[ART_SLOT_FAR_INDEX(*slot)] = *child;
+
+	return true;
+}
+
+/*
+ * Decode page node stored at block blkNum into palloc'd in memory node.
+ */
+ArtNodeHeader *
+_art_page_node_decode(const ArtNodeHeader * pageNode, BlockNumber blkNum)
+{
+	ArtNodeHeader * node;
+	ItemPointerData * children;
+	const uint8 * keys = ((const ArtPageNodeSorted *) pageNode)->keys;
+	const uint16 * slots = ART_PAGE_NODE_SLOTS(pageNode);
+	int nchildren;
+
+	// Bucket has no separate page form
+	if (pageNode->node_type == NODE_BUCKET)
+	{
+		Size size = _art_bucket_size(pageNode);
+
+		node = (ArtNodeHeader *) palloc(size);
+		memcpy(node, pageNode, size);
+		return node;
+	}
+
+	node = _art_alloc_node(pageNode->node_type, pageNode->prefix_key_len);
+	node->flags = pageNode->flags;
+	node->num_children = pageNode->num_children;
+
+	children = _node_children(node, &nchildren);
+
+	switch (node->node_type)
+	{
+	case NODE_4:
+	case NODE_16:
+		memcpy(node->node_type == NODE_4 ? ((ArtNode4 *) node)->keys :
+			   ((ArtNode16 *) node)->keys, keys, node->num_children);
+
+		for (int i = 0; i < node->num_children; i++)
+			_page_node_child(pageNode, blkNum, slots[i], &children[i]);
+		break;
+	case NODE_48:
+	{
+		ArtNode48 * node48 = (ArtNode48 *) node;
+
+		for (int i = 0; i < node->num_children; i++)
+		{
+			node48->keys[keys[i]] = i + 1;
+			ART_KEY_BITMAP_SET(node48->present, keys[i]);
+			_page_node_child(pageNode, blkNum, slots[i], &children[i]);
+		}
+
+		node48->used_slots = (UINT64CONST(1) << node->num_children) - 1;
+		break;
+	}
+	default:
+	{
+		const ArtPageNode256 * page_node256 = (const ArtPageNode256 *) pageNode;
+
+		memcpy(((ArtNode256 *) node)->present, page_node256->present,
+			   sizeof(page_node256->present));
+
+		for (int i = _art_key_bitmap_next(page_node256->present, 0); i >= 0;
+			 i = _art_key_bitmap_next(page_node256->present, i + 1))
+			_page_node_child(pageNode, blkNum, page_node256->children[i], &children[i]);
+		break;
+	}
+	}
+
+	memcpy(ART_NODE_PREFIX(node), ART_PAGE_NODE_PREFIX(pageNode), node->prefix_key_len);
+
+	return node;
+}
+
+
+ArtNodeHeader *
+_art_get_node_from_iptr(Relation index, ItemPointer iptr,
+					    Buffer * nodeBuffer, int bufferLockMode)
+{
+	Page page;
+
+	*nodeBuffer = ReadBuffer(index, ItemPointerGetBlockNumber(iptr));
+	LockBuffer(*nodeBuffer, bufferLockMode);
+	page = BufferGetPage(*nodeBuffer);
+
+	return _art_page_get_node(index, page, iptr);
+}
+
+/*
+ * Get node or leaf item of iptr on locked page. Removed items stay on page
+ * while scans may hold pointers to them, so missing item means corruption.
+ */
+ArtNodeHeader *
+_art_page_get_node(Relation index, Page page, ItemPointer iptr)
+{
+	OffsetNumber off = ItemPointerGetOffsetNumber(iptr);
+	ItemId item_id;
+	ArtNodeHeader * node;
+
+	if (off < FirstOffsetNumber || off > PageGetMaxOffsetNumber(page) ||
+		!ItemIdHasStorage(item_id = PageGetItemId(page, off)))
+		elog(ERROR, "ART index \"%s\" has no item at (%u,%u)",
+			 RelationGetRelationName(index),
+			 ItemPointerGetBlockNumber(iptr), off);
+
+	node = (ArtNodeHeader *) PageGetItem(page, item_id);
+
+	if (node->node_type > NODE_BUCKET)
+		elog(ERROR, "ART index \"%s\" has invalid item at (%u,%u)",
+			 RelationGetRelationName(index),
+			 ItemPointerGetBlockNumber(iptr), off);
+
+	return node;
+}
+
+/*
+ * Compare leaf key with key. Leaf stores only key suffix, bytes before
+ * its key offset are implied by path and are equal for any key reaching
+ * the leaf.
+ */
+int32
+_art_leaf_compare(const ArtNodeLeaf * n, const uint8 * key, uint16 key_len)
+{
+	int key_suffix_len = (int) key_len - n->key_offset;
+	int32 cmp;
+
+	cmp = memcmp(n->data, key + n->key_offset, Max(Min(n->key_len, key_suffix_len), 0));
+
+	if (cmp != 0)
+		return cmp;
+
+	return (int32) ART_LEAF_KEY_LEN(n) - (int32) key_len;
+}
+
 int
-_art_check_prefix(const ArtNodeHeader *n, const uint8 *key, int key_len, int depth)
+_art_leaf_matches(const ArtNodeLeaf * n, const uint8 * key, uint16 key_len)
 {
-	int max_cmp = Min(Min(n->prefix_key_len, MAX_PREFIX_KEY_LEN), key_len - depth);
-	int idx;
+	if (ART_LEAF_KEY_LEN(n) != key_len)
+		return 1;
+
+	return memcmp(n->data, key + n->key_offset, n->key_len);
+}
 
-	for (idx = 0; idx < max_cmp; idx++)
+/*
+ * Number of equal leading bytes of a and b, compared word at a time.
+ */
+static inline int
+_common_prefix_len(const uint8 * a, const uint8 * b, int len)
+{
+	int idx = 0;
+
+	for (; idx + (int) sizeof(uint64) <= len; idx += sizeof(uint64))
+	{
+		uint64 wa;
+		uint64 wb;
+
+		memcpy(&wa, a + idx, sizeof(uint64));
+		memcpy(&wb, b + idx, sizeof(uint64));
+
+		if (wa != wb)
+		{
+#ifdef WORDS_BIGENDIAN
+			return idx + (63 - pg_leftmost_one_pos64(wa ^ wb)) / 8;
+#else
+			return idx + pg_rightmost_one_pos64(wa ^ wb) / 8;
+#endif
+		}
+	}
+
+	for (; idx < len; idx++)
 	{
-		if (n->prefix[idx] != key[depth+idx])
-			return idx;
+		if (a[idx] != b[idx])
+			break;
 	}
 
 	return idx;
 }
+
+int
+_art_longest_common_prefix(const ArtNodeLeaf *l, const uint8 *key, int key_len, int depth)
+{
+	int max_cmp = Min(ART_LEAF_KEY_LEN(l), key_len) - depth;
+
+	Assert(depth >= l->key_offset);
+
+	return _common_prefix_len(&ART_LEAF_KEY_BYTE(l, depth), key + depth, Max(max_cmp, 0));
+}
+
+
+/*
+ * Return number of prefix bytes of node matching key at depth. Full
+ * prefix is stored in node so no leaf has to be visited.
+ */
+int
+_art_check_prefix(const uint8 *prefix, int prefix_len,
+				  const uint8 *key, int key_len, int depth)
+{
+	int max_cmp = Min(prefix_len, key_len - depth);
+
+	return _common_prefix_len(prefix, key + depth, Max(max_cmp, 0));
+}
+
+
+/*
+ * Get size of bucket, entries are stored in key order so last entry
+ * ends the item.
+ */
+Size
+_art_bucket_size(const ArtNodeHeader * bucket)
+{
+	const ArtBucketEntry * last;
+
+	Assert(bucket->num_children > 0);
+
+	last = ART_BUCKET_ENTRY(bucket, bucket->num_children - 1);
+
+	return ART_BUCKET_OFFSETS(bucket)[bucket->num_children - 1] +
+		   ART_BUCKET_ENTRY_SIZE(last->key_len);
+}
+
+/*
+ * Get size of bucket built from sorted items, skip bytes of each item key
+ * are covered by depth and prefix.
+ */
+Size
+_art_bucket_build_size(uint16 prefixLen, const ArtBucketItem * items, int nitems, int skip)
+{
+	Size size = SHORTALIGN(sizeof(ArtNodeHeader) + nitems * sizeof(uint16) + prefixLen);
+
+	for (int i = 0; i < nitems; i++)
+		size += ART_BUCKET_ENTRY_SIZE(items[i].key_len - skip);
+
+	return size;
+}
+
+/*
+ * Build palloc'd bucket from sorted items.
+ */
+ArtNodeHeader *
+_art_bucket_build(const uint8 * prefix, uint16 prefixLen,
+				  const ArtBucketItem * items, int nitems, int skip)
+{
+	ArtNodeHeader * bucket;
+	uint16 * offsets;
+	Size off;
+
+	bucket = (ArtNodeHeader *) palloc0(_art_bucket_build_size(prefixLen, items,
+															   nitems, skip));
+	bucket->node_type = NODE_BUCKET;
+	bucket->num_children = nitems;
+	bucket->prefix_key_len = prefixLen;
+
+	offsets = ART_BUCKET_OFFSETS(bucket);
+	memcpy(ART_BUCKET_PREFIX(bucket), prefix, prefixLen);
+
+	off = SHORTALIGN(sizeof(ArtNodeHeader) + nitems * sizeof(uint16) + prefixLen);
+
+	for (int i = 0; i < nitems; i++)
+	{
+		ArtBucketEntry * entry = (ArtBucketEntry *) ((char *) bucket + off);
+
+		offsets[i] = off;
+		entry->child = items[i].child;
+		entry->key_len = items[i].key_len - skip;
+		memcpy(entry->key, items[i].key + skip, entry->key_len);
+
+		off += ART_BUCKET_ENTRY_SIZE(entry->key_len);
+	}
+
+	return bucket;
+}
+
+/*
+ * Compare key of bucket entry i, that is bucket prefix followed by entry
+ * suffix, with key bytes starting at depth.
+ */
+int32
+_art_bucket_compare(const ArtNodeHeader * bucket, int i,
+					const uint8 * key, int key_len, int depth)
+{
+	const ArtBucketEntry * entry = ART_BUCKET_ENTRY(bucket, i);
+	int prefix_len = bucket->prefix_key_len;
+	int rest = key_len - depth;
+	int32 cmp;
+
+	cmp = memcmp(ART_BUCKET_PREFIX(bucket), key + depth, Min(prefix_len, rest));
+
+	if (cmp == 0 && rest > prefix_len)
+		cmp = memcmp(entry->key, key + depth + prefix_len,
+					 Min(entry->key_len, rest - prefix_len));
+
+	if (cmp != 0)
+		return cmp;
+
+	return (prefix_len + entry->key_len) - rest;
+}
+
+/*
+ * Binary search key in bucket. Returns index of matching entry, or index
+ * where key would be inserted if there is none.
+ */
+int
+_art_bucket_find(const ArtNodeHeader * bucket, const uint8 * key, int key_len,
+				 int depth, bool * found)
+{
+	int low = 0;
+	int high = bucket->num_children;
+
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		int32 cmp = _art_bucket_compare(bucket, mid, key, key_len, depth);
+
+		if (cmp == 0)
+		{
+			*found = true;
+			return mid;
+		}
+
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	*found = false;
+	return low;
+}
@@ -3,6 +3,24 @@
  * artvacuum.c
  *		ART VACUUM functions.
  *
+ * Index pages are swept in physical block order instead of walking the
+ * tree, so that reads are sequential and can be prefetched. Dead TIDs are
+ * removed from leaf posting lists, bitmap containers and inline children
+ * of nodes and buckets, items are rewritten in place. Tree structure is
+ * not changed by the sweep, VACUUM cleanup then walks the tree to remove
+ * empty leaves and nodes, shrink nodes and collapse single child paths.
+ *
+ * Inserts run during sweep and may move items to pages that were already
+ * swept, like nbtree page splits. Bulk delete starts a vacuum cycle, and
+ * inserts stamp pages they move items to with the cycle and list them on
+ * metadata page. Sweep visits listed pages again until list stays empty,
+ * last round blocks inserts. Cycle starts and ends while bulk delete holds
+ * metadata page lock tag exclusively, inserts hold it in share mode.
+ *
+ * Pending list of fast inserts is merged into tree when cycle starts.
+ * Entries added later have TIDs bulk delete doesn't remove, entries of
+ * pages merge left behind are vacuumed there.
+ *
  *-------------------------------------------------------------------------
  */
 
@@ -16,20 +34,745 @@
 #include "storage/bufmgr.h"
 #include "storage/indexfsm.h"
 #include "storage/lmgr.h"
+#include "utils/memutils.h"
 
 #include "art.h"
 
+typedef struct ArtVacuumState
+{
+	IndexVacuumInfo * info;
+	IndexBulkDeleteResult * stats;
+	IndexBulkDeleteCallback callback;	/* NULL when only counting */
+	void * callback_state;
+	uint16 cycle;						/* vacuum cycle of bulk delete */
+	MemoryContext page_ctx;				/* reset after each page */
+} ArtVacuumState;
+
+/* Rounds of revisiting listed pages before inserts are blocked */
+#define ART_VACUUM_ROUNDS 3
+
+static uint16 _art_vacuum_start_cycle(Relation index);
+static int _art_vacuum_take_blks(Relation index, BlockNumber * blks, bool endCycle);
+static void _art_vacuum_revisit(ArtVacuumState * vs);
+static void _art_vacuum_scan(ArtVacuumState * vs);
+static void _art_vacuum_block(ArtVacuumState * vs, BlockNumber blk);
+static bool _art_vacuum_page(ArtVacuumState * vs, BlockNumber blkNum, Page page);
+static bool _art_vacuum_bitmap_page(ArtVacuumState * vs, Page page);
+static bool _art_vacuum_pending_page(ArtVacuumState * vs, Page page);
+static bool _art_vacuum_leaf(ArtVacuumState * vs, Page page, OffsetNumber off,
+							 ArtNodeLeaf * leaf);
+static bool _art_vacuum_node(ArtVacuumState * vs, BlockNumber blkNum, Page page,
+							 OffsetNumber off, ArtNodeHeader * pageNode);
+static bool _art_vacuum_bucket(ArtVacuumState * vs, Page page, OffsetNumber off,
+							   ArtNodeHeader * bucket);
+static bool _art_tid_is_dead(ArtVacuumState * vs, ItemPointer tid);
+static void _art_vacuum_page_cache(Relation index, BlockNumber blkNum, Page page);
+static int _art_blk_cmp(const void * a, const void * b);
+
 
 IndexBulkDeleteResult *
 artbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 			  IndexBulkDeleteCallback callback, void *callback_state)
 {
-	return NULL;
+	ArtVacuumState vs;
+
+	// Index built with other format is not vacuumed
+	_art_get_metadata_flags(info->index);
+
+	if (stats == NULL)
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+	vs.info = info;
+	vs.stats = stats;
+	vs.callback = callback;
+	vs.callback_state = callback_state;
+
+	// Cycle left by failed bulk delete is replaced here, inserts only
+	// stamped pages for it meanwhile
+	vs.cycle = _art_vacuum_start_cycle(info->index);
+
+	_art_vacuum_scan(&vs);
+
+	_art_vacuum_revisit(&vs);
+
+	return stats;
 }
 
 
 IndexBulkDeleteResult *
 artvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
 {
-	return NULL;
+	ArtVacuumState vs;
+
+	if (info->analyze_only)
+		return stats;
+
+	_art_get_metadata_flags(info->index);
+
+	// No bulk delete in this VACUUM, just count index tuples
+	if (stats == NULL)
+	{
+		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
+
+		vs.info = info;
+		vs.stats = stats;
+		vs.callback = NULL;
+		vs.callback_state = NULL;
+		vs.cycle = 0;
+
+		_art_pending_merge(info->index, false);
+
+		_art_vacuum_scan(&vs);
+
+		return stats;
+	}
+
+	// Bulk delete removed TIDs, remove structure left empty. Walk keeps
+	// root locked, which blocks tree inserts anyway, tag lock also keeps
+	// out inserts through jump nodes that would lock pages in other order.
+	LockPage(info->index, ART_METADATA_NODE_BLKNO, ExclusiveLock);
+
+	_art_cleanup_tree(info->index);
+
+	UnlockPage(info->index, ART_METADATA_NODE_BLKNO, ExclusiveLock);
+
+	stats->num_pages = RelationGetNumberOfBlocks(info->index);
+
+	return stats;
+}
+
+/*
+ * Start vacuum cycle. Inserts running before are waited for, so items
+ * they moved are in place before sweep, and pending list entries added
+ * before are merged.
+ */
+uint16
+_art_vacuum_start_cycle(Relation index)
+{
+	uint16 cycle = 0;
+
+	LockPage(index, ART_METADATA_NODE_BLKNO, ExclusiveLock);
+
+	_art_pending_merge(index, true);
+
+	_art_xlog_begin(index);
+
+	PG_TRY();
+	{
+		Buffer buffer = _art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+		ArtMetaDataPageOpaque metadata =
+			(ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer));
+
+		// Zero means no cycle, pages stamped by cycles long ago are cleared
+		// by sweep
+		cycle = metadata->last_vacuum_cycle + 1;
+		if (cycle == 0)
+			cycle = 1;
+
+		START_CRIT_SECTION();
+		metadata->vacuum_cycle = cycle;
+		metadata->last_vacuum_cycle = cycle;
+		metadata->num_vacuum_blks = 0;
+		END_CRIT_SECTION();
+
+		_art_xlog_release_buffer(buffer);
+
+		_art_xlog_finish();
+	}
+	PG_CATCH();
+	{
+		_art_xlog_abort();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	UnlockPage(index, ART_METADATA_NODE_BLKNO, ExclusiveLock);
+
+	return cycle;
+}
+
+/*
+ * Take pages listed by inserts since last call, sorted, and clear list.
+ * Returns number of pages, or -1 if list overflowed. Cycle ends if
+ * endCycle is set.
+ */
+int
+_art_vacuum_take_blks(Relation index, BlockNumber * blks, bool endCycle)
+{
+	int num_blks = 0;
+
+	_art_xlog_begin(index);
+
+	PG_TRY();
+	{
+		Buffer buffer = _art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+		ArtMetaDataPageOpaque metadata =
+			(ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(buffer));
+
+		if (metadata->num_vacuum_blks == ART_VACUUM_BLKS_OVERFLOW)
+			num_blks = -1;
+		else
+		{
+			num_blks = metadata->num_vacuum_blks;
+			memcpy(blks, metadata->vacuum_blks, sizeof(BlockNumber) * num_blks);
+		}
+
+		START_CRIT_SECTION();
+		metadata->num_vacuum_blks = 0;
+		if (endCycle)
+			metadata->vacuum_cycle = 0;
+		END_CRIT_SECTION();
+
+		_art_xlog_release_buffer(buffer);
+
+		_art_xlog_finish();
+	}
+	PG_CATCH();
+	{
+		_art_xlog_abort();
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (num_blks > 1)
+		qsort(blks, num_blks, sizeof(BlockNumber), _art_blk_cmp);
+
+	return num_blks;
+}
+
+/*
+ * Visit pages listed by inserts during sweep again. Their TIDs were
+ * counted where inserts moved them from. Last round holds inserts off,
+ * so that nothing is moved behind it.
+ */
+void
+_art_vacuum_revisit(ArtVacuumState * vs)
+{
+	Relation index = vs->info->index;
+	double num_index_tuples = vs->stats->num_index_tuples;
+	BlockNumber blks[ART_VACUUM_BLKS];
+
+	vs->page_ctx = AllocSetContextCreate(CurrentMemoryContext,
+										 "ART vacuum page context",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	for (int round = 0; round <= ART_VACUUM_ROUNDS; round++)
+	{
+		bool last = round == ART_VACUUM_ROUNDS;
+		int num_blks;
+
+		if (last)
+			LockPage(index, ART_METADATA_NODE_BLKNO, ExclusiveLock);
+
+		num_blks = _art_vacuum_take_blks(index, blks, last);
+
+		if (num_blks < 0)
+		{
+			BlockNumber num_blocks = RelationGetNumberOfBlocks(index);
+
+			for (BlockNumber blk = ART_METADATA_NODE_BLKNO + 1; blk < num_blocks; blk++)
+				_art_vacuum_block(vs, blk);
+		}
+		else
+		{
+			for (int i = 0; i < num_blks; i++)
+			{
+				if (i == 0 || blks[i] != blks[i - 1])
+					_art_vacuum_block(vs, blks[i]);
+			}
+		}
+
+		if (last)
+			UnlockPage(index, ART_METADATA_NODE_BLKNO, ExclusiveLock);
+		else if (num_blks == 0)
+			round = ART_VACUUM_ROUNDS - 1;
+	}
+
+	vs->stats->num_index_tuples = num_index_tuples;
+
+	MemoryContextDelete(vs->page_ctx);
+}
+
+/*
+ * Sweep all index pages in block order. Blocks ahead of current one are
+ * prefetched up to maintenance_io_concurrency. Pages added during sweep
+ * only get items moved from elsewhere, and are listed then.
+ */
+void
+_art_vacuum_scan(ArtVacuumState * vs)
+{
+	Relation index = vs->info->index;
+	BlockNumber num_blocks = RelationGetNumberOfBlocks(index);
+	BlockNumber prefetch_blk = ART_METADATA_NODE_BLKNO + 1;
+
+	vs->page_ctx = AllocSetContextCreate(CurrentMemoryContext,
+										 "ART vacuum page context",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	vs->stats->num_index_tuples = 0;
+	vs->stats->estimated_count = false;
+
+	for (BlockNumber blk = ART_METADATA_NODE_BLKNO + 1; blk < num_blocks; blk++)
+	{
+		for (; prefetch_blk < num_blocks &&
+			   prefetch_blk <= blk + maintenance_io_concurrency; prefetch_blk++)
+			PrefetchBuffer(index, MAIN_FORKNUM, prefetch_blk);
+
+		_art_vacuum_block(vs, blk);
+	}
+
+	vs->stats->num_pages = num_blocks;
+
+	MemoryContextDelete(vs->page_ctx);
+}
+
+/*
+ * Vacuum single index page.
+ */
+void
+_art_vacuum_block(ArtVacuumState * vs, BlockNumber blk)
+{
+	Relation index = vs->info->index;
+	int lock_mode = vs->callback ? BUFFER_LOCK_EXCLUSIVE : BUFFER_LOCK_SHARE;
+	Buffer buffer;
+	Page page;
+	MemoryContext old_ctx;
+
+	vacuum_delay_point();
+
+	buffer = ReadBufferExtended(index, MAIN_FORKNUM, blk, RBM_NORMAL,
+								vs->info->strategy);
+	LockBuffer(buffer, lock_mode);
+	page = BufferGetPage(buffer);
+
+	if (PageIsNew(page))
+	{
+		UnlockReleaseBuffer(buffer);
+		return;
+	}
+
+	old_ctx = MemoryContextSwitchTo(vs->page_ctx);
+
+	if (vs->callback == NULL)
+	{
+		_art_vacuum_page(vs, blk, page);
+		UnlockReleaseBuffer(buffer);
+	}
+	else
+	{
+		// Batch logs changes of page and releases it
+		_art_xlog_begin(index);
+		_art_xlog_register_buffer(buffer, false);
+
+		PG_TRY();
+		{
+			ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+
+			// Scans don't kill TIDs read before page changed, see _art_kill_items
+			if (_art_vacuum_page(vs, blk, page))
+				opaque->remove_cycle++;
+
+			// Items moved in from now on get page listed again
+			if (opaque->vacuum_cycle == vs->cycle)
+			{
+				START_CRIT_SECTION();
+				opaque->vacuum_cycle = 0;
+				END_CRIT_SECTION();
+			}
+
+			if (_art_page_prune(index, page))
+				_art_vacuum_page_cache(index, blk, page);
+
+			_art_xlog_finish();
+		}
+		PG_CATCH();
+		{
+			_art_xlog_abort();
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+	}
+
+	MemoryContextSwitchTo(old_ctx);
+	MemoryContextReset(vs->page_ctx);
+}
+
+/*
+ * Vacuum all items of page. Returns true if page was modified.
+ */
+bool
+_art_vacuum_page(ArtVacuumState * vs, BlockNumber blkNum, Page page)
+{
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+	bool modified = false;
+
+	if (opaque->page_flags & ART_BITMAP_PAGE)
+		return _art_vacuum_bitmap_page(vs, page);
+
+	if (opaque->page_flags & ART_PENDING_PAGE)
+		return _art_vacuum_pending_page(vs, page);
+
+	for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		ItemId item_id = PageGetItemId(page, off);
+		bool dead = ItemIdIsDead(item_id);
+		double num_index_tuples = vs->stats->num_index_tuples;
+		ArtNodeHeader * node;
+
+		if (!ItemIdHasStorage(item_id))
+			continue;
+
+		node = (ArtNodeHeader *) PageGetItem(page, item_id);
+
+		switch (node->node_type)
+		{
+		case NODE_LEAF:
+			modified |= _art_vacuum_leaf(vs, page, off, (ArtNodeLeaf *) node);
+			break;
+		case NODE_4:
+		case NODE_16:
+		case NODE_48:
+		case NODE_256:
+			modified |= _art_vacuum_node(vs, blkNum, page, off, node);
+			break;
+		case NODE_BUCKET:
+			modified |= _art_vacuum_bucket(vs, page, off, node);
+			break;
+		default:
+			elog(ERROR, "Invalid ART NODE");
+		}
+
+		// Dead item is copy kept for scans, its TIDs are removed but not
+		// counted, and rewritten item stays dead
+		if (dead)
+		{
+			vs->stats->num_index_tuples = num_index_tuples;
+
+			if (!ItemIdIsDead(item_id))
+			{
+				START_CRIT_SECTION();
+				ItemIdMarkDead(item_id);
+				END_CRIT_SECTION();
+			}
+		}
+	}
+
+	return modified;
+}
+
+/*
+ * Offer page whose dead items were freed to inserts through page cache.
+ */
+void
+_art_vacuum_page_cache(Relation index, BlockNumber blkNum, Page page)
+{
+	Buffer metadata_buffer = _art_xlog_read_buffer(index, ART_METADATA_NODE_BLKNO, false);
+	ArtMetaDataPageOpaque metadata =
+		(ArtMetaDataPageOpaque) PageGetSpecialPointer(BufferGetPage(metadata_buffer));
+
+	START_CRIT_SECTION();
+	_art_page_cache_put(metadata, blkNum, page);
+	END_CRIT_SECTION();
+
+	_art_xlog_release_buffer(metadata_buffer);
+}
+
+/*
+ * Remove dead TIDs from bitmap containers. Containers left empty are
+ * removed, remaining containers keep heap block order.
+ */
+bool
+_art_vacuum_bitmap_page(ArtVacuumState * vs, Page page)
+{
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+	ItemPointerData tids[MaxHeapTuplesPerPage];
+	OffsetNumber offsets[MaxHeapTuplesPerPage];
+	bool modified = false;
+
+	// Going backwards keeps offsets valid when containers are removed
+	for (OffsetNumber off = PageGetMaxOffsetNumber(page); off >= FirstOffsetNumber; off--)
+	{
+		ArtBitmapContainer * c =
+			(ArtBitmapContainer *) PageGetItem(page, PageGetItemId(page, off));
+		int num_items = _art_bitmap_container_decode(c, tids);
+		int num_live = 0;
+
+		for (int i = 0; i < num_items; i++)
+		{
+			if (!_art_tid_is_dead(vs, &tids[i]))
+				offsets[num_live++] = ItemPointerGetOffsetNumber(&tids[i]);
+		}
+
+		vs->stats->num_index_tuples += num_live;
+
+		if (num_live == num_items)
+			continue;
+
+		vs->stats->tuples_removed += num_items - num_live;
+		modified = true;
+
+		if (num_live == 0)
+		{
+			START_CRIT_SECTION();
+			PageIndexTupleDelete(page, off);
+			opaque->n_total--;
+			END_CRIT_SECTION();
+		}
+		else
+		{
+			ArtBitmapContainer * new_c =
+				_art_bitmap_container_build(c->heap_blk, offsets, num_live);
+
+			START_CRIT_SECTION();
+			PageIndexTupleOverwrite(page, off, (Item) new_c,
+									_art_bitmap_container_size(new_c));
+			END_CRIT_SECTION();
+		}
+	}
+
+	return modified;
+}
+
+/*
+ * Remove pending list entries of dead TIDs. Nothing refers to entry
+ * offsets, so page is compacted.
+ */
+bool
+_art_vacuum_pending_page(ArtVacuumState * vs, Page page)
+{
+	ArtDataPageOpaque opaque = (ArtDataPageOpaque) PageGetSpecialPointer(page);
+	OffsetNumber dead[MaxIndexTuplesPerPage];
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+	int num_dead = 0;
+
+	for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		ArtPendingItem * item =
+			(ArtPendingItem *) PageGetItem(page, PageGetItemId(page, off));
+
+		if (_art_tid_is_dead(vs, &item->iptr))
+			dead[num_dead++] = off;
+		else
+			vs->stats->num_index_tuples++;
+	}
+
+	if (num_dead == 0)
+		return false;
+
+	vs->stats->tuples_removed += num_dead;
+
+	START_CRIT_SECTION();
+	PageIndexMultiDelete(page, dead, num_dead);
+	opaque->n_total -= num_dead;
+	END_CRIT_SECTION();
+
+	return true;
+}
+
+/*
+ * Remove dead TIDs from leaf posting list. Bitmap leaf TIDs are on bitmap
+ * pages and are vacuumed there. Empty leaf stays in place.
+ */
+bool
+_art_vacuum_leaf(ArtVacuumState * vs, Page page, OffsetNumber off, ArtNodeLeaf * leaf)
+{
+	ItemPointerData * items;
+	ArtNodeLeaf * new_leaf;
+	int num_items;
+	int num_live = 0;
+
+	if (leaf->flags & ART_LEAF_BITMAP)
+		return false;
+
+	items = (ItemPointerData *) palloc(sizeof(ItemPointerData) * (leaf->num_items + 1));
+	num_items = _art_posting_decode(ART_LEAF_POSTING(leaf), leaf->posting_size, items);
+
+	for (int i = 0; i < num_items; i++)
+	{
+		if (!_art_tid_is_dead(vs, &items[i]))
+			items[num_live++] = items[i];
+	}
+
+	vs->stats->num_index_tuples += num_live;
+
+	if (num_live == num_items)
+		return false;
+
+	vs->stats->tuples_removed += num_items - num_live;
+
+	new_leaf = (ArtNodeLeaf *) palloc(sizeof(ArtNodeLeaf) + leaf->key_len +
+									  ART_POSTING_MAX_SIZE(num_live));
+	memcpy(new_leaf, leaf, sizeof(ArtNodeLeaf) + leaf->key_len);
+	new_leaf->num_items = num_live;
+	new_leaf->posting_size =
+		_art_posting_encode(items, num_live, ART_LEAF_POSTING(new_leaf));
+
+	START_CRIT_SECTION();
+	PageIndexTupleOverwrite(page, off, (Item) new_leaf,
+							_art_node_size((ArtNodeHeader *) new_leaf));
+	END_CRIT_SECTION();
+
+	return true;
+}
+
+/*
+ * Remove inline TID children that are dead. Inline TIDs are always in far
+ * table, so node is decoded only if some of them is dead. Node is encoded
+ * back at same position, reserved nodes keep their size.
+ */
+bool
+_art_vacuum_node(ArtVacuumState * vs, BlockNumber blkNum, Page page,
+				 OffsetNumber off, ArtNodeHeader * pageNode)
+{
+	ItemPointerData * far = ART_PAGE_NODE_FAR(pageNode);
+	ItemPointerData * dead;
+	int num_dead = 0;
+	ArtNodeHeader * node;
+	ArtNodeHeader * new_page_node;
+	uint8 keys[256];
+	ItemPointerData children[256];
+	int num_children;
+
+	if (vs->callback == NULL)
+	{
+		for (int i = 0; i < pageNode->num_far; i++)
+		{
+			if (ART_CHILD_IS_INLINE(&far[i]))
+				vs->stats->num_index_tuples++;
+		}
+
+		return false;
+	}
+
+	dead = (ItemPointerData *) palloc(sizeof(ItemPointerData) * (pageNode->num_far + 1));
+
+	for (int i = 0; i < pageNode->num_far; i++)
+	{
+		ItemPointerData tid;
+
+		if (!ART_CHILD_IS_INLINE(&far[i]))
+			continue;
+
+		ART_CHILD_GET_INLINE(&far[i], &tid);
+
+		if (_art_tid_is_dead(vs, &tid))
+			dead[num_dead++] = far[i];
+		else
+			vs->stats->num_index_tuples++;
+	}
+
+	if (num_dead == 0)
+		return false;
+
+	vs->stats->tuples_removed += num_dead;
+
+	node = _art_page_node_decode(pageNode, blkNum);
+	num_children = _art_node_children(node, keys, children);
+
+	for (int i = 0; i < num_children; i++)
+	{
+		if (!ART_CHILD_IS_INLINE(&children[i]))
+			continue;
+
+		for (int j = 0; j < num_dead; j++)
+		{
+			if (ItemPointerEquals(&children[i], &dead[j]))
+			{
+				_art_node_remove_child(node, keys[i]);
+				break;
+			}
+		}
+	}
+
+	new_page_node = _art_page_node_encode(node, blkNum);
+
+	START_CRIT_SECTION();
+	PageIndexTupleOverwrite(page, off, (Item) new_page_node,
+							_art_page_node_size(node, blkNum));
+	END_CRIT_SECTION();
+
+	return true;
+}
+
+/*
+ * Remove bucket entries with dead inline TIDs. Bucket can't be empty, so
+ * bucket without live entries is replaced by empty NODE_4.
+ */
+bool
+_art_vacuum_bucket(ArtVacuumState * vs, Page page, OffsetNumber off, ArtNodeHeader * bucket)
+{
+	ArtBucketItem * items;
+	ArtNodeHeader * new_node;
+	Size new_size;
+	int num_live = 0;
+
+	items = (ArtBucketItem *) palloc(sizeof(ArtBucketItem) * bucket->num_children);
+
+	for (int i = 0; i < bucket->num_children; i++)
+	{
+		ArtBucketEntry * entry = ART_BUCKET_ENTRY(bucket, i);
+
+		if (ART_CHILD_IS_INLINE(&entry->child))
+		{
+			ItemPointerData tid;
+
+			ART_CHILD_GET_INLINE(&entry->child, &tid);
+
+			if (_art_tid_is_dead(vs, &tid))
+				continue;
+
+			vs->stats->num_index_tuples++;
+		}
+
+		items[num_live].key = entry->key;
+		items[num_live].key_len = entry->key_len;
+		items[num_live++].child = entry->child;
+	}
+
+	if (num_live == bucket->num_children)
+		return false;
+
+	vs->stats->tuples_removed += bucket->num_children - num_live;
+
+	if (num_live > 0)
+	{
+		new_node = _art_bucket_build(ART_BUCKET_PREFIX(bucket), bucket->prefix_key_len,
+									 items, num_live, 0);
+		new_size = _art_bucket_size(new_node);
+	}
+	else
+	{
+		ArtNodeHeader * empty = _art_alloc_node(NODE_4, 0);
+
+		new_node = _art_page_node_encode(empty, InvalidBlockNumber);
+		new_size = _art_page_node_size(empty, InvalidBlockNumber);
+	}
+
+	START_CRIT_SECTION();
+	PageIndexTupleOverwrite(page, off, (Item) new_node, new_size);
+	END_CRIT_SECTION();
+
+	return true;
+}
+
+/*
+ * Check heap TID with VACUUM callback. In counting mode nothing is dead.
+ */
+bool
+_art_tid_is_dead(ArtVacuumState * vs, ItemPointer tid)
+{
+	if (vs->callback == NULL)
+		return false;
+
+	return vs->callback(tid, vs->callback_state);
+}
+
+int
+_art_blk_cmp(const void * a, const void * b)
+{
+	BlockNumber blk_a = *(const BlockNumber *) a;
+	BlockNumber blk_b = *(const BlockNumber *) b;
+
+	return blk_a < blk_b ? -1 : blk_a > blk_b ? 1 : 0;
 }
@@ -0,0 +1,751 @@
+/*-------------------------------------------------------------------------
+ *
+ * art_xlog.c
+ *		WAL logging and replay for ART indexes.
+ *
+ * Pages changed by one insert, by VACUUM of one page, or by a step of
+ * cleanup walk are logged by single record. Operations that may change
+ * more pages flush batch at points where tree is consistent, so record
+ * never exceeds ART_XLOG_MAX_BLOCKS pages. Pages join the batch when
+ * they are locked exclusively and stay locked until batch is logged,
+ * except pages left unchanged, and metadata page that is logged early
+ * with new pages it points to.
+ * Batch keeps page image from when page joined, so record only carries
+ * byte ranges that changed since, typically a slot, a few appended TID
+ * bytes or a new item with its line pointer. New pages are logged as
+ * full images. If caller fails before batch is logged, pages are put
+ * back to their images, so no change is ever left without WAL.
+ *
+ * Delta records are replayed by ART resource manager, which can only be
+ * registered when library is loaded by shared_preload_libraries. Without
+ * it records of up to MAX_GENERIC_XLOG_PAGES pages are logged as generic
+ * WAL, larger ones as full page images, both replayed by core. TIDs are
+ * then only removed by VACUUM when hot standby needs conflict information,
+ * as core records can't carry it.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/bufmask.h"
+#include "access/generic_xlog.h"
+#include "access/rmgr.h"
+#include "access/transam.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xloginsert.h"
+#include "access/xlogreader.h"
+#include "access/xlogutils.h"
+#include "catalog/pg_control.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/standby.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "art.h"
+
+/*
+ * Resource manager ID of ART, IDs of extensions are registered on
+ * https://wiki.postgresql.org/wiki/CustomWALResourceManagers. WAL written
+ * with it can't be replayed under another ID, so it must never change.
+ */
+#define ART_RMGR_ID 173
+
+#define XLOG_ART_DELTA 0x00
+
+/* Equal bytes up to fragment header size are cheaper to keep in fragment */
+#define ART_XLOG_FRAGMENT_HEADER ((int) (2 * sizeof(uint16)))
+
+/* Pages per record, changes of more pages can't be logged atomically */
+#define ART_XLOG_MAX_BLOCKS XLR_MAX_BLOCK_ID
+
+/* Batch size at which long operations log changes made so far */
+#define ART_XLOG_FLUSH_PAGES (ART_XLOG_MAX_BLOCKS / 2)
+
+typedef struct xl_art_delta
+{
+	TransactionId latest_removed_xid;	/* newest xid of removed TIDs */
+} xl_art_delta;
+
+typedef struct ArtXLogPage
+{
+	Buffer buffer;
+	BlockNumber blk_num;
+	Page image;						/* page as last logged, NULL if new */
+	int refs;						/* page entries using buffer */
+} ArtXLogPage;
+
+typedef struct ArtXLogBatch
+{
+	Relation index;
+	ArtXLogPage * pages;
+	int num_pages;
+	int max_pages;
+	TransactionId latest_removed_xid;
+} ArtXLogBatch;
+
+static ArtXLogBatch * art_xlog_batch = NULL;
+static MemoryContext art_xlog_ctx = NULL;
+static bool art_rmgr_registered = false;
+
+static ArtXLogPage * _art_xlog_find_page(BlockNumber blkNum);
+static void _art_xlog_release_metadata(ArtXLogPage * metadata);
+static void _art_xlog_remove_page(ArtXLogPage * xlog_page);
+static void _art_xlog_log_pages(ArtXLogPage ** pages, int numPages,
+								TransactionId latestRemovedXid);
+static void _art_xlog_log_generic(ArtXLogPage ** pages, int numPages);
+static void _art_xlog_delta(StringInfo delta, const char * image, const char * page);
+static void _art_xlog_live_delta(StringInfo delta, const char * image,
+								 const char * page, int start, int end,
+								 int holeStart, int holeEnd);
+static void _art_xlog_region_delta(StringInfo delta, const char * image,
+								   const char * page, int start, int end);
+static void _art_xlog_apply_delta(Page page, const char * delta, Size len);
+static void _art_xlog_redo(XLogReaderState * record);
+static void _art_xlog_desc(StringInfo buf, XLogReaderState * record);
+static const char * _art_xlog_identify(uint8 info);
+static void _art_xlog_mask(char * pagedata, BlockNumber blkno);
+
+static RmgrData art_rmgr = {
+	.rm_name = "art",
+	.rm_redo = _art_xlog_redo,
+	.rm_desc = _art_xlog_desc,
+	.rm_identify = _art_xlog_identify,
+	.rm_mask = _art_xlog_mask
+};
+
+
+/*
+ * Register resource manager, only possible while preloading libraries.
+ */
+void
+_art_xlog_register_rmgr(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RegisterCustomRmgr(ART_RMGR_ID, &art_rmgr);
+	art_rmgr_registered = true;
+}
+
+/*
+ * Start batch of page changes. Every batch ends with _art_xlog_finish,
+ * or with _art_xlog_abort if caller fails.
+ */
+void
+_art_xlog_begin(Relation index)
+{
+	if (art_xlog_ctx == NULL)
+		art_xlog_ctx = AllocSetContextCreate(TopMemoryContext,
+											 "ART WAL batch context",
+											 ALLOCSET_DEFAULT_SIZES);
+
+	MemoryContextReset(art_xlog_ctx);
+
+	art_xlog_batch = MemoryContextAllocZero(art_xlog_ctx, sizeof(ArtXLogBatch));
+	art_xlog_batch->index = index;
+	art_xlog_batch->max_pages = 8;
+	art_xlog_batch->pages = MemoryContextAlloc(art_xlog_ctx,
+											   sizeof(ArtXLogPage) * art_xlog_batch->max_pages);
+	art_xlog_batch->latest_removed_xid = InvalidTransactionId;
+}
+
+bool
+_art_xlog_in_progress(void)
+{
+	return art_xlog_batch != NULL;
+}
+
+ArtXLogPage *
+_art_xlog_find_page(BlockNumber blkNum)
+{
+	for (int i = 0; i < art_xlog_batch->num_pages; i++)
+	{
+		if (art_xlog_batch->pages[i].blk_num == blkNum)
+			return &art_xlog_batch->pages[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Add exclusively locked buffer to batch, batch releases it. Image of new
+ * page is not kept, it is logged whole.
+ */
+void
+_art_xlog_register_buffer(Buffer buffer, bool isNew)
+{
+	ArtXLogBatch * batch = art_xlog_batch;
+	ArtXLogPage * xlog_page;
+
+	if (batch->num_pages == batch->max_pages)
+	{
+		batch->max_pages *= 2;
+		batch->pages = repalloc(batch->pages, sizeof(ArtXLogPage) * batch->max_pages);
+	}
+
+	xlog_page = &batch->pages[batch->num_pages++];
+	xlog_page->buffer = buffer;
+	xlog_page->blk_num = BufferGetBlockNumber(buffer);
+	xlog_page->refs = 1;
+	xlog_page->image = NULL;
+
+	if (!isNew)
+	{
+		xlog_page->image = MemoryContextAlloc(art_xlog_ctx, BLCKSZ);
+		memcpy(xlog_page->image, BufferGetPage(buffer), BLCKSZ);
+	}
+}
+
+/*
+ * Exclusively lock block as part of batch, block that is already in batch
+ * is shared. Returns InvalidBuffer if conditional lock is not available.
+ */
+Buffer
+_art_xlog_read_buffer(Relation index, BlockNumber blkNum, bool conditional)
+{
+	ArtXLogPage * xlog_page = _art_xlog_find_page(blkNum);
+	Buffer buffer;
+
+	if (xlog_page)
+	{
+		xlog_page->refs++;
+		return xlog_page->buffer;
+	}
+
+	buffer = ReadBuffer(index, blkNum);
+
+	if (!conditional)
+		LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+	else if (!ConditionalLockBuffer(buffer))
+	{
+		ReleaseBuffer(buffer);
+		return InvalidBuffer;
+	}
+
+	_art_xlog_register_buffer(buffer, false);
+
+	return buffer;
+}
+
+/*
+ * Drop page entry reference of buffer. Returns false if buffer is not
+ * part of batch, caller releases it then. Page left unchanged is released
+ * right away, as other inserts may wait for it.
+ */
+bool
+_art_xlog_release_buffer(Buffer buffer)
+{
+	ArtXLogPage * xlog_page;
+
+	if (art_xlog_batch == NULL)
+		return false;
+
+	xlog_page = _art_xlog_find_page(BufferGetBlockNumber(buffer));
+
+	if (xlog_page == NULL)
+		return false;
+
+	if (--xlog_page->refs > 0)
+		return true;
+
+	if (xlog_page->image && memcmp(xlog_page->image, BufferGetPage(buffer), BLCKSZ) == 0)
+		_art_xlog_remove_page(xlog_page);
+	else if (xlog_page->blk_num == ART_METADATA_NODE_BLKNO)
+		_art_xlog_release_metadata(xlog_page);
+
+	return true;
+}
+
+/*
+ * Every insert locks metadata page, so it is not held until batch ends.
+ * It is logged with new pages its tail block numbers point to.
+ */
+void
+_art_xlog_release_metadata(ArtXLogPage * metadata)
+{
+	ArtXLogBatch * batch = art_xlog_batch;
+	ArtXLogPage ** pages = palloc(sizeof(ArtXLogPage *) * batch->num_pages);
+	int num_pages = 0;
+
+	pages[num_pages++] = metadata;
+
+	for (int i = 0; i < batch->num_pages; i++)
+	{
+		if (batch->pages[i].image == NULL)
+			pages[num_pages++] = &batch->pages[i];
+	}
+
+	_art_xlog_log_pages(pages, num_pages, InvalidTransactionId);
+
+	for (int i = 1; i < num_pages; i++)
+	{
+		pages[i]->image = MemoryContextAlloc(art_xlog_ctx, BLCKSZ);
+		memcpy(pages[i]->image, BufferGetPage(pages[i]->buffer), BLCKSZ);
+	}
+
+	pfree(pages);
+
+	_art_xlog_remove_page(metadata);
+}
+
+void
+_art_xlog_remove_page(ArtXLogPage * xlog_page)
+{
+	ArtXLogBatch * batch = art_xlog_batch;
+	int pos = xlog_page - batch->pages;
+
+	UnlockReleaseBuffer(xlog_page->buffer);
+
+	if (xlog_page->image)
+		pfree(xlog_page->image);
+
+	memmove(&batch->pages[pos], &batch->pages[pos + 1],
+			sizeof(ArtXLogPage) * (batch->num_pages - pos - 1));
+	batch->num_pages--;
+}
+
+/*
+ * Record xid of heap tuples whose TIDs batch removes, standby cancels
+ * queries that may still see them before replaying batch.
+ */
+void
+_art_xlog_set_latest_removed_xid(TransactionId xid)
+{
+	if (TransactionIdFollows(xid, art_xlog_batch->latest_removed_xid))
+		art_xlog_batch->latest_removed_xid = xid;
+}
+
+/*
+ * Check if TIDs can be removed outside of VACUUM.
+ */
+bool
+_art_xlog_can_remove_tids(Relation index)
+{
+	return art_rmgr_registered || !RelationNeedsWAL(index) || !XLogStandbyInfoActive();
+}
+
+/*
+ * Log pages that changed since their images were taken, by single record.
+ */
+void
+_art_xlog_log_pages(ArtXLogPage ** pages, int numPages, TransactionId latestRemovedXid)
+{
+	bool needs_wal = RelationNeedsWAL(art_xlog_batch->index);
+	ArtXLogPage ** changed = palloc(sizeof(ArtXLogPage *) * numPages);
+	StringInfoData * deltas = palloc0(sizeof(StringInfoData) * numPages);
+	int num_changed = 0;
+
+	// Deltas need memory, so they are computed before critical section
+	for (int i = 0; i < numPages; i++)
+	{
+		if (pages[i]->image)
+		{
+			StringInfo delta = &deltas[num_changed];
+
+			initStringInfo(delta);
+			_art_xlog_delta(delta, pages[i]->image, BufferGetPage(pages[i]->buffer));
+
+			if (delta->len == 0)
+			{
+				pfree(delta->data);
+				delta->data = NULL;
+				continue;
+			}
+		}
+
+		changed[num_changed++] = pages[i];
+	}
+
+	// Caller flushes often enough, change split over records wouldn't be atomic
+	if (num_changed > ART_XLOG_MAX_BLOCKS)
+		elog(ERROR, "ART index \"%s\" change spans %d pages, at most %d can be logged together",
+			 RelationGetRelationName(art_xlog_batch->index), num_changed, ART_XLOG_MAX_BLOCKS);
+
+	// Generic record carries deltas as well, but only of few pages
+	if (!art_rmgr_registered && num_changed > 0 && num_changed <= MAX_GENERIC_XLOG_PAGES)
+		_art_xlog_log_generic(changed, num_changed);
+	else
+	{
+		if (needs_wal && num_changed > 0)
+			XLogEnsureRecordSpace(num_changed - 1, num_changed + 1);
+
+		START_CRIT_SECTION();
+
+		for (int i = 0; i < num_changed; i++)
+			MarkBufferDirty(changed[i]->buffer);
+
+		if (needs_wal && num_changed > 0)
+		{
+			xl_art_delta xlrec;
+			XLogRecPtr recptr;
+
+			XLogBeginInsert();
+
+			if (art_rmgr_registered)
+			{
+				xlrec.latest_removed_xid = latestRemovedXid;
+				XLogRegisterData((char *) &xlrec, sizeof(xl_art_delta));
+			}
+
+			for (int i = 0; i < num_changed; i++)
+			{
+				// Delta larger than page contents is replaced by page image
+				if (art_rmgr_registered && changed[i]->image &&
+					deltas[i].len < BLCKSZ - (int) PageGetExactFreeSpace(BufferGetPage(changed[i]->buffer)))
+				{
+					XLogRegisterBuffer(i, changed[i]->buffer, REGBUF_STANDARD);
+					XLogRegisterBufData(i, deltas[i].data, deltas[i].len);
+				}
+				else
+					XLogRegisterBuffer(i, changed[i]->buffer,
+									   REGBUF_FORCE_IMAGE | REGBUF_STANDARD);
+			}
+
+			if (art_rmgr_registered)
+				recptr = XLogInsert(ART_RMGR_ID, XLOG_ART_DELTA);
+			else
+				recptr = XLogInsert(RM_XLOG_ID, XLOG_FPI);
+
+			for (int i = 0; i < num_changed; i++)
+				PageSetLSN(BufferGetPage(changed[i]->buffer), recptr);
+		}
+
+		END_CRIT_SECTION();
+	}
+
+	for (int i = 0; i < num_changed; i++)
+	{
+		if (deltas[i].data)
+			pfree(deltas[i].data);
+	}
+
+	pfree(deltas);
+	pfree(changed);
+}
+
+/*
+ * Log changed pages by generic WAL record. Generic WAL takes page as it
+ * was from buffer and applies changes itself, so page image is put back
+ * to buffer while its changes are copied to page generic WAL returns.
+ * Pages stay locked, so nobody sees them in between.
+ */
+void
+_art_xlog_log_generic(ArtXLogPage ** pages, int numPages)
+{
+	GenericXLogState * state = GenericXLogStart(art_xlog_batch->index);
+	char * changes = palloc(BLCKSZ);
+
+	for (int i = 0; i < numPages; i++)
+	{
+		Page page = BufferGetPage(pages[i]->buffer);
+		Page generic_page;
+
+		if (pages[i]->image == NULL)
+		{
+			generic_page = GenericXLogRegisterBuffer(state, pages[i]->buffer,
+													 GENERIC_XLOG_FULL_IMAGE);
+			memcpy(generic_page, page, BLCKSZ);
+			continue;
+		}
+
+		memcpy(changes, page, BLCKSZ);
+		memcpy(page, pages[i]->image, BLCKSZ);
+
+		generic_page = GenericXLogRegisterBuffer(state, pages[i]->buffer, 0);
+		memcpy(generic_page, changes, BLCKSZ);
+	}
+
+	// Marks buffers dirty and sets their LSN, copying changes back to them
+	GenericXLogFinish(state);
+
+	pfree(changes);
+}
+
+/*
+ * Log changes of batch pages and release pages no page entry uses. Caller
+ * flushes only when tree is consistent as of changed pages.
+ */
+void
+_art_xlog_flush(void)
+{
+	ArtXLogBatch * batch = art_xlog_batch;
+	ArtXLogPage ** pages = palloc(sizeof(ArtXLogPage *) * batch->num_pages);
+	int num_kept = 0;
+
+	for (int i = 0; i < batch->num_pages; i++)
+		pages[i] = &batch->pages[i];
+
+	_art_xlog_log_pages(pages, batch->num_pages, batch->latest_removed_xid);
+
+	pfree(pages);
+
+	for (int i = 0; i < batch->num_pages; i++)
+	{
+		ArtXLogPage * xlog_page = &batch->pages[i];
+
+		if (xlog_page->refs > 0)
+		{
+			// Page stays in batch, its next delta starts from logged state
+			if (xlog_page->image == NULL)
+				xlog_page->image = MemoryContextAlloc(art_xlog_ctx, BLCKSZ);
+
+			memcpy(xlog_page->image, BufferGetPage(xlog_page->buffer), BLCKSZ);
+			batch->pages[num_kept++] = *xlog_page;
+		}
+		else
+		{
+			UnlockReleaseBuffer(xlog_page->buffer);
+
+			if (xlog_page->image)
+				pfree(xlog_page->image);
+		}
+	}
+
+	batch->num_pages = num_kept;
+	batch->latest_removed_xid = InvalidTransactionId;
+}
+
+/*
+ * Flush batch once it holds ART_XLOG_FLUSH_PAGES pages. Called by long
+ * operations at points where tree is consistent, does nothing outside
+ * of batch.
+ */
+void
+_art_xlog_flush_if_full(void)
+{
+	if (art_xlog_batch != NULL && art_xlog_batch->num_pages >= ART_XLOG_FLUSH_PAGES)
+		_art_xlog_flush();
+}
+
+/*
+ * Log batch and release all its pages.
+ */
+void
+_art_xlog_finish(void)
+{
+	for (int i = 0; i < art_xlog_batch->num_pages; i++)
+		art_xlog_batch->pages[i].refs = 0;
+
+	_art_xlog_flush();
+
+	art_xlog_batch = NULL;
+	MemoryContextReset(art_xlog_ctx);
+}
+
+/*
+ * Put batch pages back to their last logged state and release them. Called
+ * on error, before locks are released by abort.
+ */
+void
+_art_xlog_abort(void)
+{
+	ArtXLogBatch * batch = art_xlog_batch;
+
+	if (batch == NULL)
+		return;
+
+	art_xlog_batch = NULL;
+
+	for (int i = 0; i < batch->num_pages; i++)
+	{
+		ArtXLogPage * xlog_page = &batch->pages[i];
+		Page page = BufferGetPage(xlog_page->buffer);
+
+		// New page goes back to empty, nothing logged points to it
+		if (xlog_page->image)
+			memcpy(page, xlog_page->image, BLCKSZ);
+		else
+			MemSet(page, 0, BLCKSZ);
+
+		UnlockReleaseBuffer(xlog_page->buffer);
+	}
+
+	MemoryContextReset(art_xlog_ctx);
+}
+
+/*
+ * Append fragments of page bytes that differ from image. Fragment is
+ * offset and length followed by bytes. Free space of page is skipped.
+ *
+ * Free space of image is not compared: it holds stale bytes on primary,
+ * while on standby, or after full page image, it is zeroed. Bytes that
+ * page now uses there are logged whole, even where they match image.
+ */
+void
+_art_xlog_delta(StringInfo delta, const char * image, const char * page)
+{
+	PageHeader header = (PageHeader) page;
+	PageHeader image_header = (PageHeader) image;
+
+	_art_xlog_live_delta(delta, image, page, 0, header->pd_lower,
+						 image_header->pd_lower, image_header->pd_upper);
+	_art_xlog_live_delta(delta, image, page, header->pd_upper, BLCKSZ,
+						 image_header->pd_lower, image_header->pd_upper);
+}
+
+/*
+ * Append delta of page region, bytes within image hole are logged whole.
+ */
+void
+_art_xlog_live_delta(StringInfo delta, const char * image, const char * page,
+					 int start, int end, int holeStart, int holeEnd)
+{
+	int hole_start = Max(start, holeStart);
+	int hole_end = Min(end, holeEnd);
+	uint16 frag_start;
+	uint16 frag_len;
+
+	if (hole_start >= hole_end)
+	{
+		_art_xlog_region_delta(delta, image, page, start, end);
+		return;
+	}
+
+	_art_xlog_region_delta(delta, image, page, start, hole_start);
+
+	frag_start = hole_start;
+	frag_len = hole_end - hole_start;
+	appendBinaryStringInfo(delta, (char *) &frag_start, sizeof(uint16));
+	appendBinaryStringInfo(delta, (char *) &frag_len, sizeof(uint16));
+	appendBinaryStringInfo(delta, page + frag_start, frag_len);
+
+	_art_xlog_region_delta(delta, image, page, hole_end, end);
+}
+
+void
+_art_xlog_region_delta(StringInfo delta, const char * image, const char * page,
+					   int start, int end)
+{
+	int pos = start;
+
+	while (pos < end)
+	{
+		uint16 frag_start;
+		uint16 frag_len;
+		int frag_end;
+
+		// Most of page is unchanged, compare it word at a time
+		while (pos + (int) sizeof(uint64) <= end &&
+			   memcmp(image + pos, page + pos, sizeof(uint64)) == 0)
+			pos += sizeof(uint64);
+
+		while (pos < end && image[pos] == page[pos])
+			pos++;
+
+		if (pos == end)
+			break;
+
+		frag_start = pos;
+		frag_end = pos + 1;
+
+		for (pos = frag_end; pos < end && pos - frag_end < ART_XLOG_FRAGMENT_HEADER; pos++)
+		{
+			if (image[pos] != page[pos])
+				frag_end = pos + 1;
+		}
+
+		frag_len = frag_end - frag_start;
+		appendBinaryStringInfo(delta, (char *) &frag_start, sizeof(uint16));
+		appendBinaryStringInfo(delta, (char *) &frag_len, sizeof(uint16));
+		appendBinaryStringInfo(delta, page + frag_start, frag_len);
+
+		pos = frag_end;
+	}
+}
+
+void
+_art_xlog_apply_delta(Page page, const char * delta, Size len)
+{
+	const char * ptr = delta;
+	const char * end = delta + len;
+
+	while (ptr < end)
+	{
+		uint16 frag_start;
+		uint16 frag_len;
+
+		memcpy(&frag_start, ptr, sizeof(uint16));
+		ptr += sizeof(uint16);
+		memcpy(&frag_len, ptr, sizeof(uint16));
+		ptr += sizeof(uint16);
+
+		memcpy((char *) page + frag_start, ptr, frag_len);
+		ptr += frag_len;
+	}
+}
+
+void
+_art_xlog_redo(XLogReaderState * record)
+{
+	XLogRecPtr lsn = record->EndRecPtr;
+	xl_art_delta * xlrec = (xl_art_delta *) XLogRecGetData(record);
+	uint8 info = XLogRecGetInfo(record) & ~XLR_INFO_MASK;
+	Buffer buffers[XLR_MAX_BLOCK_ID + 1];
+
+	if (info != XLOG_ART_DELTA)
+		elog(PANIC, "art_redo: unknown op code %u", info);
+
+	if (InHotStandby && TransactionIdIsValid(xlrec->latest_removed_xid))
+	{
+		RelFileNode rnode;
+
+		XLogRecGetBlockTag(record, 0, &rnode, NULL, NULL);
+		ResolveRecoveryConflictWithSnapshot(xlrec->latest_removed_xid, rnode);
+	}
+
+	// Pages stay locked until all are replayed, readers see whole change
+	for (int block_id = 0; block_id <= XLogRecMaxBlockId(record); block_id++)
+	{
+		buffers[block_id] = InvalidBuffer;
+
+		if (!XLogRecHasBlockRef(record, block_id))
+			continue;
+
+		if (XLogReadBufferForRedo(record, block_id, &buffers[block_id]) == BLK_NEEDS_REDO)
+		{
+			Page page = BufferGetPage(buffers[block_id]);
+			Size len;
+			char * delta = XLogRecGetBlockData(record, block_id, &len);
+
+			_art_xlog_apply_delta(page, delta, len);
+
+			PageSetLSN(page, lsn);
+			MarkBufferDirty(buffers[block_id]);
+		}
+	}
+
+	for (int block_id = 0; block_id <= XLogRecMaxBlockId(record); block_id++)
+	{
+		if (BufferIsValid(buffers[block_id]))
+			UnlockReleaseBuffer(buffers[block_id]);
+	}
+}
+
+void
+_art_xlog_desc(StringInfo buf, XLogReaderState * record)
+{
+	xl_art_delta * xlrec = (xl_art_delta *) XLogRecGetData(record);
+
+	if (TransactionIdIsValid(xlrec->latest_removed_xid))
+		appendStringInfo(buf, "latest_removed_xid %u", xlrec->latest_removed_xid);
+}
+
+const char *
+_art_xlog_identify(uint8 info)
+{
+	if ((info & ~XLR_INFO_MASK) == XLOG_ART_DELTA)
+		return "DELTA";
+
+	return NULL;
+}
+
+void
+_art_xlog_mask(char * pagedata, BlockNumber blkno)
+{
+	mask_page_lsn_and_checksum(pagedata);
+	mask_page_hint_bits(pagedata);
+	mask_unused_space(pagedata);
+}
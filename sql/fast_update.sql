@@ -0,0 +1,76 @@
+--
+-- Inserts to pending list are found by scans before and after merge
+--
+-- Rows matching each qual by seqscan, and whether index and bitmap scans
+-- return same TIDs
+CREATE FUNCTION art_check(tbl regclass, VARIADIC quals text[])
+RETURNS TABLE (qual text, num_rows bigint, index_scan bool, bitmap_scan bool)
+LANGUAGE plpgsql AS $$
+DECLARE
+    query text;
+    seq_tids tid[];
+    index_tids tid[];
+    bitmap_tids tid[];
+BEGIN
+    FOREACH qual IN ARRAY quals LOOP
+        query := format('SELECT array_agg(ctid ORDER BY ctid) FROM %s WHERE %s', tbl, qual);
+        PERFORM set_config('enable_seqscan', 'on', true);
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'off', true);
+        EXECUTE query INTO seq_tids;
+        PERFORM set_config('enable_seqscan', 'off', true);
+        PERFORM set_config('enable_indexscan', 'on', true);
+        EXECUTE query INTO index_tids;
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'on', true);
+        EXECUTE query INTO bitmap_tids;
+        num_rows := coalesce(cardinality(seq_tids), 0);
+        index_scan := index_tids IS NOT DISTINCT FROM seq_tids;
+        bitmap_scan := bitmap_tids IS NOT DISTINCT FROM seq_tids;
+        RETURN NEXT;
+    END LOOP;
+END
+$$;
+CREATE TABLE fu_tbl (k int4) WITH (autovacuum_enabled = off);
+CREATE INDEX fu_k_idx ON fu_tbl USING art (k) WITH (fast_update = on);
+-- Entries stay on pending list
+INSERT INTO fu_tbl SELECT i FROM generate_series(1, 5000) i;
+SELECT * FROM art_check('fu_tbl',
+  'k = 4321',
+  'k < 100',
+  'k >= 2500',
+  'k <= 3000');
+-- VACUUM merges pending list into tree
+VACUUM fu_tbl;
+SELECT * FROM art_check('fu_tbl',
+  'k = 4321',
+  'k < 100',
+  'k >= 2500',
+  'k <= 3000');
+-- Pending entries and tree entries of same keys
+INSERT INTO fu_tbl SELECT i FROM generate_series(1, 1000) i;
+INSERT INTO fu_tbl SELECT 4321 FROM generate_series(1, 10);
+SELECT * FROM art_check('fu_tbl',
+  'k = 4321',
+  'k < 100',
+  'k >= 2500',
+  'k <= 3000');
+-- List reaching its limit is merged by insert
+ALTER INDEX fu_k_idx SET (pending_list_limit = 64);
+INSERT INTO fu_tbl SELECT i FROM generate_series(5001, 25000) i;
+SELECT * FROM art_check('fu_tbl',
+  'k = 4321',
+  'k < 100',
+  'k >= 2500',
+  'k <= 3000');
+SELECT * FROM art_check('fu_tbl', 'k > 5000');
+-- Deleted entries are removed from pending list and tree
+DELETE FROM fu_tbl WHERE k % 2 = 0;
+VACUUM fu_tbl;
+SELECT * FROM art_check('fu_tbl',
+  'k = 4321',
+  'k < 100',
+  'k >= 2500',
+  'k <= 3000');
+DROP TABLE fu_tbl;
+DROP FUNCTION art_check;
@@ -0,0 +1,87 @@
+--
+-- Storage parameters are validated and honored
+--
+-- Rows matching each qual by seqscan, and whether index and bitmap scans
+-- return same TIDs
+CREATE FUNCTION art_check(tbl regclass, VARIADIC quals text[])
+RETURNS TABLE (qual text, num_rows bigint, index_scan bool, bitmap_scan bool)
+LANGUAGE plpgsql AS $$
+DECLARE
+    query text;
+    seq_tids tid[];
+    index_tids tid[];
+    bitmap_tids tid[];
+BEGIN
+    FOREACH qual IN ARRAY quals LOOP
+        query := format('SELECT array_agg(ctid ORDER BY ctid) FROM %s WHERE %s', tbl, qual);
+        PERFORM set_config('enable_seqscan', 'on', true);
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'off', true);
+        EXECUTE query INTO seq_tids;
+        PERFORM set_config('enable_seqscan', 'off', true);
+        PERFORM set_config('enable_indexscan', 'on', true);
+        EXECUTE query INTO index_tids;
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'on', true);
+        EXECUTE query INTO bitmap_tids;
+        num_rows := coalesce(cardinality(seq_tids), 0);
+        index_scan := index_tids IS NOT DISTINCT FROM seq_tids;
+        bitmap_scan := bitmap_tids IS NOT DISTINCT FROM seq_tids;
+        RETURN NEXT;
+    END LOOP;
+END
+$$;
+CREATE TABLE ro_tbl (k int4) WITH (autovacuum_enabled = off);
+INSERT INTO ro_tbl SELECT i / 3 FROM generate_series(1, 30000) i;
+CREATE INDEX ro_bad_idx ON ro_tbl USING art (k) WITH (leaf_fillfactor = 5);
+CREATE INDEX ro_bad_idx ON ro_tbl USING art (k) WITH (bucket_max_keys = 300);
+CREATE INDEX ro_bad_idx ON ro_tbl USING art (k) WITH (node_placement = middle);
+CREATE INDEX ro_bad_idx ON ro_tbl USING art (k) WITH (fast_update = maybe);
+CREATE INDEX ro_bad_idx ON ro_tbl USING art (k) WITH (fillfactor = 50);
+-- Leaf pages filled to fillfactor by build
+CREATE INDEX ro_full_idx ON ro_tbl USING art (k) WITH (leaf_fillfactor = 100);
+CREATE INDEX ro_sparse_idx ON ro_tbl USING art (k) WITH (leaf_fillfactor = 20);
+SELECT pg_relation_size('ro_sparse_idx') > pg_relation_size('ro_full_idx') AS sparse_larger;
+SELECT reloptions FROM pg_class WHERE relname = 'ro_full_idx';
+ALTER INDEX ro_full_idx SET (fast_update = on, pending_list_limit = 128);
+SELECT reloptions FROM pg_class WHERE relname = 'ro_full_idx';
+ALTER INDEX ro_full_idx SET (node_fillfactor = 101);
+-- Inserts go to pending list of index with fast_update
+DROP INDEX ro_sparse_idx;
+INSERT INTO ro_tbl SELECT i FROM generate_series(20000, 20999) i;
+SELECT * FROM art_check('ro_tbl',
+  'k BETWEEN 9990 AND 20010',
+  'k >= 9000');
+ALTER INDEX ro_full_idx RESET (fast_update);
+SELECT reloptions FROM pg_class WHERE relname = 'ro_full_idx';
+DROP TABLE ro_tbl;
+--
+-- Jump table is kept by rebuilds
+--
+CREATE TABLE jt_tbl (k int8) WITH (autovacuum_enabled = off);
+INSERT INTO jt_tbl SELECT i * 461168601842738 FROM generate_series(0, 20000) i;
+INSERT INTO jt_tbl SELECT i % 100 FROM generate_series(1, 5000) i;
+CREATE INDEX jt_bad_idx ON jt_tbl USING art (k) WITH (jump_table = maybe);
+CREATE INDEX jt_plain_idx ON jt_tbl USING art (k);
+CREATE INDEX jt_idx ON jt_tbl USING art (k) WITH (jump_table = on);
+SELECT reloptions FROM pg_class WHERE relname = 'jt_idx';
+SELECT pg_relation_size('jt_idx') > pg_relation_size('jt_plain_idx') AS has_jump_pages;
+DROP INDEX jt_plain_idx;
+SELECT * FROM art_check('jt_tbl',
+  'k = 0',
+  'k = 5',
+  'k = 461168601842738',
+  'k = 9223372036854775807',
+  'k BETWEEN 100000000000000000 AND 500000000000000000',
+  'k >= 9000000000000000000');
+-- Inserts after build descend from jump nodes
+INSERT INTO jt_tbl SELECT i * 4611686018427 FROM generate_series(0, 1000000, 997) i;
+SELECT * FROM art_check('jt_tbl',
+  'k = 997 * 4611686018427',
+  'k BETWEEN 1000000000000000000 AND 1100000000000000000');
+-- Rebuild keeps layout of storage parameter
+CREATE INDEX jt_plain_idx ON jt_tbl USING art (k);
+REINDEX INDEX jt_idx;
+SELECT pg_relation_size('jt_idx') > pg_relation_size('jt_plain_idx') AS has_jump_pages;
+DROP TABLE jt_tbl;
+DROP FUNCTION art_check;
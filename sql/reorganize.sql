@@ -0,0 +1,60 @@
+--
+-- art_reorganize() keeps index scans equal to sequential scans
+--
+-- Rows matching each qual by seqscan, and whether index and bitmap scans
+-- return same TIDs
+CREATE FUNCTION art_check(tbl regclass, VARIADIC quals text[])
+RETURNS TABLE (qual text, num_rows bigint, index_scan bool, bitmap_scan bool)
+LANGUAGE plpgsql AS $$
+DECLARE
+    query text;
+    seq_tids tid[];
+    index_tids tid[];
+    bitmap_tids tid[];
+BEGIN
+    FOREACH qual IN ARRAY quals LOOP
+        query := format('SELECT array_agg(ctid ORDER BY ctid) FROM %s WHERE %s', tbl, qual);
+        PERFORM set_config('enable_seqscan', 'on', true);
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'off', true);
+        EXECUTE query INTO seq_tids;
+        PERFORM set_config('enable_seqscan', 'off', true);
+        PERFORM set_config('enable_indexscan', 'on', true);
+        EXECUTE query INTO index_tids;
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'on', true);
+        EXECUTE query INTO bitmap_tids;
+        num_rows := coalesce(cardinality(seq_tids), 0);
+        index_scan := index_tids IS NOT DISTINCT FROM seq_tids;
+        bitmap_scan := bitmap_tids IS NOT DISTINCT FROM seq_tids;
+        RETURN NEXT;
+    END LOOP;
+END
+$$;
+CREATE TABLE reorg_tbl (k int4, t text COLLATE "C") WITH (autovacuum_enabled = off);
+CREATE INDEX reorg_k_idx ON reorg_tbl USING art (k);
+CREATE INDEX reorg_t_idx ON reorg_tbl USING art (t);
+-- Keys inserted out of order scatter nodes and leaves across index
+INSERT INTO reorg_tbl SELECT (i * 7919) % 20011, 'key' || (i * 7919) % 20011
+  FROM generate_series(1, 20000) i;
+INSERT INTO reorg_tbl SELECT 43, 'key43' FROM generate_series(1, 500);
+DELETE FROM reorg_tbl WHERE k % 7 = 0;
+SELECT art_reorganize('reorg_k_idx');
+SELECT art_reorganize('reorg_t_idx');
+SELECT * FROM art_check('reorg_tbl',
+  'k = 43',
+  'k < 1000',
+  'k >= 10000',
+  'k <= 5000',
+  't = ''key43''',
+  't < ''key5''');
+-- Reorganized index takes further inserts
+INSERT INTO reorg_tbl SELECT i, 'key' || i FROM generate_series(20011, 21000) i;
+SELECT * FROM art_check('reorg_tbl',
+  'k > 20000',
+  't = ''key20500''');
+-- Only ART indexes are reorganized
+CREATE INDEX reorg_btree_idx ON reorg_tbl (k);
+SELECT art_reorganize('reorg_btree_idx');
+DROP TABLE reorg_tbl;
+DROP FUNCTION art_check;
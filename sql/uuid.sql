@@ -0,0 +1,53 @@
+--
+-- uuid keys are compared bytewise as 16 byte fixed length keys
+--
+-- Rows matching each qual by seqscan, and whether index and bitmap scans
+-- return same TIDs
+CREATE FUNCTION art_check(tbl regclass, VARIADIC quals text[])
+RETURNS TABLE (qual text, num_rows bigint, index_scan bool, bitmap_scan bool)
+LANGUAGE plpgsql AS $$
+DECLARE
+    query text;
+    seq_tids tid[];
+    index_tids tid[];
+    bitmap_tids tid[];
+BEGIN
+    FOREACH qual IN ARRAY quals LOOP
+        query := format('SELECT array_agg(ctid ORDER BY ctid) FROM %s WHERE %s', tbl, qual);
+        PERFORM set_config('enable_seqscan', 'on', true);
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'off', true);
+        EXECUTE query INTO seq_tids;
+        PERFORM set_config('enable_seqscan', 'off', true);
+        PERFORM set_config('enable_indexscan', 'on', true);
+        EXECUTE query INTO index_tids;
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'on', true);
+        EXECUTE query INTO bitmap_tids;
+        num_rows := coalesce(cardinality(seq_tids), 0);
+        index_scan := index_tids IS NOT DISTINCT FROM seq_tids;
+        bitmap_scan := bitmap_tids IS NOT DISTINCT FROM seq_tids;
+        RETURN NEXT;
+    END LOOP;
+END
+$$;
+CREATE TABLE uuid_tbl (u uuid) WITH (autovacuum_enabled = off);
+INSERT INTO uuid_tbl SELECT md5(i::text)::uuid FROM generate_series(1, 10000) i;
+CREATE INDEX uuid_idx ON uuid_tbl USING art (u);
+-- Inserts after build, keys sharing 14 leading bytes get long node prefixes
+INSERT INTO uuid_tbl SELECT md5(i::text)::uuid FROM generate_series(10001, 20000) i;
+INSERT INTO uuid_tbl SELECT ('00000000-0000-0000-0000-' || lpad(i::text, 12, '0'))::uuid
+  FROM generate_series(1, 2000) i;
+INSERT INTO uuid_tbl SELECT md5('dup')::uuid FROM generate_series(1, 300);
+SELECT * FROM art_check('uuid_tbl',
+  'u = md5(''1'')::uuid',
+  'u = md5(''15000'')::uuid',
+  'u = md5(''dup'')::uuid',
+  'u = ''00000000-0000-0000-0000-000000000042''',
+  'u = ''00000000-0000-0000-0000-000000000000''',
+  'u = md5(''20001'')::uuid',
+  'u BETWEEN ''10000000-0000-0000-0000-000000000000'' AND ''30000000-0000-0000-0000-000000000000''',
+  'u < ''00000000-0000-0000-0000-000000001000''',
+  'u <= ''00000000-0000-0000-0000-000000001000''');
+DROP TABLE uuid_tbl;
+DROP FUNCTION art_check;
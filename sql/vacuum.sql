@@ -0,0 +1,98 @@
+--
+-- VACUUM removes deleted TIDs and empty structure, scans stay correct
+--
+-- Rows matching each qual by seqscan, and whether index and bitmap scans
+-- return same TIDs
+CREATE FUNCTION art_check(tbl regclass, VARIADIC quals text[])
+RETURNS TABLE (qual text, num_rows bigint, index_scan bool, bitmap_scan bool)
+LANGUAGE plpgsql AS $$
+DECLARE
+    query text;
+    seq_tids tid[];
+    index_tids tid[];
+    bitmap_tids tid[];
+BEGIN
+    FOREACH qual IN ARRAY quals LOOP
+        query := format('SELECT array_agg(ctid ORDER BY ctid) FROM %s WHERE %s', tbl, qual);
+        PERFORM set_config('enable_seqscan', 'on', true);
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'off', true);
+        EXECUTE query INTO seq_tids;
+        PERFORM set_config('enable_seqscan', 'off', true);
+        PERFORM set_config('enable_indexscan', 'on', true);
+        EXECUTE query INTO index_tids;
+        PERFORM set_config('enable_indexscan', 'off', true);
+        PERFORM set_config('enable_bitmapscan', 'on', true);
+        EXECUTE query INTO bitmap_tids;
+        num_rows := coalesce(cardinality(seq_tids), 0);
+        index_scan := index_tids IS NOT DISTINCT FROM seq_tids;
+        bitmap_scan := bitmap_tids IS NOT DISTINCT FROM seq_tids;
+        RETURN NEXT;
+    END LOOP;
+END
+$$;
+CREATE TABLE vac_tbl (k int4) WITH (autovacuum_enabled = off);
+CREATE INDEX vac_k_idx ON vac_tbl USING art (k);
+INSERT INTO vac_tbl SELECT i FROM generate_series(1, 10000) i;
+INSERT INTO vac_tbl SELECT i % 10 FROM generate_series(1, 2000) i;
+-- Whole subtrees are emptied, others lose some TIDs
+DELETE FROM vac_tbl WHERE k BETWEEN 2000 AND 5999;
+DELETE FROM vac_tbl WHERE k % 3 = 0;
+VACUUM vac_tbl;
+SELECT reltuples FROM pg_class WHERE relname = 'vac_k_idx';
+SELECT * FROM art_check('vac_tbl',
+  'k BETWEEN 2000 AND 5999',
+  'k < 10',
+  'k = 7',
+  'k = 6',
+  'k > 1500');
+-- Emptied key range takes inserts again
+INSERT INTO vac_tbl SELECT i FROM generate_series(3000, 3999) i;
+SELECT * FROM art_check('vac_tbl', 'k BETWEEN 2000 AND 5999');
+VACUUM vac_tbl;
+SELECT reltuples FROM pg_class WHERE relname = 'vac_k_idx';
+SELECT * FROM art_check('vac_tbl', 'k >= 3500');
+-- Index left empty
+DELETE FROM vac_tbl;
+VACUUM vac_tbl;
+SELECT reltuples FROM pg_class WHERE relname = 'vac_k_idx';
+SELECT * FROM art_check('vac_tbl', 'k > 0');
+INSERT INTO vac_tbl VALUES (1), (2), (2);
+SELECT * FROM art_check('vac_tbl', 'k = 2');
+DROP TABLE vac_tbl;
+--
+-- Index scans remove TIDs of deleted rows before VACUUM
+--
+CREATE TABLE kill_tbl (k int4, v int4) WITH (autovacuum_enabled = off);
+CREATE INDEX kill_k_idx ON kill_tbl USING art (k);
+INSERT INTO kill_tbl SELECT i % 500, i FROM generate_series(1, 20000) i;
+-- Some leaves lose all TIDs, others some of them
+DELETE FROM kill_tbl WHERE k % 4 = 0;
+DELETE FROM kill_tbl WHERE v % 7 = 0;
+-- First scans find deleted rows dead and remove their TIDs, second scans skip them
+SELECT * FROM art_check('kill_tbl',
+  'k < 250',
+  'k = 8',
+  'k = 7',
+  'k >= 100');
+SELECT * FROM art_check('kill_tbl',
+  'k < 250',
+  'k = 8',
+  'k = 7',
+  'k >= 100');
+-- Killed leaves take inserts again
+INSERT INTO kill_tbl SELECT i % 500, i FROM generate_series(20001, 21000) i;
+SELECT * FROM art_check('kill_tbl',
+  'k < 250',
+  'k = 8',
+  'k = 7',
+  'k >= 100');
+VACUUM kill_tbl;
+SELECT reltuples FROM pg_class WHERE relname = 'kill_k_idx';
+SELECT * FROM art_check('kill_tbl',
+  'k < 250',
+  'k = 8',
+  'k = 7',
+  'k >= 100');
+DROP TABLE kill_tbl;
+DROP FUNCTION art_check;
@@ -0,0 +1,96 @@
+# Check that ART index replayed by standby and by crash recovery returns
+# same rows as heap, with page contents verified by consistency checking.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $primary = PostgreSQL::Test::Cluster->new('primary');
+$primary->init(allows_streaming => 1);
+$primary->append_conf('postgresql.conf', qq(
+shared_preload_libraries = 'art'
+wal_consistency_checking = 'all'
+autovacuum = off
+));
+$primary->start;
+
+$primary->safe_psql('postgres', 'CREATE EXTENSION art');
+$primary->safe_psql('postgres', 'CREATE TABLE t (k int4, v text)');
+$primary->safe_psql('postgres', 'CREATE INDEX t_k ON t USING art (k)');
+
+my $backup_name = 'backup';
+$primary->backup($backup_name);
+
+my $standby = PostgreSQL::Test::Cluster->new('standby');
+$standby->init_from_backup($primary, $backup_name, has_streaming => 1);
+$standby->start;
+
+# Deleted and vacuumed items leave free space with stale bytes, which new
+# items then reuse.
+$primary->safe_psql('postgres', q(
+INSERT INTO t SELECT i % 5000, 'a' FROM generate_series(1, 20000) i;
+INSERT INTO t SELECT 7, 'b' FROM generate_series(1, 5000) i;
+DELETE FROM t WHERE k % 3 = 0 OR (k = 7 AND v = 'b');
+VACUUM t;
+INSERT INTO t SELECT i % 7000, 'c' FROM generate_series(1, 20000) i;
+DELETE FROM t WHERE k % 5 = 0;
+VACUUM t;
+INSERT INTO t SELECT (i * 7919) % 10000, 'd' FROM generate_series(1, 10000) i;
+));
+
+# Compare index scans with sequential scan of heap
+sub check_index
+{
+	my ($node, $name) = @_;
+
+	foreach my $qual ('k = 7', 'k = 4999', 'k < 100', 'k >= 6900', 'k > 0')
+	{
+		my $query = "SELECT count(*), sum(k), count(DISTINCT v) FROM t WHERE $qual";
+		my $expected = $node->safe_psql('postgres', qq(
+SET enable_indexscan = off; SET enable_bitmapscan = off; $query));
+		my $index_scan = $node->safe_psql('postgres', qq(
+SET enable_seqscan = off; SET enable_bitmapscan = off; $query));
+		my $bitmap_scan = $node->safe_psql('postgres', qq(
+SET enable_seqscan = off; SET enable_indexscan = off; $query));
+
+		is($index_scan, $expected, "$name: index scan of $qual");
+		is($bitmap_scan, $expected, "$name: bitmap scan of $qual");
+	}
+}
+
+$primary->wait_for_catchup($standby);
+check_index($primary, 'primary');
+check_index($standby, 'standby');
+
+# Index scans on primary remove TIDs of deleted rows before VACUUM, in
+# records standby replays.
+$primary->safe_psql('postgres', q(
+DELETE FROM t WHERE k % 11 = 0 OR v = 'd';
+));
+foreach my $qual ('k = 7', 'k < 1000', 'k >= 0')
+{
+	$primary->safe_psql('postgres', qq(
+SET enable_seqscan = off; SET enable_bitmapscan = off;
+SELECT count(*) FROM t WHERE $qual;
+));
+}
+
+$primary->wait_for_catchup($standby);
+check_index($primary, 'primary after killed items');
+check_index($standby, 'standby after killed items');
+
+# Crash recovery replays everything since last checkpoint
+$primary->safe_psql('postgres', 'CHECKPOINT');
+$primary->safe_psql('postgres', q(
+DELETE FROM t WHERE k % 7 = 0;
+VACUUM t;
+INSERT INTO t SELECT i % 3000, 'e' FROM generate_series(1, 10000) i;
+));
+$primary->stop('immediate');
+$primary->start;
+check_index($primary, 'crash recovery');
+
+done_testing();